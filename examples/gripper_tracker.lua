@@ -77,13 +77,6 @@ local function undistort(img)
   return undistImage
 end
 
-local function RGBtoBGR(img)
-  local out = img.new():resizeAs(img)
-  cv.cvtColor{img, out, cv.COLOR_RGB2BGR}
-  return out
-end
-
-
 local function findTargetPose(img)
   -- find circle pattern
   local ok, centers = cv.findCirclesGrid { image = img, patternSize = pattern.geom, flags = pattern.type }
@@ -169,7 +162,7 @@ local function processFrame(img)
 
   gripper_model:setPose(marker_pose * GRIPPER_MARKER_OFFSET * MM_TO_M * LEFT_UPPER_CORNER_TO_ORIGIN)
 
-  overlay_material:updateTextureRGB8(0, img:size(2), img:size(1), RGBtoBGR(img), true, true)
+  overlay_material:updateStreamingTexture(0, img, 'bgr')
 
   render()
 
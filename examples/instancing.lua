@@ -0,0 +1,45 @@
+local xgl = require 'xgl'
+
+xgl.init(true, 640, 480)
+
+local scene = xgl.SimpleScene()
+local camera = xgl.Camera()
+
+camera:setProjectionMatrix(camera.perspective(1, 640/480, 0.01, 20.0))
+camera:lookAt({0,3,6}, {0,0,0}, {0,1,0})
+scene:setCamera(camera)
+scene:setClearColor(0,0,0.5,1)
+
+-- one sphere mesh drawn 400 times with a single draw call
+local sphere = xgl.geo.sphere(0.1, 2)
+local markers = xgl.InstancedModel(sphere:getMeshAt(1))
+scene:addModel(markers)
+
+local n = 20
+local poses = torch.DoubleTensor(n*n, 4, 4)
+local colors = torch.FloatTensor(n*n, 4)
+for i=1,n do
+  for j=1,n do
+    local k = (i-1)*n + j
+    colors[k] = torch.FloatTensor({i/n, j/n, 1-i/n, 1})
+  end
+end
+
+while not xgl.windowShouldClose() do
+  local t = sys.clock()
+
+  for i=1,n do
+    for j=1,n do
+      local x, z = (i - n/2) * 0.3, (j - n/2) * 0.3
+      poses[(i-1)*n + j] = xgl.translate(x, 0.3 * math.sin(t + x + z), z)
+    end
+  end
+  markers:setInstances(poses, colors)
+
+  scene:render()
+  camera:swapBuffers()
+  xgl.pollEvents()
+  sys.sleep(0.01)
+end
+
+xgl.terminate()
@@ -53,7 +53,8 @@ local cloud = pcl.PointCloud('xyzrgba', camera:getWidth(), camera:getHeight())
 local points = cloud:points()
 
 
-camera:unprojectDepthImage(depth_image, points, points:stride(2))
+-- unprojection runs on the GPU (same coordinates and row order as camera:unprojectDepthImage)
+points[{{},{},{1,3}}]:copy(camera:copyPointCloud('camera', false, false))
 cloud:writeRGB(color_image, true, 255)
 
 -- show point cloud in viewer
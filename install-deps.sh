@@ -1,5 +1,6 @@
 #!/bin/bash
 sudo apt install libglfw3-dev
+sudo apt install libegl1-mesa-dev
 sudo apt install libglm-dev
 sudo apt install libglew-dev
 sudo apt install libsoil-dev
@@ -16,10 +16,32 @@ function init()
     'getPrincipalPoint',
     'getFocalLength',
     'setIntrinsics',
+    'setMultiSampleCount',
+    'getMultiSampleCount',
+    'setFxaaEnabled',
+    'isFxaaEnabled',
     'createRenderTarget',
+    'releaseRenderTargets',
+    'getGpuMemorySize',
     'copyRenderResultF32',
+    'beginReadback',
+    'isReadbackReady',
+    'waitReadback',
+    'getReadbackFormat',
+    'collectReadback',
+    'collectReadbackF32',
+    'cancelReadback',
+    'setReadbackRingSize',
     'unprojectDepthImage',
+    'unprojectDepthImageStrided',
+    'copyPointCloud',
+    'getPixelRays',
+    'copyGBuffer',
+    'copyGBufferF32',
+    'copyGBufferIds',
     'copyRenderResult',
+    'copyBatchResult',
+    'copyBatchResultF32',
     'swapBuffers',
     'lookAt',
     'getViewMatrix',
@@ -120,10 +142,35 @@ function Camera:setIntrinsics(fx, fy, cx, cy, im_width, im_height)
   end
 end
 
+-- Anti-aliasing of color renders. samples: MSAA samples per pixel, clamped to the maximum of
+-- the GL implementation (default 16), 0 disables multi-sampling. fxaa: post-process AA when the
+-- result is resolved, cheap compared to high sample counts at large image sizes.
+-- E.g. camera:setAntiAliasing(0, true) for speed, camera:setAntiAliasing(16) for quality.
+function Camera:setAntiAliasing(samples, fxaa)
+  if samples ~= nil then
+    f.setMultiSampleCount(self.o, samples)
+  end
+  f.setFxaaEnabled(self.o, fxaa or false)
+end
+
+function Camera:getAntiAliasing()
+  return f.getMultiSampleCount(self.o), f.isFxaaEnabled(self.o)
+end
+
 function Camera:createRenderTarget()
   f.createRenderTarget(self.o)
 end
 
+-- Returns the render targets to the shared pool, they are reacquired on the next render.
+function Camera:releaseRenderTargets()
+  f.releaseRenderTargets(self.o)
+end
+
+-- Estimated GPU memory held by the render targets of the camera in bytes.
+function Camera:getGpuMemorySize()
+  return f.getGpuMemorySize(self.o)
+end
+
 function Camera:copyRenderResult(vflip, output)
   if vflip == nil then vflip = true end
   output = output or torch.ByteTensor()
@@ -138,8 +185,152 @@ function Camera:copyRenderResultF32(vflip, output)
   return output
 end
 
-function Camera:unprojectDepthImage(depth_input, xyz_output, output_stride)
-  f.unprojectDepthImage(self.o, depth_input:cdata(), xyz_output:cdata(), output_stride)
+local READBACK_FORMAT = { rgb = 0, f32 = 1 }
+
+-- Asynchronous readback: start copying the last render result into a pixel pack buffer and
+-- return a ticket, e.g. render frame N, beginReadback, render frame N+1, collectReadback(N).
+-- format: 'rgb' (default, like copyRenderResult) or 'f32' (like copyRenderResultF32)
+function Camera:beginReadback(format)
+  local f_ = READBACK_FORMAT[format or 'rgb']
+  if f_ == nil then
+    error('Invalid readback format specified.')
+  end
+  return f.beginReadback(self.o, f_)
+end
+
+function Camera:isReadbackReady(ticket)
+  return f.isReadbackReady(self.o, ticket)
+end
+
+-- Blocks until the readback is done or timeout (in seconds, default infinite) expired.
+function Camera:waitReadback(ticket, timeout)
+  return f.waitReadback(self.o, ticket, timeout or -1)
+end
+
+function Camera:collectReadback(ticket, vflip, output)
+  if vflip == nil then vflip = true end
+  if f.getReadbackFormat(self.o, ticket) == READBACK_FORMAT.f32 then
+    output = output or torch.FloatTensor()
+    f.collectReadbackF32(self.o, ticket, vflip, output:cdata())
+  else
+    output = output or torch.ByteTensor()
+    f.collectReadback(self.o, ticket, vflip, output:cdata())
+  end
+  return output
+end
+
+function Camera:cancelReadback(ticket)
+  f.cancelReadback(self.o, ticket)
+end
+
+function Camera:setReadbackRingSize(size)
+  f.setReadbackRingSize(self.o, size)
+end
+
+-- Unprojects a HxW depth image (e.g. of a real sensor) on all CPU cores. With output_stride
+-- points are written consecutively into xyz_output. Otherwise xyz_output is used as a HxWxC
+-- tensor through its strides (e.g. a narrowed view of PCL points) and resized to HxWx3 if it
+-- does not fit. frame: 'camera' (default) or 'world'. Depth values outside (min_depth,
+-- max_depth), default (0, inf), and NaNs produce NaN points.
+function Camera:unprojectDepthImage(depth_input, xyz_output, output_stride, frame, min_depth, max_depth)
+  if output_stride ~= nil and frame == nil and min_depth == nil and max_depth == nil then
+    f.unprojectDepthImage(self.o, depth_input:cdata(), xyz_output:cdata(), output_stride)
+    return xyz_output
+  end
+  local frame_ = Camera.POINT_CLOUD_FRAME[frame or 'camera']
+  if frame_ == nil then
+    error('Invalid point cloud frame, expected \'camera\' or \'world\'.')
+  end
+  xyz_output = xyz_output or torch.FloatTensor()
+  local xyz = xyz_output
+  if output_stride ~= nil then
+    xyz = xyz_output:view(depth_input:size(1), depth_input:size(2), output_stride)
+  end
+  f.unprojectDepthImageStrided(self.o, depth_input:cdata(), xyz:cdata(), frame_, min_depth or 0, max_depth or math.huge)
+  return xyz_output
+end
+
+Camera.POINT_CLOUD_FRAME = {
+  camera = 0,
+  world = 1
+}
+
+-- Unprojects the last depth render (SimpleScene:renderDepth) on the GPU and returns an organized
+-- HxWx3 point cloud with a single readback. frame: 'camera' (default, same coordinates as
+-- unprojectDepthImage) or 'world'. With with_color a fourth channel holds the color of the last
+-- render() packed like the rgba field of PCL points.
+function Camera:copyPointCloud(frame, with_color, vflip, output)
+  local frame_ = Camera.POINT_CLOUD_FRAME[frame or 'camera']
+  if frame_ == nil then
+    error('Invalid point cloud frame, expected \'camera\' or \'world\'.')
+  end
+  if vflip == nil then vflip = true end
+  output = output or torch.FloatTensor()
+  f.copyPointCloud(self.o, frame_, with_color or false, vflip, output:cdata())
+  return output
+end
+
+-- Returns world space rays (Nx6: origin, unit direction) through pixel positions (Nx2 tensor or
+-- table of {x, y}, pixel centers at +0.5). With vflip (default true) y counts from the top row,
+-- like images copied with vflip.
+function Camera:getPixelRays(pixels, vflip, output)
+  if type(pixels) == 'table' then
+    pixels = torch.FloatTensor(pixels)
+  end
+  if vflip == nil then vflip = true end
+  output = output or torch.FloatTensor()
+  f.getPixelRays(self.o, pixels:float():contiguous():view(-1, 2):cdata(), vflip, output:cdata())
+  return output
+end
+
+local GBUFFER_COMPONENT = { color = 0, depth = 1, normal = 2, id = 3 }
+
+-- Reads images of the last SimpleScene:renderGBuffer. components: list of 'color' (HxWx3 byte),
+-- 'depth' (HxW float, linear, NaN for background), 'normal' (HxWx3 float, view space) and 'id'
+-- (HxWx2 int: model id and mesh index, 0 for background); default all. Returns a table
+-- indexed by component name.
+function Camera:copyGBuffer(components, vflip)
+  components = components or { 'color', 'depth', 'normal', 'id' }
+  if type(components) == 'string' then
+    components = { components }
+  end
+  if vflip == nil then vflip = true end
+
+  local result = {}
+  for _, name in ipairs(components) do
+    local c = GBUFFER_COMPONENT[name]
+    if c == nil then
+      error(string.format('Invalid G-buffer component \'%s\'.', tostring(name)))
+    end
+    local output
+    if name == 'color' then
+      output = torch.ByteTensor()
+      f.copyGBuffer(self.o, vflip, output:cdata())
+    elseif name == 'id' then
+      output = torch.IntTensor()
+      f.copyGBufferIds(self.o, vflip, output:cdata())
+    else
+      output = torch.FloatTensor()
+      f.copyGBufferF32(self.o, c, vflip, output:cdata())
+    end
+    result[name] = output
+  end
+  return result
+end
+
+-- Returns all images of the last SimpleScene:renderPoses/renderViews batch, NxHxWx3 (color) or NxHxW (depth).
+function Camera:copyBatchResult(vflip, output)
+  if vflip == nil then vflip = true end
+  output = output or torch.ByteTensor()
+  f.copyBatchResult(self.o, vflip, output:cdata())
+  return output
+end
+
+function Camera:copyBatchResultF32(vflip, output)
+  if vflip == nil then vflip = true end
+  output = output or torch.FloatTensor()
+  f.copyBatchResultF32(self.o, vflip, output:cdata())
+  return output
 end
 
 function Camera:swapBuffers()
@@ -0,0 +1,48 @@
+local torch = require 'torch'
+local xgl = require 'xgl.env'
+local utils = require 'xgl.utils'
+
+local InstancedModel, parent = torch.class('xgl.InstancedModel', 'xgl.Model', xgl)
+
+function init()
+  local method_names = {
+    'new',
+    'delete',
+    'setInstances',
+    'getInstanceCount'
+  }
+
+  return utils.create_method_table('xgl_InstancedModel_', method_names)
+end
+
+local f = init()
+
+-- Draws mesh once per instance with a single draw call. The shaders used (default_shader and
+-- the shader of the mesh material) have to read the per-instance attributes like the default
+-- shaders do: mat4 instanceTransform at location 4 and vec4 instanceColor at location 8.
+function InstancedModel:__init(mesh, default_shader)
+  default_shader = default_shader or xgl.getDefaultShader()
+  self.o = f.new(mesh:cdata(), default_shader:cdata())
+end
+
+-- transforms: Nx4x4 (or 4x4) tensor of instance poses relative to the model pose,
+-- colors: optional 4 or Nx4 tensor/table, an alpha of 0 keeps the vertex colors.
+function InstancedModel:setInstances(transforms, colors)
+  if type(transforms) == 'table' then
+    transforms = torch.DoubleTensor(transforms)
+  end
+  if transforms ~= nil then
+    transforms = transforms:double()
+  end
+  if type(colors) == 'table' then
+    colors = torch.FloatTensor(colors)
+  end
+  if colors ~= nil then
+    colors = colors:float()
+  end
+  f.setInstances(self.o, utils.cdata(transforms), utils.cdata(colors))
+end
+
+function InstancedModel:getInstanceCount()
+  return f.getInstanceCount(self.o)
+end
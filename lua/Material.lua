@@ -25,7 +25,8 @@ function init()
     'setDepthTest',
     'getDepthWrite',
     'setDepthWrite',
-    'updateTextureRGB8'
+    'updateTextureRGB8',
+    'updateStreamingTexture'
   }
 
   return utils.create_method_table('xgl_Material_', method_names)
@@ -129,3 +130,25 @@ end
 function Material:updateTextureRGB8(index, width, height, image, flipV, generateMipmap)
   f.updateTextureRGB8(self.o, index, width, height, image:cdata(), flipV ~= nil and flipV or false, generateMipmap or false)
 end
+
+local PIXEL_FORMAT = { gray = 0, rgb = 1, bgr = 2, rgba = 3, bgra = 4 }
+
+-- Streams a ByteTensor image (HxW or HxWxC) into texture 'index' without CPU side conversion,
+-- intended for images that change every frame. format: 'gray', 'rgb', 'bgr', 'rgba' or 'bgra',
+-- defaults to the OpenCV channel order ('gray', 'bgr' or 'bgra'). flipV shows images stored top
+-- row first upright by flipping the texture coordinates of all textures, it is only supported for
+-- index 0 (default true there, false otherwise).
+function Material:updateStreamingTexture(index, image, format, flipV, generateMipmap)
+  if flipV == nil then
+    flipV = index == 0
+  end
+  if format == nil then
+    local channels = image:dim() == 3 and image:size(3) or 1
+    format = channels == 1 and 'gray' or channels == 4 and 'bgra' or 'bgr'
+  end
+  local format_ = PIXEL_FORMAT[format]
+  if format_ == nil then
+    error(string.format('Invalid pixel format \'%s\'.', tostring(format)))
+  end
+  f.updateStreamingTexture(self.o, index, image:cdata(), format_, flipV, generateMipmap or false)
+end
@@ -12,6 +12,12 @@ function init()
     'release',
     'isNull',
     'getVertices',
+    'getGpuMemorySize',
+    'hasData',
+    'updateVertices',
+    'updateIndices',
+    'getVertexCount',
+    'getIndexCount',
     'getMaterial',
     'setMaterial'
   }
@@ -21,15 +27,29 @@ end
 
 local f = init()
 
+-- GPU storage of normals, texture coordinates and colors, 'compact' uses packed 10 bit normals,
+-- half float texture coordinates and 8 bit colors, 'full' stores 32 bit floats.
+Mesh.PRECISION = {
+  compact = 0,
+  full = 1
+}
+
 function Mesh.createUnassigned()
   local obj = torch.factory('xgl.Mesh')()
   obj.o = f.new()
   return obj
 end
 
-function Mesh:__init(vertices, indices, material)
+-- vertices: Nx3, Nx6, Nx8 or Nx12 float tensor (position, normal, uv, color), uploaded without
+-- intermediate copy when contiguous and precision is 'full'. A CPU copy of the mesh data is
+-- only kept when keep_data is true, getVertices() reads back from the GPU otherwise.
+function Mesh:__init(vertices, indices, material, precision, keep_data)
+  precision = Mesh.PRECISION[precision or 'compact']
+  if precision == nil then
+    error('Invalid vertex precision, expected \'compact\' or \'full\'.')
+  end
   self.o = f.new()
-  f.create(self.o, vertices:cdata(), indices:cdata(), utils.cdata(material))
+  f.create(self.o, vertices:cdata(), indices:cdata(), utils.cdata(material), precision, keep_data or false)
 end
 
 function Mesh:cdata()
@@ -50,6 +70,36 @@ function Mesh:getVertices()
   return vertices
 end
 
+-- Size of vertex and index buffers on the GPU in bytes.
+function Mesh:getGpuMemorySize()
+  return f.getGpuMemorySize(self.o)
+end
+
+function Mesh:hasData()
+  return f.hasData(self.o)
+end
+
+-- Writes vertex rows (same format as for __init) starting at vertex index offset (1-based),
+-- rows past the end are appended. Without offset all vertices are replaced. The vertex layout
+-- of the mesh is kept, e.g. colors are dropped when the mesh was created without colors.
+function Mesh:updateVertices(vertices, offset)
+  f.updateVertices(self.o, vertices:cdata(), offset and offset - 1 or -1)
+end
+
+-- Writes 0-based vertex indices starting at offset (1-based), without offset all indices are
+-- replaced.
+function Mesh:updateIndices(indices, offset)
+  f.updateIndices(self.o, indices:cdata(), offset and offset - 1 or -1)
+end
+
+function Mesh:getVertexCount()
+  return f.getVertexCount(self.o)
+end
+
+function Mesh:getIndexCount()
+  return f.getIndexCount(self.o)
+end
+
 function Mesh:getMaterial()
   local material = xgl.Material.createUnassigned()
   f.getMaterial(self.o, material:cdata())
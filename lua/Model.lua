@@ -11,6 +11,13 @@ function init()
     'loadModel',
     'getPose',
     'setPose',
+    'getId',
+    'setId',
+    'getFrustumCulling',
+    'setFrustumCulling',
+    'getClipSpace',
+    'setClipSpace',
+    'generateLods',
     'addMesh',
     'addMesh_Tensor',
     'getMeshCount',
@@ -38,6 +45,17 @@ function Model:loadModel(filename)
   f.loadModel(self.o, filename)
 end
 
+-- Creates a model and loads filename in the background, returns an xgl.ModelLoad handle. The
+-- model (handle:getModel()) can be added to a scene right away, meshes appear as they are loaded.
+function Model.loadAsync(filename, default_shader)
+  return xgl.ModelLoad(xgl.Model(default_shader), filename)
+end
+
+-- Loads filename into this model in the background, returns an xgl.ModelLoad handle.
+function Model:loadModelAsync(filename)
+  return xgl.ModelLoad(self, filename)
+end
+
 function Model:getPose(output)
   output = output or torch.DoubleTensor()
   f.getPose(self.o, output:cdata())
@@ -48,6 +66,38 @@ function Model:setPose(pose)
   f.setPose(self.o, pose:cdata())
 end
 
+-- Id written to the id image of SimpleScene:renderGBuffer, unique per model by default.
+function Model:getId()
+  return f.getId(self.o)
+end
+
+function Model:setId(id)
+  f.setId(self.o, id)
+end
+
+function Model:getFrustumCulling()
+  return f.getFrustumCulling(self.o)
+end
+
+function Model:setFrustumCulling(value)
+  f.setFrustumCulling(self.o, value)
+end
+
+-- Marks models drawn with shaders that ignore the model, view and projection transforms (e.g.
+-- full-screen overlays). Scene:addQuad sets it for quads whose shader has no projection.
+function Model:getClipSpace()
+  return f.getClipSpace(self.o)
+end
+
+function Model:setClipSpace(value)
+  f.setClipSpace(self.o, value)
+end
+
+-- Replaces the levels of detail of all meshes, e.g. for meshes not loaded from files.
+function Model:generateLods(level_count)
+  f.generateLods(self.o, level_count or 3)
+end
+
 function Model:addMesh(vertices, indices, shader, color)
   if torch.isTypeOf(vertices, xgl.Mesh) then
     f.addMesh(self.o, vertices:cdata())
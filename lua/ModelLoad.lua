@@ -0,0 +1,87 @@
+local ffi = require 'ffi'
+local torch = require 'torch'
+local xgl = require 'xgl.env'
+local utils = require 'xgl.utils'
+
+local ModelLoad = torch.class('xgl.ModelLoad', xgl)
+
+function init()
+  local method_names = {
+    'new',
+    'delete',
+    'getState',
+    'isDone',
+    'getError',
+    'wait',
+    'cancel'
+  }
+
+  return utils.create_method_table('xgl_ModelLoad_', method_names)
+end
+
+local f = init()
+
+ModelLoad.STATE = {
+  importing = 0,
+  uploading = 1,
+  ready = 2,
+  failed = 3,
+  cancelled = 4
+}
+
+local STATE_NAMES = {}
+for k,v in pairs(ModelLoad.STATE) do
+  STATE_NAMES[v] = k
+end
+
+-- Loads filename into model in the background, use Model.loadAsync() to create one. Import and
+-- texture decoding run on loader threads, GL uploads happen during SimpleScene:render() (a few
+-- milliseconds per frame, see xgl.setUploadBudget) or in wait().
+function ModelLoad:__init(model, filename)
+  self.model = model      -- keeps the model alive while loading
+  self.o = f.new(model:cdata(), filename)
+end
+
+function ModelLoad:cdata()
+  return self.o
+end
+
+function ModelLoad:getModel()
+  return self.model
+end
+
+-- Returns 'importing', 'uploading', 'ready', 'failed' or 'cancelled'.
+function ModelLoad:getState()
+  return STATE_NAMES[f.getState(self.o)]
+end
+
+function ModelLoad:isDone()
+  return f.isDone(self.o)
+end
+
+function ModelLoad:getError()
+  if self:getState() ~= 'failed' then
+    return nil
+  end
+  return ffi.string(f.getError(self.o))
+end
+
+-- Blocks until the load is done (timeout in seconds, default: none), returns the model or
+-- nil and the error message. Returns nil, 'timeout' if the timeout expired.
+function ModelLoad:wait(timeout)
+  if not f.wait(self.o, timeout or -1) then
+    return nil, 'timeout'
+  end
+  local state = self:getState()
+  if state == 'failed' then
+    return nil, self:getError()
+  elseif state == 'cancelled' then
+    return nil, 'cancelled'
+  end
+  return self.model
+end
+
+-- Stops the load, meshes uploaded so far stay in the model.
+function ModelLoad:cancel()
+  f.cancel(self.o)
+end
@@ -11,9 +11,23 @@ function init()
     'delete',
     'render',
     'renderDepth',
+    'renderGBuffer',
+    'renderPoses',
+    'renderViews',
+    'getRenderStats',
+    'castRays',
+    'castPixelRays',
     'setClearColor',
     'getOverrideMaterial',
     'setOverrideMaterial',
+    'getFrustumCulling',
+    'setFrustumCulling',
+    'getOcclusionCulling',
+    'setOcclusionCulling',
+    'getLodThreshold',
+    'setLodThreshold',
+    'getForcedLod',
+    'setForcedLod',
     'setCamera',
     'addModel',
     'clearModels',
@@ -37,6 +51,50 @@ function SimpleScene:render()
   f.render(self.o)
 end
 
+local function toFloatRows(x, columns)
+  if type(x) == 'table' then
+    x = torch.FloatTensor(x)
+  end
+  return x:float():contiguous():view(-1, columns)
+end
+
+-- Intersects rays (Nx6 tensor or table of {ox, oy, oz, dx, dy, dz} in world coordinates) with
+-- the meshes of the scene on the CPU, without rendering. Returns the hit distances (N, in
+-- multiples of the direction length, NaN for misses), ids (Nx3 int: model id, mesh index and
+-- triangle index, 1-based, 0 for misses) and the barycentric weights of the second and third
+-- triangle vertex (Nx2).
+function SimpleScene:castRays(rays, max_distance)
+  local distances, ids, barycentrics = torch.FloatTensor(), torch.IntTensor(), torch.FloatTensor()
+  f.castRays(self.o, toFloatRows(rays, 6):cdata(), max_distance or math.huge, distances:cdata(), ids:cdata(), barycentrics:cdata())
+  return distances, ids, barycentrics
+end
+
+-- Casts the rays of the scene camera through pixel positions (Nx2 tensor or table of {x, y}),
+-- see Camera:getPixelRays and SimpleScene:castRays.
+function SimpleScene:castPixelRays(pixels, vflip, max_distance)
+  if vflip == nil then vflip = true end
+  local distances, ids, barycentrics = torch.FloatTensor(), torch.IntTensor(), torch.FloatTensor()
+  f.castPixelRays(self.o, toFloatRows(pixels, 2):cdata(), vflip, max_distance or math.huge, distances:cdata(), ids:cdata(), barycentrics:cdata())
+  return distances, ids, barycentrics
+end
+
+-- Returns draw call, GL state change, culled, occluded and reduced detail mesh counters of the last
+-- rendered frame.
+function SimpleScene:getRenderStats()
+  local stats = ffi.new('RenderStats')
+  f.getRenderStats(self.o, stats)
+  return {
+    drawCalls = stats.drawCalls,
+    skippedDrawCalls = stats.skippedDrawCalls,
+    stateChanges = stats.stateChanges,
+    redundantStateChanges = stats.redundantStateChanges,
+    culledMeshes = stats.culledMeshes,
+    occludedMeshes = stats.occludedMeshes,
+    occlusionQueries = stats.occlusionQueries,
+    reducedMeshes = stats.reducedMeshes
+  }
+end
+
 function SimpleScene:renderDepth(clear_depth, depth_material, output)
   clear_depth = clear_depth or 0/0
   self:setClearColor(clear_depth, 0, 0, 1)
@@ -49,6 +107,79 @@ function SimpleScene:renderDepth(clear_depth, depth_material, output)
   return depth_image
 end
 
+-- Renders color, linear depth, view-space normals and model/mesh ids in a single pass and
+-- returns the requested components, see Camera:copyGBuffer. Shaders have to write the extra
+-- fragment outputs like the default shader does.
+function SimpleScene:renderGBuffer(components, vflip)
+  f.renderGBuffer(self.o)
+  return self.camera:copyGBuffer(components, vflip)
+end
+
+-- Renders depth (and color when with_color is set) and returns the organized point cloud
+-- computed on the GPU, see Camera:copyPointCloud. Pixels without geometry are NaN.
+function SimpleScene:renderPointCloud(frame, with_color, vflip, output)
+  if with_color then
+    self:render()
+  end
+  self:setClearColor(0/0, 0, 0, 1)
+  local old_override_material = self:getOverrideMaterial()
+  self:setOverrideMaterial(xgl.getDefaultDepthMaterial())
+  local ok, err = pcall(f.renderDepth, self.o)
+  self:setOverrideMaterial(old_override_material)
+  if not ok then
+    error(err)
+  end
+  return self.camera:copyPointCloud(frame, with_color, vflip, output)
+end
+
+local function toDoubleTensor(x)
+  if type(x) == 'table' then
+    return torch.DoubleTensor(x)
+  end
+  return x:double()
+end
+
+-- Renders model once per pose (Nx4x4 tensor) and returns all color images as NxHxWx3 tensor.
+function SimpleScene:renderPoses(model, poses, vflip, output)
+  f.renderPoses(self.o, model:cdata(), toDoubleTensor(poses):cdata(), false)
+  return self.camera:copyBatchResult(vflip, output)
+end
+
+-- Depth variant of renderPoses, returns a NxHxW float tensor.
+function SimpleScene:renderPosesDepth(model, poses, clear_depth, depth_material, output)
+  clear_depth = clear_depth or 0/0
+  self:setClearColor(clear_depth, 0, 0, 1)
+  depth_material = depth_material or xgl.getDefaultDepthMaterial()
+  local old_override_material = self:getOverrideMaterial()
+  self:setOverrideMaterial(depth_material)
+  local ok, err = pcall(f.renderPoses, self.o, model:cdata(), toDoubleTensor(poses):cdata(), true)
+  self:setOverrideMaterial(old_override_material)
+  if not ok then
+    error(err)
+  end
+  return self.camera:copyBatchResultF32(false, output)
+end
+
+-- Renders the scene once per camera view matrix (Nx4x4 tensor) and returns a NxHxWx3 tensor.
+function SimpleScene:renderViews(views, vflip, output)
+  f.renderViews(self.o, toDoubleTensor(views):cdata(), false)
+  return self.camera:copyBatchResult(vflip, output)
+end
+
+function SimpleScene:renderViewsDepth(views, clear_depth, depth_material, output)
+  clear_depth = clear_depth or 0/0
+  self:setClearColor(clear_depth, 0, 0, 1)
+  depth_material = depth_material or xgl.getDefaultDepthMaterial()
+  local old_override_material = self:getOverrideMaterial()
+  self:setOverrideMaterial(depth_material)
+  local ok, err = pcall(f.renderViews, self.o, toDoubleTensor(views):cdata(), true)
+  self:setOverrideMaterial(old_override_material)
+  if not ok then
+    error(err)
+  end
+  return self.camera:copyBatchResultF32(false, output)
+end
+
 function SimpleScene:setClearColor(r, g, b, a)
   f.setClearColor(self.o, r, g, b, a)
 end
@@ -66,6 +197,44 @@ end
 function SimpleScene:setOverrideMaterial(value)
   f.setOverrideMaterial(self.o, utils.cdata(value))
 end
+
+-- Meshes outside the camera frustum are skipped (default: enabled).
+function SimpleScene:getFrustumCulling()
+  return f.getFrustumCulling(self.o)
+end
+
+function SimpleScene:setFrustumCulling(value)
+  f.setFrustumCulling(self.o, value)
+end
+
+function SimpleScene:getOcclusionCulling()
+  return f.getOcclusionCulling(self.o)
+end
+
+function SimpleScene:setOcclusionCulling(value)
+  f.setOcclusionCulling(self.o, value)
+end
+
+-- Color renders draw meshes at the coarsest level of detail whose RMS simplification error
+-- stays below this many pixels (e.g. 1). 0, the default, draws full detail. Depth, point cloud
+-- and G-buffer renders always use full detail unless a level is forced.
+function SimpleScene:getLodThreshold()
+  return f.getLodThreshold(self.o)
+end
+
+function SimpleScene:setLodThreshold(pixels)
+  f.setLodThreshold(self.o, pixels)
+end
+
+-- Forces a level of detail for all meshes in every render, including depth renders. -1 or nil
+-- restores the automatic selection.
+function SimpleScene:getForcedLod()
+  return f.getForcedLod(self.o)
+end
+
+function SimpleScene:setForcedLod(level)
+  f.setForcedLod(self.o, level or -1)
+end
     
 function SimpleScene:setCamera(camera)
   self.camera = camera
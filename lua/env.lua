@@ -17,23 +17,79 @@ typedef struct FrameBufferLimits {
   int maxLayers;
 } FrameBufferLimits;
 
+typedef struct RenderStats {
+  int drawCalls;
+  int skippedDrawCalls;
+  int stateChanges;
+  int redundantStateChanges;
+  int culledMeshes;
+  int occludedMeshes;
+  int occlusionQueries;
+  int reducedMeshes;
+} RenderStats;
+
+typedef struct TextureCacheStats {
+  double hits;
+  double misses;
+  double evictions;
+  double textureCount;
+  double byteSize;
+  double budget;
+} TextureCacheStats;
+
+typedef struct ImportOptimizeStats {
+  double meshCount;
+  double inputVertices;
+  double outputVertices;
+  double inputIndices;
+  double outputIndices;
+  double inputCacheMisses;
+  double outputCacheMisses;
+} ImportOptimizeStats;
+
 typedef struct Camera {} Camera;
 typedef struct Model {} Model;
 typedef struct Shader {} Shader;
 typedef struct SimpleScene {} SimpleScene;
 typedef struct MaterialHandle {} MaterialHandle;
 typedef struct MeshHandle {} MeshHandle;
+typedef struct ModelLoad {} ModelLoad;
 typedef struct ShaderHandle {} ShaderHandle;
 
-void xgl___init(bool show_window, int window_width, int window_height);
+void xgl___init(bool show_window, int window_width, int window_height, const char *backend);
 void xgl___terminate();
+const char *xgl___getBackend();
 void xgl___pollEvents();
 bool xgl___windowShouldClose();
+double xgl___getRenderTargetPoolSize();
+void xgl___trimRenderTargetPool(double maxBytes);
+void xgl___setRenderTargetPoolBudget(double bytes);
+void xgl___getTextureCacheStats(TextureCacheStats *stats);
+void xgl___resetTextureCacheCounters();
+void xgl___trimTextureCache(double maxBytes);
+void xgl___setTextureCacheBudget(double bytes);
+void xgl___setMeshCacheDirectory(const char *path);
+const char *xgl___getMeshCacheDirectory();
+void xgl___setImportLodOptions(int levelCount, int minTriangles);
+void xgl___getImportLodOptions(int *levelCount, int *minTriangles);
+void xgl___setImportOptimization(bool enabled, float weldTolerance, float weldNormalAngle);
+void xgl___getImportOptimization(bool *enabled, float *weldTolerance, float *weldNormalAngle);
+void xgl___getImportOptimizeStats(ImportOptimizeStats *stats);
+void xgl___resetImportOptimizeStats();
+int xgl___processUploads(double maxMilliseconds);
+void xgl___setUploadBudget(double milliseconds);
 
 Camera *xgl_Camera_new();
 void xgl_Camera_delete(Camera *camera);
 void xgl_Camera_getImageSize(Camera *camera, THIntTensor *output);
 void xgl_Camera_setImageSize(Camera *camera, int width, int height);
+void xgl_Camera_setMultiSampleCount(Camera *camera, int samples);
+int xgl_Camera_getMultiSampleCount(Camera *camera);
+void xgl_Camera_setFxaaEnabled(Camera *camera, bool enabled);
+bool xgl_Camera_isFxaaEnabled(Camera *camera);
+void xgl_Camera_createRenderTarget(Camera *camera);
+void xgl_Camera_releaseRenderTargets(Camera *camera);
+double xgl_Camera_getGpuMemorySize(Camera *camera);
 void xgl_Camera_getClipNearFar(Camera *camera, THDoubleTensor *output);
 void xgl_Camera_setClipNearFar(Camera *camera, float near, float far);
 float xgl_Camera_getAspectRatio(Camera *camera);
@@ -42,7 +98,23 @@ void xgl_Camera_getFocalLength(Camera *camera, THDoubleTensor *output);
 void xgl_Camera_setIntrinsics(Camera *camera, float fx, float fy, float cx, float cy);
 void xgl_Camera_copyRenderResult(Camera *camera, bool vflip, THByteTensor *output);
 void xgl_Camera_copyRenderResultF32(Camera *camera, bool vflip, THFloatTensor *output);
+int xgl_Camera_beginReadback(Camera *camera, int format);
+bool xgl_Camera_isReadbackReady(Camera *camera, int ticket);
+bool xgl_Camera_waitReadback(Camera *camera, int ticket, double timeout);
+int xgl_Camera_getReadbackFormat(Camera *camera, int ticket);
+void xgl_Camera_collectReadback(Camera *camera, int ticket, bool vflip, THByteTensor *output);
+void xgl_Camera_collectReadbackF32(Camera *camera, int ticket, bool vflip, THFloatTensor *output);
+void xgl_Camera_cancelReadback(Camera *camera, int ticket);
+void xgl_Camera_setReadbackRingSize(Camera *camera, int size);
 void xgl_Camera_unprojectDepthImage(Camera *camera, THFloatTensor *depthInput, THFloatTensor *xyzOutput, int outputStride);
+void xgl_Camera_unprojectDepthImageStrided(Camera *camera, THFloatTensor *depth, THFloatTensor *xyz, int frame, float minDepth, float maxDepth);
+void xgl_Camera_copyPointCloud(Camera *camera, int frame, bool withColor, bool vflip, THFloatTensor *output);
+void xgl_Camera_getPixelRays(Camera *camera, THFloatTensor *pixels, bool vflip, THFloatTensor *rays);
+void xgl_Camera_copyGBuffer(Camera *camera, bool vflip, THByteTensor *output);
+void xgl_Camera_copyGBufferF32(Camera *camera, int component, bool vflip, THFloatTensor *output);
+void xgl_Camera_copyGBufferIds(Camera *camera, bool vflip, THIntTensor *output);
+void xgl_Camera_copyBatchResult(Camera *camera, bool vflip, THByteTensor *output);
+void xgl_Camera_copyBatchResultF32(Camera *camera, bool vflip, THFloatTensor *output);
 void xgl_Camera_swapBuffers(Camera *camera);
 void xgl_Camera_lookAt(Camera *camera, THDoubleTensor *eye, THDoubleTensor *at, THDoubleTensor *up);
 void xgl_Camera_getViewMatrix(Camera *camera, THDoubleTensor *output);
@@ -68,11 +140,26 @@ void xgl_Model_delete(Model *model);
 void xgl_Model_loadModel(Model *model, const char *filePath);
 void xgl_Model_getPose(Model *model, THDoubleTensor *output);
 void xgl_Model_setPose(Model *model, THDoubleTensor *input);
+int xgl_Model_getId(Model *model);
+void xgl_Model_setId(Model *model, int id);
+bool xgl_Model_getFrustumCulling(Model *model);
+void xgl_Model_setFrustumCulling(Model *model, bool value);
+bool xgl_Model_getClipSpace(Model *model);
+void xgl_Model_setClipSpace(Model *model, bool value);
+void xgl_Model_generateLods(Model *model, int levelCount);
 void xgl_Model_addMesh(Model *model, MeshHandle *mesh);
 void xgl_Model_addMesh_Tensor(Model *model, THFloatTensor *vertices, THIntTensor *indices, ShaderHandle *shader, THFloatTensor *color);
 int xgl_Model_getMeshCount(Model *model);
 void xgl_Model_getMeshAt(Model *model, int index, MeshHandle *output);
 
+ModelLoad *xgl_ModelLoad_new(Model *model, const char *filePath);
+void xgl_ModelLoad_delete(ModelLoad *load);
+int xgl_ModelLoad_getState(ModelLoad *load);
+bool xgl_ModelLoad_isDone(ModelLoad *load);
+const char *xgl_ModelLoad_getError(ModelLoad *load);
+bool xgl_ModelLoad_wait(ModelLoad *load, double timeout);
+void xgl_ModelLoad_cancel(ModelLoad *load);
+
 MaterialHandle * xgl_Material_new();
 void xgl_Material_delete(MaterialHandle *material);
 void xgl_Material_create(MaterialHandle *material);
@@ -93,23 +180,49 @@ void xgl_Material_setDepthTest(MaterialHandle *material, bool value);
 bool xgl_Material_getDepthWrite(MaterialHandle *material);
 void xgl_Material_setDepthWrite(MaterialHandle *material, bool value);
 void xgl_Material_updateTextureRGB8(MaterialHandle *material, int index, int width, int height, THByteTensor *image, bool flipV, bool generateMipmap);
+void xgl_Material_updateStreamingTexture(MaterialHandle *material, int index, THByteTensor *image, int format, bool flipV, bool generateMipmap);
 
 MeshHandle * xgl_Mesh_new();
 void xgl_Mesh_delete(MeshHandle *mesh);
-void xgl_Mesh_create(MeshHandle *mesh, THFloatTensor *vertices, THIntTensor *indices, MaterialHandle *material);
+void xgl_Mesh_create(MeshHandle *mesh, THFloatTensor *vertices, THIntTensor *indices, MaterialHandle *material, int precision, bool keepData);
+bool xgl_Mesh_hasData(MeshHandle *mesh);
+double xgl_Mesh_getGpuMemorySize(MeshHandle *mesh);
+void xgl_Mesh_updateVertices(MeshHandle *mesh, THFloatTensor *vertices, int offset);
+void xgl_Mesh_updateIndices(MeshHandle *mesh, THIntTensor *indices, int offset);
+int xgl_Mesh_getVertexCount(MeshHandle *mesh);
+int xgl_Mesh_getIndexCount(MeshHandle *mesh);
 void xgl_Mesh_release(MeshHandle *mesh);
 bool xgl_Mesh_isNull(MeshHandle *mesh);
 void xgl_Mesh_getVertices(MeshHandle *mesh, THFloatTensor *verticesToWrite);
 void xgl_Mesh_getMaterial(MeshHandle *mesh, MaterialHandle *output);
 void xgl_Mesh_setMaterial(MeshHandle *mesh, MaterialHandle *input);
 
+Model *xgl_InstancedModel_new(MeshHandle *mesh, ShaderHandle *defaultShader);
+void xgl_InstancedModel_delete(Model *model);
+void xgl_InstancedModel_setInstances(Model *model, THDoubleTensor *transforms, THFloatTensor *colors);
+int xgl_InstancedModel_getInstanceCount(Model *model);
+
 SimpleScene *xgl_SimpleScene_new();
 void xgl_SimpleScene_delete(SimpleScene *scene);
 void xgl_SimpleScene_render(SimpleScene *scene);
 void xgl_SimpleScene_renderDepth(SimpleScene *scene);
+void xgl_SimpleScene_renderGBuffer(SimpleScene *scene);
+void xgl_SimpleScene_renderPoses(SimpleScene *scene, Model *model, THDoubleTensor *poses, bool depth);
+void xgl_SimpleScene_renderViews(SimpleScene *scene, THDoubleTensor *views, bool depth);
+void xgl_SimpleScene_castRays(SimpleScene *scene, THFloatTensor *rays, float maxDistance, THFloatTensor *distances, THIntTensor *ids, THFloatTensor *barycentrics);
+void xgl_SimpleScene_castPixelRays(SimpleScene *scene, THFloatTensor *pixels, bool vflip, float maxDistance, THFloatTensor *distances, THIntTensor *ids, THFloatTensor *barycentrics);
+void xgl_SimpleScene_getRenderStats(SimpleScene *scene, RenderStats *stats);
 void xgl_SimpleScene_setClearColor(SimpleScene *scene, float r, float g, float b, float a);
 void xgl_SimpleScene_getOverrideMaterial(SimpleScene *scene, MaterialHandle *output);
 void xgl_SimpleScene_setOverrideMaterial(SimpleScene *scene, MaterialHandle *input);
+bool xgl_SimpleScene_getFrustumCulling(SimpleScene *scene);
+void xgl_SimpleScene_setFrustumCulling(SimpleScene *scene, bool value);
+bool xgl_SimpleScene_getOcclusionCulling(SimpleScene *scene);
+void xgl_SimpleScene_setOcclusionCulling(SimpleScene *scene, bool value);
+float xgl_SimpleScene_getLodThreshold(SimpleScene *scene);
+void xgl_SimpleScene_setLodThreshold(SimpleScene *scene, float pixels);
+int xgl_SimpleScene_getForcedLod(SimpleScene *scene);
+void xgl_SimpleScene_setForcedLod(SimpleScene *scene, int level);
 void xgl_SimpleScene_setCamera(SimpleScene *scene, Camera *camera);
 void xgl_SimpleScene_addModel(SimpleScene *scene, Model *model);
 void xgl_SimpleScene_clearModels(SimpleScene *scene);
@@ -1,8 +1,11 @@
+local ffi = require 'ffi'
 local xgl = require 'xgl.env'
 
 require 'xgl.Camera'
 require 'xgl.Shader'
 require 'xgl.Model'
+require 'xgl.ModelLoad'
+require 'xgl.InstancedModel'
 require 'xgl.SimpleScene'
 require 'xgl.Material'
 require 'xgl.Mesh'
@@ -15,6 +18,8 @@ local default_depth_shader
 local default_depth_material
 
 
+-- instanceTransform and instanceColor are set per instance by xgl.InstancedModel, for
+-- regular meshes they default to identity and a transparent color (vertex color is used)
 local DEFAULT_VERTEX_SHADER = [[
 #version 330 core
 
@@ -22,10 +27,13 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texCoords;
 layout (location = 3) in vec4 colorIn;
+layout (location = 4) in mat4 instanceTransform;
+layout (location = 8) in vec4 instanceColor;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform bool flipTextureV;
 
 out vec2 TexCoords;
 out vec3 FragPos;
@@ -33,11 +41,12 @@ out vec3 Normal;
 out vec4 VertexColor;
 
 void main() {
-  gl_Position = projection * view * model * vec4(position, 1.0f);
-  TexCoords = texCoords;
-  FragPos = vec3(model * vec4(position, 1.0f));
-  Normal = mat3(transpose(inverse(model))) * normal;
-  VertexColor = colorIn;
+  mat4 world = model * instanceTransform;
+  gl_Position = projection * view * world * vec4(position, 1.0f);
+  TexCoords = flipTextureV ? vec2(texCoords.x, 1.0 - texCoords.y) : texCoords;
+  FragPos = vec3(world * vec4(position, 1.0f));
+  Normal = mat3(transpose(inverse(world))) * normal;
+  VertexColor = instanceColor.a > 0.0 ? instanceColor : colorIn;
 }
 ]]
 
@@ -57,8 +66,14 @@ uniform Material material;
 uniform vec3 lightPos;
 uniform vec3 lightColor;
 uniform vec3 viewPos;
+uniform mat4 view;
+uniform uvec2 objectId;
 
-out vec4 color;
+// locations 1-3 are only written when rendering a G-buffer (SimpleScene:renderGBuffer)
+layout (location = 0) out vec4 color;
+layout (location = 1) out float linearDepth;
+layout (location = 2) out vec3 viewNormal;
+layout (location = 3) out uvec2 id;
 
 in vec4 VertexColor;
 in vec3 FragPos;
@@ -84,16 +99,21 @@ void main() {
 
   vec3 result = (ambient + diffuse + specular) * mix(material.diffuse, vec3(VertexColor), VertexColor[3]);
   color = vec4(result, material.opacity);
+
+  linearDepth = 1.0 / gl_FragCoord.w;
+  viewNormal = normalize(mat3(view) * norm);
+  id = objectId;
 }
 ]]
 
 local DEFAULT_DEPTH_VERTEX_SHADER = [[#version 330 core
 layout (location = 0) in vec3 position;
+layout (location = 4) in mat4 instanceTransform;   // identity for non-instanced meshes
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 void main() {
-  gl_Position = projection * view * model * vec4(position, 1.0f);
+  gl_Position = projection * view * model * instanceTransform * vec4(position, 1.0f);
 }
 ]]
 
@@ -105,14 +125,132 @@ void main() {
 ]]
 
 
-function xgl.init(show_window, window_width, window_height)
-  xgl.lib.xgl___init(show_window or false, window_width or 16, window_height or 16)
+-- backend: 'auto' (default), 'glfw' or 'egl'; 'auto' creates a window-less EGL context
+-- when no window is shown, so no X server is required for off-screen rendering.
+function xgl.init(show_window, window_width, window_height, backend)
+  xgl.lib.xgl___init(show_window or false, window_width or 16, window_height or 16, backend or 'auto')
+end
+
+function xgl.getBackend()
+  return ffi.string(xgl.lib.xgl___getBackend())
 end
 
 function xgl.terminate()
   xgl.lib.xgl___terminate()
 end
 
+-- Render targets released by cameras (resize, delete) are kept in a pool for reuse, up to a
+-- budget in bytes (256 MB by default).
+function xgl.getRenderTargetPoolSize()
+  return xgl.lib.xgl___getRenderTargetPoolSize()
+end
+
+function xgl.trimRenderTargetPool(max_bytes)
+  xgl.lib.xgl___trimRenderTargetPool(max_bytes or 0)
+end
+
+function xgl.setRenderTargetPoolBudget(bytes)
+  xgl.lib.xgl___setRenderTargetPoolBudget(bytes)
+end
+
+-- Textures loaded from files are shared by all models through a cache. Textures no model uses
+-- anymore are kept for reuse up to a budget in bytes (512 MB by default).
+function xgl.getTextureCacheStats()
+  local stats = ffi.new('TextureCacheStats')
+  xgl.lib.xgl___getTextureCacheStats(stats)
+  return {
+    hits = stats.hits,
+    misses = stats.misses,
+    evictions = stats.evictions,
+    textureCount = stats.textureCount,
+    byteSize = stats.byteSize,
+    budget = stats.budget
+  }
+end
+
+function xgl.resetTextureCacheCounters()
+  xgl.lib.xgl___resetTextureCacheCounters()
+end
+
+function xgl.trimTextureCache(max_bytes)
+  xgl.lib.xgl___trimTextureCache(max_bytes or 0)
+end
+
+function xgl.setTextureCacheBudget(bytes)
+  xgl.lib.xgl___setTextureCacheBudget(bytes)
+end
+
+-- Imported models are cached in this directory (default: $XGL_MESH_CACHE, else
+-- ~/.cache/xamla-xgl/meshes), so loading an unchanged file again skips the import. An empty
+-- path disables the cache.
+function xgl.setMeshCacheDirectory(path)
+  xgl.lib.xgl___setMeshCacheDirectory(path or '')
+end
+
+function xgl.getMeshCacheDirectory()
+  return ffi.string(xgl.lib.xgl___getMeshCacheDirectory())
+end
+
+-- Model loading simplifies meshes with at least min_triangles triangles (default 2048) into
+-- level_count levels of detail, each with about a quarter of the triangles of the previous one.
+-- Set before loading. Disabled by default (0 levels), like their selection: levels are only
+-- drawn with SimpleScene:setLodThreshold or setForcedLod.
+function xgl.setImportLodOptions(level_count, min_triangles)
+  xgl.lib.xgl___setImportLodOptions(level_count, min_triangles or 2048)
+end
+
+function xgl.getImportLodOptions()
+  local level_count, min_triangles = ffi.new('int[1]'), ffi.new('int[1]')
+  xgl.lib.xgl___getImportLodOptions(level_count, min_triangles)
+  return level_count[0], min_triangles[0]
+end
+
+-- Model loading welds vertices with equal attributes whose positions are at most weld_tolerance
+-- apart (default 1e-6 model units) and reorders triangles and vertices for the vertex cache,
+-- overdraw and vertex fetch. Set before loading, enabled by default. Normals have to be equal
+-- unless weld_normal_angle (degrees, default 0) is set, e.g. 30 smooths the per-face normals of
+-- STL files across edges below that angle and welds their vertices.
+function xgl.setImportOptimization(enabled, weld_tolerance, weld_normal_angle)
+  xgl.lib.xgl___setImportOptimization(enabled, weld_tolerance or 1e-6, weld_normal_angle or 0)
+end
+
+function xgl.getImportOptimization()
+  local enabled, weld_tolerance, weld_normal_angle = ffi.new('bool[1]'), ffi.new('float[1]'), ffi.new('float[1]')
+  xgl.lib.xgl___getImportOptimization(enabled, weld_tolerance, weld_normal_angle)
+  return enabled[0], weld_tolerance[0], weld_normal_angle[0]
+end
+
+-- Vertex, index and vertex cache miss (16 entry FIFO) totals before and after the optimization of
+-- all meshes imported since the last reset, loads served by the mesh cache are not counted.
+function xgl.getImportOptimizeStats()
+  local stats = ffi.new('ImportOptimizeStats')
+  xgl.lib.xgl___getImportOptimizeStats(stats)
+  return {
+    meshCount = stats.meshCount,
+    inputVertices = stats.inputVertices,
+    outputVertices = stats.outputVertices,
+    inputIndices = stats.inputIndices,
+    outputIndices = stats.outputIndices,
+    inputCacheMisses = stats.inputCacheMisses,
+    outputCacheMisses = stats.outputCacheMisses
+  }
+end
+
+function xgl.resetImportOptimizeStats()
+  xgl.lib.xgl___resetImportOptimizeStats()
+end
+
+-- Performs pending GL uploads of background model loads for up to max_ms milliseconds, returns
+-- the number of loads in progress. SimpleScene:render() does this with the upload budget.
+function xgl.processUploads(max_ms)
+  return xgl.lib.xgl___processUploads(max_ms or math.huge)
+end
+
+-- Milliseconds of background load uploads per SimpleScene:render() call (default 4).
+function xgl.setUploadBudget(ms)
+  xgl.lib.xgl___setUploadBudget(ms)
+end
+
 function xgl.pollEvents()
   xgl.lib.xgl___pollEvents()
 end
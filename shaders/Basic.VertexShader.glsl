@@ -8,6 +8,7 @@ layout (location = 3) in vec4 colorIn;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform bool flipTextureV;
 
 out vec2 TexCoords;
 out vec3 FragPos;
@@ -16,7 +17,7 @@ out vec4 VertexColor;
 
 void main() {
   gl_Position = projection * view * model * vec4(position, 1.0f);
-  TexCoords = texCoords;
+  TexCoords = flipTextureV ? vec2(texCoords.x, 1.0 - texCoords.y) : texCoords;
   FragPos = vec3(model * vec4(position, 1.0f));
   Normal = mat3(transpose(inverse(model))) * normal;
   VertexColor = colorIn;
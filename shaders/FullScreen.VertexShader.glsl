@@ -1,8 +1,12 @@
 const vec2 madd = vec2(0.5, 0.5);
 attribute vec2 vertexIn;
 varying vec2 textureCoord;
+uniform bool flipTextureV;
 
 void main() {
    textureCoord = vertexIn.xy * madd + madd;  // scale vertex attribute to [0-1] range
+   if (flipTextureV) {
+      textureCoord.y = 1.0 - textureCoord.y;
+   }
    gl_Position = vec4(vertexIn.xy, 1, 1);     // set Z to 1 (far clipping plane in NDC)
 }
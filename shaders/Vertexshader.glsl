@@ -8,9 +8,10 @@ out vec2 TexCoords;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform bool flipTextureV;
 
 void main()
 {
     gl_Position = projection * view * model * vec4(position, 1.0f);
-    TexCoords = texCoords;
+    TexCoords = flipTextureV ? vec2(texCoords.x, 1.0 - texCoords.y) : texCoords;
 }
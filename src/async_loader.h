@@ -0,0 +1,267 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "model.h"
+
+
+enum class LoadState : int {
+  Importing = 0,    // queued or running on a worker thread
+  Uploading = 1,    // imported, GL objects are created by processUploads()
+  Ready = 2,
+  Failed = 3,
+  Cancelled = 4
+};
+
+
+// Progress of one asynchronous model load.
+class ModelLoad {
+public:
+  ModelLoad(Model *model, const std::string &path)
+    : model(model)
+    , modelLifetime(model->getLifetimeToken())
+    , path(path)
+    , optimizeOptions(importOptimizeOptions())
+    , lodOptions(importLodOptions())
+    , state(LoadState::Importing)
+    , nextMesh(0) {
+  }
+
+  ModelLoad & operator =(const ModelLoad &) = delete;
+  ModelLoad(const ModelLoad &) = delete;
+
+  LoadState getState() const {
+    return state.load();
+  }
+
+  bool isDone() const {
+    const LoadState s = state.load();
+    return s == LoadState::Ready || s == LoadState::Failed || s == LoadState::Cancelled;
+  }
+
+  // Error message, set before the state changes to Failed.
+  const std::string& getError() const {
+    return error;
+  }
+
+  const std::string& getPath() const {
+    return path;
+  }
+
+private:
+  friend class AsyncLoader;
+
+  Model *model;
+  std::weak_ptr<void> modelLifetime;
+  std::string path;
+  OptimizeOptions optimizeOptions;    // in effect when the load was queued
+  LodOptions lodOptions;
+  std::atomic<LoadState> state;
+  std::string error;
+  std::unique_ptr<ModelImport> imported;
+  size_t nextMesh;
+};
+
+
+// Loads models in the background: file I/O, ASSIMP import (or mesh cache mapping) and texture
+// decoding run on worker threads, one model per worker at a time. Only the GL uploads are left to
+// the GL thread, which performs them in processUploads() with a time budget per call, so a
+// running visualization keeps rendering while a workcell of many parts is loading. Meshes are
+// added to the model one by one as they are uploaded.
+class AsyncLoader {
+public:
+  explicit AsyncLoader(size_t threadCount = std::thread::hardware_concurrency())
+    : threadCount(std::max<size_t>(threadCount, 1))
+    , running(0)
+    , uploadBudget(4)
+    , stopping(false) {
+    meshCache();      // used by the workers, has to outlive them
+  }
+
+  ~AsyncLoader() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      jobs.clear();
+    }
+    wake.notify_all();
+    for (auto &t : workers) {
+      t.join();
+    }
+  }
+
+  AsyncLoader & operator =(const AsyncLoader &) = delete;
+  AsyncLoader(const AsyncLoader &) = delete;
+
+  // Starts loading path into model. If the model is deleted before the load is done, the remaining
+  // uploads are skipped and the load ends as cancelled.
+  std::shared_ptr<ModelLoad> loadModel(Model *model, const std::string &path) {
+    std::shared_ptr<ModelLoad> load = std::make_shared<ModelLoad>(model, path);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (workers.empty()) {
+        // started on first use, most processes never load asynchronously
+        for (size_t i = 0; i < threadCount; ++i) {
+          workers.emplace_back(&AsyncLoader::workerLoop, this);
+        }
+      }
+      jobs.push_back(load);
+    }
+    wake.notify_one();
+    return load;
+  }
+
+  // Stops a load, meshes already added to the model are kept.
+  void cancel(const std::shared_ptr<ModelLoad> &load) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!load->isDone()) {
+      load->state = LoadState::Cancelled;
+    }
+  }
+
+  // Performs pending GL uploads on the calling (GL) thread for about maxMilliseconds, at least
+  // one mesh is uploaded if any is pending. Returns the number of loads not yet done.
+  size_t processUploads(double maxMilliseconds) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto budget = std::chrono::duration<double, std::milli>(maxMilliseconds);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    bool uploaded = false;
+    while (!uploads.empty()) {
+      if (uploaded && std::chrono::steady_clock::now() - start >= budget) {
+        break;
+      }
+
+      std::shared_ptr<ModelLoad> load = uploads.front();
+      if (load->getState() != LoadState::Uploading || load->modelLifetime.expired()) {
+        uploads.pop_front();
+        finish(*load, LoadState::Cancelled, std::string());
+        continue;
+      }
+
+      // uploads only happen on this thread, the lock is not needed while creating GL objects
+      lock.unlock();
+      try {
+        load->model->addImportedMesh(*load->imported, load->nextMesh++);
+      }
+      catch (const std::exception &e) {
+        lock.lock();
+        uploads.pop_front();
+        finish(*load, LoadState::Failed, e.what());
+        continue;
+      }
+      uploaded = true;
+      lock.lock();
+
+      if (load->nextMesh >= load->imported->getMeshes().size()) {
+        uploads.pop_front();
+        finish(*load, LoadState::Ready, std::string());
+      }
+    }
+    return jobs.size() + uploads.size() + running;
+  }
+
+  // Blocks until load is done, performing uploads meanwhile; returns false on timeout (seconds,
+  // negative waits indefinitely).
+  bool wait(const std::shared_ptr<ModelLoad> &load, double timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout);
+    while (!load->isDone()) {
+      if (load->getState() == LoadState::Uploading) {
+        processUploads(std::numeric_limits<double>::infinity());
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(mutex);
+      if (timeout < 0) {
+        imported.wait(lock, [&] { return load->getState() != LoadState::Importing; });
+      } else if (!imported.wait_until(lock, deadline, [&] { return load->getState() != LoadState::Importing; })) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Milliseconds of GL uploads per SimpleScene::render() call.
+  double getUploadBudget() const {
+    return uploadBudget;
+  }
+
+  void setUploadBudget(double milliseconds) {
+    uploadBudget = milliseconds;
+  }
+
+private:
+  size_t threadCount;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable imported;
+  std::deque<std::shared_ptr<ModelLoad> > jobs;
+  std::deque<std::shared_ptr<ModelLoad> > uploads;     // imported, in order of completion
+  size_t running;             // imports in progress
+  double uploadBudget;
+  bool stopping;
+
+  void finish(ModelLoad &load, LoadState state, const std::string &error) {
+    if (state != LoadState::Cancelled || !load.isDone()) {
+      load.error = error;
+      load.state = state;
+    }
+    load.imported.reset();     // unmaps cache files, frees decoded images
+    imported.notify_all();
+  }
+
+  void workerLoop() {
+    for (;;) {
+      std::shared_ptr<ModelLoad> load;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (stopping) {
+          return;
+        }
+        load = jobs.front();
+        jobs.pop_front();
+        ++running;
+      }
+
+      std::unique_ptr<ModelImport> result;
+      std::string error;
+      if (load->getState() == LoadState::Importing) {
+        try {
+          result = Model::importModel(load->path, load->optimizeOptions, load->lodOptions);
+        }
+        catch (const std::exception &e) {
+          error = e.what();
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      --running;
+      if (load->getState() != LoadState::Importing) {
+        imported.notify_all();    // cancelled meanwhile
+      } else if (!result) {
+        finish(*load, LoadState::Failed, error);
+      } else if (result->getMeshes().empty()) {
+        finish(*load, LoadState::Ready, std::string());
+      } else {
+        load->imported = std::move(result);
+        load->state = LoadState::Uploading;
+        uploads.push_back(load);
+        imported.notify_all();
+      }
+    }
+  }
+};
+
+
+inline AsyncLoader& asyncLoader() {
+  static AsyncLoader loader;
+  return loader;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+
+// Axis aligned bounding box, empty (min > max) by default.
+struct BoundingBox {
+  glm::vec3 min;
+  glm::vec3 max;
+
+  BoundingBox()
+    : min(std::numeric_limits<float>::max())
+    , max(-std::numeric_limits<float>::max()) {
+  }
+
+  BoundingBox(const glm::vec3 &min, const glm::vec3 &max)
+    : min(min), max(max) {
+  }
+
+  bool isEmpty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+
+  glm::vec3 getCenter() const {
+    return isEmpty() ? glm::vec3(0, 0, 0) : (min + max) * 0.5f;
+  }
+
+  glm::vec3 getExtent() const {
+    return isEmpty() ? glm::vec3(0, 0, 0) : (max - min) * 0.5f;
+  }
+
+  void add(const glm::vec3 &p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+
+  void add(const BoundingBox &other) {
+    if (!other.isEmpty()) {
+      add(other.min);
+      add(other.max);
+    }
+  }
+
+  // Box enclosing this box after an affine transform (transformed center and extent, J. Arvo).
+  BoundingBox transform(const glm::mat4 &m) const {
+    if (isEmpty()) {
+      return *this;
+    }
+    const glm::vec3 c = glm::vec3(m * glm::vec4(getCenter(), 1.0f));
+    const glm::vec3 e = getExtent();
+    const glm::vec3 r(
+      std::abs(m[0][0]) * e.x + std::abs(m[1][0]) * e.y + std::abs(m[2][0]) * e.z,
+      std::abs(m[0][1]) * e.x + std::abs(m[1][1]) * e.y + std::abs(m[2][1]) * e.z,
+      std::abs(m[0][2]) * e.x + std::abs(m[1][2]) * e.y + std::abs(m[2][2]) * e.z
+    );
+    return BoundingBox(c - r, c + r);
+  }
+};
+
+
+struct BoundingSphere {
+  glm::vec3 center;
+  float radius;       // negative for empty meshes
+
+  BoundingSphere()
+    : center(0, 0, 0), radius(-1) {
+  }
+
+  BoundingSphere(const glm::vec3 &center, float radius)
+    : center(center), radius(radius) {
+  }
+
+  // Sphere enclosing this sphere after an affine transform (radius scaled by the largest axis scale).
+  BoundingSphere transform(const glm::mat4 &m) const {
+    if (radius < 0) {
+      return *this;
+    }
+    const float scale = std::sqrt(std::max(glm::dot(glm::vec3(m[0]), glm::vec3(m[0])), std::max(glm::dot(glm::vec3(m[1]), glm::vec3(m[1])), glm::dot(glm::vec3(m[2]), glm::vec3(m[2])))));
+    return BoundingSphere(glm::vec3(m * glm::vec4(center, 1.0f)), radius * scale);
+  }
+};
+
+
+// View frustum planes extracted from a projection * view matrix (Gribb/Hartmann), normals point
+// inwards. Works for world space bounds if the matrix includes the view transform.
+class Frustum {
+public:
+  explicit Frustum(const glm::mat4 &viewProjection) {
+    const glm::mat4 t = glm::transpose(viewProjection);
+    planes[0] = t[3] + t[0];    // left
+    planes[1] = t[3] - t[0];    // right
+    planes[2] = t[3] + t[1];    // bottom
+    planes[3] = t[3] - t[1];    // top
+    planes[4] = t[3] + t[2];    // near
+    planes[5] = t[3] - t[2];    // far
+    for (glm::vec4 &p : planes) {
+      const float length = glm::length(glm::vec3(p));
+      if (length > 0) {
+        p = p / length;
+      }
+    }
+  }
+
+  bool intersects(const BoundingSphere &sphere) const {
+    for (const glm::vec4 &p : planes) {
+      if (glm::dot(glm::vec3(p), sphere.center) + p.w < -sphere.radius) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Conservative, boxes near frustum corners may pass although they are outside.
+  bool intersects(const BoundingBox &box) const {
+    for (const glm::vec4 &p : planes) {
+      // corner furthest along the plane normal
+      const glm::vec3 v(p.x >= 0 ? box.max.x : box.min.x, p.y >= 0 ? box.max.y : box.min.y, p.z >= 0 ? box.max.z : box.min.z);
+      if (glm::dot(glm::vec3(p), v) + p.w < 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  glm::vec4 planes[6];
+};
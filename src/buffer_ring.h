@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+
+// Triple-buffered GL buffer with a CPU shadow copy for data that changes after creation. Updates
+// modify the shadow, commit() then switches to the next buffer of the ring and uploads only the
+// byte ranges that changed since that buffer was current. A fence placed when a buffer is
+// retired makes sure it is not overwritten while draws submitted before still read it; with
+// three buffers that fence has normally long been signaled, so updates do not stall.
+class BufferRing {
+public:
+  // Takes ownership of an existing buffer which already holds content.
+  BufferRing(GLuint buffer, std::vector<uint8_t> &&content, size_t size = 3)
+    : shadow(std::move(content))
+    , slots(std::max<size_t>(size, 1))
+    , currentSlot(0) {
+    slots[0].buffer = buffer;
+    slots[0].capacity = shadow.size();
+    for (size_t i = 1; i < slots.size(); ++i) {
+      markDirty(slots[i], 0, shadow.size());
+    }
+  }
+
+  ~BufferRing() {
+    for (auto &s : slots) {
+      s.clearFence();
+      if (s.buffer != 0) {
+        glDeleteBuffers(1, &s.buffer);
+      }
+    }
+  }
+
+  BufferRing & operator =(const BufferRing &) = delete;
+  BufferRing(const BufferRing &) = delete;
+
+  size_t getSize() const {
+    return shadow.size();
+  }
+
+  const std::vector<uint8_t>& getShadow() const {
+    return shadow;
+  }
+
+  // Resizes the shadow, added bytes are zero.
+  void resize(size_t size) {
+    if (size > shadow.size()) {
+      const size_t oldSize = shadow.size();
+      shadow.resize(size, 0);
+      markDirty(oldSize, size - oldSize);
+    } else {
+      shadow.resize(size);
+    }
+  }
+
+  // Returns a pointer into the shadow copy for writing size bytes at offset, grows the shadow if
+  // necessary. The written range is uploaded at the next commit().
+  uint8_t *write(size_t offset, size_t size) {
+    if (offset + size > shadow.size()) {
+      resize(offset + size);
+    }
+    markDirty(offset, size);
+    return shadow.data() + offset;
+  }
+
+  // Makes the pending writes visible, returns the buffer to draw from.
+  GLuint commit() {
+    const size_t nextSlot = (currentSlot + 1) % slots.size();
+    if (nextSlot != currentSlot) {
+      // draws already submitted may still read the current buffer
+      slots[currentSlot].clearFence();
+      slots[currentSlot].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    Slot &slot = slots[nextSlot];
+    slot.wait();
+
+    if (slot.buffer == 0) {
+      glGenBuffers(1, &slot.buffer);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, slot.buffer);
+    if (slot.capacity < shadow.size() || slot.capacity == 0) {
+      slot.capacity = std::max<size_t>(shadow.size(), 1);
+      glBufferData(GL_COPY_WRITE_BUFFER, slot.capacity, nullptr, GL_DYNAMIC_DRAW);
+      slot.dirtyBegin = 0;
+      slot.dirtyEnd = shadow.size();
+    }
+
+    const size_t end = std::min(slot.dirtyEnd, shadow.size());
+    if (slot.dirtyBegin < end) {
+      glBufferSubData(GL_COPY_WRITE_BUFFER, slot.dirtyBegin, end - slot.dirtyBegin, shadow.data() + slot.dirtyBegin);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    slot.dirtyBegin = slot.dirtyEnd = 0;
+    currentSlot = nextSlot;
+    return slot.buffer;
+  }
+
+  GLuint getCurrentBuffer() const {
+    return slots[currentSlot].buffer;
+  }
+
+  // Bytes allocated on the GPU by all buffers of the ring.
+  size_t getAllocatedSize() const {
+    size_t total = 0;
+    for (const auto &s : slots) {
+      total += s.capacity;
+    }
+    return total;
+  }
+
+private:
+  struct Slot {
+    GLuint buffer;
+    GLsync fence;
+    size_t capacity;
+    size_t dirtyBegin;
+    size_t dirtyEnd;
+
+    Slot()
+      : buffer(0), fence(0), capacity(0), dirtyBegin(0), dirtyEnd(0) {
+    }
+
+    void wait() {
+      if (fence == 0) {
+        return;
+      }
+      GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+      while (result == GL_TIMEOUT_EXPIRED) {
+        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+      }
+      clearFence();
+      if (result == GL_WAIT_FAILED) {
+        throw XglException("Waiting for buffer fence failed.");
+      }
+    }
+
+    void clearFence() {
+      if (fence != 0) {
+        glDeleteSync(fence);
+        fence = 0;
+      }
+    }
+  };
+
+  std::vector<uint8_t> shadow;
+  std::vector<Slot> slots;
+  size_t currentSlot;
+
+  static void markDirty(Slot &slot, size_t offset, size_t size) {
+    if (size == 0) {
+      return;
+    }
+    if (slot.dirtyBegin == slot.dirtyEnd) {
+      slot.dirtyBegin = offset;
+      slot.dirtyEnd = offset + size;
+    } else {
+      slot.dirtyBegin = std::min(slot.dirtyBegin, offset);
+      slot.dirtyEnd = std::max(slot.dirtyEnd, offset + size);
+    }
+  }
+
+  void markDirty(size_t offset, size_t size) {
+    for (auto &s : slots) {
+      markDirty(s, offset, size);
+    }
+  }
+};
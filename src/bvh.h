@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include "bounds.h"
+
+
+struct Ray {
+  glm::vec3 origin;
+  glm::vec3 direction;      // hit distances are measured in multiples of its length
+};
+
+static_assert(sizeof(Ray) == 6 * sizeof(float), "Ray must be tightly packed");
+
+
+// Bounding volume hierarchy over a set of boxes (triangles, scene meshes). Built top-down with
+// a binned surface area heuristic, nodes are stored depth-first with the right child following
+// the left subtree, leaves reference consecutive ranges of getItems().
+class BVHTree {
+public:
+  struct Node {
+    BoundingBox box;
+    uint32_t first;         // leaf: first item, inner node: index of the right child
+    uint32_t count;         // 0 for inner nodes, the left child directly follows its parent
+  };
+
+  void build(const std::vector<BoundingBox> &boxes) {
+    nodes.clear();
+    items.resize(boxes.size());
+    std::iota(items.begin(), items.end(), 0);
+    centroids.resize(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i) {
+      centroids[i] = boxes[i].getCenter();
+    }
+    if (!boxes.empty()) {
+      nodes.reserve(boxes.size() * 2 / LEAF_SIZE + 1);
+      buildNode(boxes, 0, (uint32_t)boxes.size(), 0);
+    }
+    centroids.clear();
+    centroids.shrink_to_fit();
+  }
+
+  const std::vector<Node>& getNodes() const { return nodes; }
+  const std::vector<uint32_t>& getItems() const { return items; }   // box indices in leaf order
+
+  // Calls leaf(begin, end, tMax) with the leaf item ranges the ray passes within tMax, near leaves
+  // first. leaf shortens tMax when it finds a hit.
+  template<typename LeafFn>
+  void traverse(const Ray &ray, float &tMax, LeafFn leaf) const {
+    if (nodes.empty()) {
+      return;
+    }
+
+    const glm::vec3 invDir(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+    struct Entry {
+      uint32_t node;
+      float distance;
+    } stack[MAX_DEPTH];
+    size_t top = 0;
+    uint32_t node = 0;
+    if (entryDistance(nodes[0].box, ray.origin, invDir, tMax) == noHit()) {
+      return;
+    }
+
+    for (;;) {
+      const Node &n = nodes[node];
+      if (n.count > 0) {
+        leaf(n.first, n.first + n.count, tMax);
+      } else {
+        const uint32_t left = node + 1, right = n.first;
+        const float tLeft = entryDistance(nodes[left].box, ray.origin, invDir, tMax);
+        const float tRight = entryDistance(nodes[right].box, ray.origin, invDir, tMax);
+        if (tLeft <= tRight) {
+          if (tLeft != noHit()) {
+            if (tRight != noHit()) {
+              stack[top++] = { right, tRight };
+            }
+            node = left;
+            continue;
+          }
+        } else {
+          if (tLeft != noHit()) {
+            stack[top++] = { left, tLeft };
+          }
+          node = right;
+          continue;
+        }
+      }
+
+      // skip subtrees behind a hit found meanwhile
+      do {
+        if (top == 0) {
+          return;
+        }
+        --top;
+      } while (stack[top].distance > tMax);
+      node = stack[top].node;
+    }
+  }
+
+private:
+  // SAH splits below SAH_DEPTH are replaced by median splits, which halve the item count, so the
+  // tree depth stays below MAX_DEPTH (the traversal stack size) for 2^32 items.
+  enum { LEAF_SIZE = 4, BIN_COUNT = 12, SAH_DEPTH = 48, MAX_DEPTH = 96 };
+
+  std::vector<Node> nodes;
+  std::vector<uint32_t> items;
+  std::vector<glm::vec3> centroids;
+
+  static float noHit() {
+    return std::numeric_limits<float>::infinity();
+  }
+
+  // Distance at which the ray enters box (slab test), noHit() if it misses or enters beyond tMax.
+  static float entryDistance(const BoundingBox &box, const glm::vec3 &origin, const glm::vec3 &invDir, float tMax) {
+    const glm::vec3 t0 = (box.min - origin) * invDir;
+    const glm::vec3 t1 = (box.max - origin) * invDir;
+    const glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+    const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    const float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return enter <= exit ? enter : noHit();
+  }
+
+  static float area(const BoundingBox &box) {
+    if (box.isEmpty()) {
+      return 0;
+    }
+    const glm::vec3 d = box.max - box.min;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+  }
+
+  void buildNode(const std::vector<BoundingBox> &boxes, uint32_t begin, uint32_t end, int depth) {
+    const uint32_t index = (uint32_t)nodes.size();
+    nodes.emplace_back();
+
+    BoundingBox box, centroidBox;
+    for (uint32_t i = begin; i < end; ++i) {
+      box.add(boxes[items[i]]);
+      centroidBox.add(centroids[items[i]]);
+    }
+    nodes[index].box = box;
+
+    const uint32_t count = end - begin;
+    const glm::vec3 extent = centroidBox.max - centroidBox.min;
+    const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    if (count <= LEAF_SIZE || !(extent[axis] > 0)) {
+      nodes[index].first = begin;
+      nodes[index].count = count;
+      return;
+    }
+
+    // bin the centroids along the longest axis, evaluate the SAH at the bin borders
+    struct Bin {
+      BoundingBox box;
+      uint32_t count = 0;
+    } bins[BIN_COUNT];
+    const float scale = BIN_COUNT / extent[axis];
+    auto binOf = [&](uint32_t item) {
+      return std::min((int)BIN_COUNT - 1, (int)((centroids[item][axis] - centroidBox.min[axis]) * scale));
+    };
+    for (uint32_t i = begin; i < end; ++i) {
+      Bin &bin = bins[binOf(items[i])];
+      bin.box.add(boxes[items[i]]);
+      ++bin.count;
+    }
+
+    float rightArea[BIN_COUNT];
+    uint32_t rightCount[BIN_COUNT];
+    BoundingBox accumulated;
+    uint32_t accumulatedCount = 0;
+    for (int b = BIN_COUNT - 1; b > 0; --b) {
+      accumulated.add(bins[b].box);
+      accumulatedCount += bins[b].count;
+      rightArea[b] = area(accumulated);
+      rightCount[b] = accumulatedCount;
+    }
+
+    int bestSplit = -1;
+    float bestCost = std::numeric_limits<float>::max();
+    accumulated = BoundingBox();
+    accumulatedCount = 0;
+    for (int b = 1; b < BIN_COUNT && depth < SAH_DEPTH; ++b) {
+      accumulated.add(bins[b - 1].box);
+      accumulatedCount += bins[b - 1].count;
+      if (accumulatedCount == 0 || rightCount[b] == 0) {
+        continue;
+      }
+      const float cost = area(accumulated) * accumulatedCount + rightArea[b] * rightCount[b];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestSplit = b;
+      }
+    }
+
+    uint32_t middle;
+    if (bestSplit > 0) {
+      middle = (uint32_t)(std::partition(items.begin() + begin, items.begin() + end, [&](uint32_t item) {
+        return binOf(item) < bestSplit;
+      }) - items.begin());
+    } else {
+      middle = begin + count / 2;
+      std::nth_element(items.begin() + begin, items.begin() + middle, items.begin() + end, [&](uint32_t a, uint32_t b) {
+        return centroids[a][axis] < centroids[b][axis];
+      });
+    }
+
+    nodes[index].count = 0;
+    buildNode(boxes, begin, middle, depth + 1);
+    nodes[index].first = (uint32_t)nodes.size();
+    buildNode(boxes, middle, end, depth + 1);
+  }
+};
+
+
+// Triangle BVH of a mesh in model coordinates, see Mesh::getBVH.
+class MeshBVH {
+public:
+  void build(const std::vector<glm::vec3> &positions, const std::vector<GLuint> &indices) {
+    const size_t triangleCount = indices.size() / 3;
+    std::vector<BoundingBox> boxes(triangleCount);
+    for (size_t i = 0; i < triangleCount; ++i) {
+      for (size_t k = 0; k < 3; ++k) {
+        boxes[i].add(positions[indices[i * 3 + k]]);
+      }
+    }
+    tree.build(boxes);
+
+    // vertices in leaf order, traversal does not touch the index buffer
+    const std::vector<uint32_t> &order = tree.getItems();
+    triangles.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      Triangle &t = triangles[i];
+      t.index = order[i];
+      t.v0 = positions[indices[order[i] * 3]];
+      t.e1 = positions[indices[order[i] * 3 + 1]] - t.v0;
+      t.e2 = positions[indices[order[i] * 3 + 2]] - t.v0;
+    }
+  }
+
+  size_t getTriangleCount() const { return triangles.size(); }
+
+  // Finds the closest triangle hit before tMax (Moeller-Trumbore, both faces). On a hit tMax is
+  // set to its distance, triangle to its index in the mesh and barycentrics to the weights of
+  // its second and third vertex.
+  bool intersect(const Ray &ray, float &tMax, int &triangle, glm::vec2 &barycentrics) const {
+    bool hit = false;
+    tree.traverse(ray, tMax, [&](uint32_t begin, uint32_t end, float &t) {
+      for (uint32_t i = begin; i < end; ++i) {
+        const Triangle &tri = triangles[i];
+        const glm::vec3 p = glm::cross(ray.direction, tri.e2);
+        const float det = glm::dot(tri.e1, p);
+        if (std::abs(det) < 1e-12f) {
+          continue;     // parallel or degenerate
+        }
+        const float invDet = 1.0f / det;
+        const glm::vec3 s = ray.origin - tri.v0;
+        const float u = glm::dot(s, p) * invDet;
+        if (u < 0 || u > 1) {
+          continue;
+        }
+        const glm::vec3 q = glm::cross(s, tri.e1);
+        const float v = glm::dot(ray.direction, q) * invDet;
+        if (v < 0 || u + v > 1) {
+          continue;
+        }
+        const float distance = glm::dot(tri.e2, q) * invDet;
+        if (distance > 0 && distance < t) {
+          t = distance;
+          triangle = (int)tri.index;
+          barycentrics = glm::vec2(u, v);
+          hit = true;
+        }
+      }
+    });
+    return hit;
+  }
+
+private:
+  struct Triangle {
+    glm::vec3 v0, e1, e2;
+    uint32_t index;
+  };
+
+  BVHTree tree;
+  std::vector<Triangle> triangles;
+};
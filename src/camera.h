@@ -1,5 +1,13 @@
 #pragma once
 
+#include "bvh.h"
+#include "fxaa.h"
+#include "readback.h"
+#include "render_target_pool.h"
+#include "unproject.h"
+#include "utils.h"
+
+
 class FrameBuffer {
 public:
   FrameBuffer()
@@ -51,32 +59,21 @@ private:
 };
 
 
-class RenderBuffer {
-public:
-  RenderBuffer() {
-    glGenRenderbuffers(1, &id);
-  }
-
-  ~RenderBuffer() {
-    glDeleteRenderbuffers(1, &id);
-  }
-
-  void bind() {
-    glBindRenderbuffer(GL_RENDERBUFFER, id);
-  }
-
-  GLuint getId() const {
-    return id;
-  }
-
-private:
-  GLuint id;
-};
-
 enum class RenderTargetType {
   None = 0,
   MultiSampling = 1,
-  Depth = 2
+  Depth = 2,
+  GBuffer = 3
+};
+
+// Attachments of the G-buffer render target, written in a single pass by shaders that declare
+// the matching fragment outputs (see the default shader in init.lua).
+enum class GBufferComponent : int {
+  Color = 0,      // RGB8, location 0
+  Depth = 1,      // linear depth (R32F), location 1, NaN where nothing was drawn
+  Normal = 2,     // view-space normal (RGB16F), location 2
+  Id = 3,         // model id and mesh index + 1 (RG32UI), location 3, 0 for background
+  Count = 4
 };
 
 
@@ -96,10 +93,11 @@ public:
       , im_width(1000)
       , near(0.01f)
       , far(10)
-      , normalTextureId(0)
-      , renderTargetTextureId(0)
-      , depthTextureId(0)
-      , renderTargetReady(false)
+      , sampleCount(16)
+      , fxaaEnabled(false)
+      , batchTextureId(0)
+      , batchLayerCount(0)
+      , batchType(RenderTargetType::None)
       , renderTarget(RenderTargetType::None)
       , view(1)
       , intrinsicsProjection(false)
@@ -108,7 +106,7 @@ public:
     }
 
     ~Camera() {
-      destroyRenderTarget();
+      releaseRenderTargets();
     }
 
     void setIntrinsics(float fx, float fy, float cx, float cy) {
@@ -157,7 +155,7 @@ public:
       if (this->im_height != im_height || this->im_width != im_width) {
         this->im_height = im_height;
         this->im_width = im_width;
-        destroyRenderTarget();      // ensure render target textures are resized
+        releaseRenderTargets();     // targets of the new size are acquired on next use
       }
     }
 
@@ -195,12 +193,91 @@ public:
       return static_cast<float>(im_width) / im_height;
     }
 
-    void activateRenderTarget(RenderTargetType type = RenderTargetType::MultiSampling) {
-      if (!renderTargetReady) {
-        createRenderTarget();
+    // Samples per pixel of the color target, clamped to GL_MAX_SAMPLES (16 by default). 0 renders
+    // without multi-sampling, which is much cheaper in memory and on software rasterizers.
+    void setMultiSampleCount(int samples) {
+      if (samples < 0) {
+        throw XglException("Sample count must not be negative.");
       }
+      if (samples != sampleCount) {
+        sampleCount = samples;
+        releaseMultiSampleTarget();
+      }
+    }
 
+    int getMultiSampleCount() const {
+      GLint maxSamples = 0;
+      glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);   // software rasterizers (e.g. llvmpipe) support fewer than 16 samples
+      return std::min<int>(sampleCount, maxSamples);
+    }
+
+    // Applies FXAA when the color result is resolved, alone or on top of multi-sampling.
+    void setFxaaEnabled(bool enabled) {
+      fxaaEnabled = enabled;
+      if (!enabled) {
+        detachAll(postProcessFrameBuffer, 1);
+        renderTargetPool().release(postProcessColor);
+      }
+    }
+
+    bool isFxaaEnabled() const {
+      return fxaaEnabled;
+    }
+
+    // Allocates the color targets up front, e.g. to keep the first render() from allocating.
+    void createRenderTarget() {
+      ensureMultiSampleTarget();
+      ensureNormalTarget();
+    }
+
+    // Returns all render target surfaces to the pool, they are acquired again on next use.
+    void releaseRenderTargets() {
+      // attached surfaces would stay alive when the pool deletes them
+      releaseMultiSampleTarget();
+      detachAll(normalFrameBuffer, 1);
+      detachAll(postProcessFrameBuffer, 1);
+      detachAll(depthFrameBuffer, 1);
+      detachAll(pointCloudFrameBuffer, 1);
+      detachAll(gBufferFrameBuffer, (int)GBufferComponent::Count);
+
+      RenderTargetPool &pool = renderTargetPool();
+      pool.release(normalColor);
+      pool.release(postProcessColor);
+      pool.release(depthColor);
+      pool.release(depthDepth);
+      pool.release(pointCloudColor);
+      for (auto &surface : gBuffer) {
+        pool.release(surface);
+      }
+      pool.release(gBufferDepth);
+
+      if (batchTextureId != 0) {
+        glDeleteTextures(1, &batchTextureId);
+        batchTextureId = 0;
+        batchLayerCount = 0;
+        batchType = RenderTargetType::None;
+      }
+    }
+
+    // Estimated GPU memory held by the render targets of this camera in bytes.
+    size_t getGpuMemorySize() const {
+      size_t total = 0;
+      for (const Surface *surface : { normalColor.get(), postProcessColor.get(), multiSampleColor.get(), multiSampleDepth.get(), depthColor.get(), depthDepth.get(), pointCloudColor.get(), gBufferDepth.get() }) {
+        total += surface != nullptr ? surface->getByteSize() : 0;
+      }
+      for (const auto &surface : gBuffer) {
+        total += surface ? surface->getByteSize() : 0;
+      }
+      if (batchTextureId != 0) {
+        total += (size_t)im_width * im_height * batchLayerCount * 4;
+      }
+      return total;
+    }
+
+    // Surfaces of a target type are acquired from the render target pool on first use.
+    void activateRenderTarget(RenderTargetType type = RenderTargetType::MultiSampling) {
       if (type == RenderTargetType::MultiSampling) {
+        ensureMultiSampleTarget();
         multiSampleFrameBuffer.bind();
         renderTarget = RenderTargetType::MultiSampling;
         glViewport(0, 0, im_width, im_height);
@@ -208,29 +285,226 @@ public:
         GLenum drawBuffers[1] = { GL_COLOR_ATTACHMENT0 };
         glDrawBuffers(1, drawBuffers);
       } else if (type == RenderTargetType::Depth) {
+        ensureDepthTarget();
         depthFrameBuffer.bind();
         renderTarget = RenderTargetType::Depth;
         glViewport(0, 0, im_width, im_height);
         GLenum drawBuffers[1] = { GL_COLOR_ATTACHMENT0 };
         glDrawBuffers(1, drawBuffers);
+      } else if (type == RenderTargetType::GBuffer) {
+        ensureGBuffer();
+        gBufferFrameBuffer.bind();
+        renderTarget = RenderTargetType::GBuffer;
+        glViewport(0, 0, im_width, im_height);
+        GLenum drawBuffers[4] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+        glDrawBuffers(4, drawBuffers);
       } else {
         glBindRenderbuffer(GL_RENDERBUFFER, 0);
         renderTarget = RenderTargetType::None;
       }
     }
 
+    // Clears all G-buffer attachments, the G-buffer target has to be active.
+    void clearGBuffer(const glm::vec4 &clearColor) {
+      const GLfloat nan = std::numeric_limits<float>::quiet_NaN();
+      const GLfloat depth[4] = { nan, 0, 0, 0 };
+      const GLfloat normal[4] = { 0, 0, 0, 0 };
+      const GLuint id[4] = { 0, 0, 0, 0 };
+      glClearBufferfv(GL_COLOR, 0, glm::value_ptr(clearColor));
+      glClearBufferfv(GL_COLOR, 1, depth);
+      glClearBufferfv(GL_COLOR, 2, normal);
+      glClearBufferuiv(GL_COLOR, 3, id);
+      glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    // Reads one attachment of the last G-buffer render into data: height x width pixels of 3
+    // bytes (color), 1 float (depth), 3 floats (normal) or 2 uint32 (id).
+    void copyGBuffer(GBufferComponent component, void *data, bool vflip) {
+      if (!gBuffer[0]) {
+        throw XglException("No G-buffer has been rendered.");
+      }
+
+      gBufferFrameBuffer.bind(GL_READ_FRAMEBUFFER);
+      glReadBuffer(GL_COLOR_ATTACHMENT0 + (GLenum)component);
+      GLint packAlignment = 4;
+      glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+      const int w = (int)im_width, h = (int)im_height;
+      switch (component) {
+        case GBufferComponent::Color:
+          glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, data);
+          if (vflip) flipVInplace(static_cast<uint8_t *>(data), w, h, 3);
+          break;
+        case GBufferComponent::Depth:
+          glReadPixels(0, 0, w, h, GL_RED, GL_FLOAT, data);
+          if (vflip) flipVInplace(static_cast<float *>(data), w, h, 1);
+          break;
+        case GBufferComponent::Normal:
+          glReadPixels(0, 0, w, h, GL_RGB, GL_FLOAT, data);
+          if (vflip) flipVInplace(static_cast<float *>(data), w, h, 3);
+          break;
+        case GBufferComponent::Id:
+          glReadPixels(0, 0, w, h, GL_RG_INTEGER, GL_UNSIGNED_INT, data);
+          if (vflip) flipVInplace(static_cast<uint32_t *>(data), w, h, 2);
+          break;
+        default:
+          glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+          throw XglException("Invalid G-buffer component.");
+      }
+
+      glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+      glReadBuffer(GL_COLOR_ATTACHMENT0);
+      gBufferFrameBuffer.unbind(GL_READ_FRAMEBUFFER);
+    }
+
     void copyToNormalFrameBuffer() {
       if (renderTarget == RenderTargetType::MultiSampling) {
-        multiSampleFrameBuffer.bind(GL_READ_FRAMEBUFFER);       // Bind the FBO for reading
-        normalFrameBuffer.bind(GL_DRAW_FRAMEBUFFER);            // Bind the normal FBO for drawing
+        resolveColor();
+        normalFrameBuffer.bind();       // Bind the normal FBO for reading
+      }
+    }
 
-        // Blit the multisampled FBO to the normal FBO
-        glBlitFramebuffer(0, 0, im_width, im_height, 0, 0, im_width, im_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    // Resolves the multi-sampled color target of the last render() into the normal texture,
+    // independent of the render target used since.
+    GLuint resolveColorTexture() {
+      if (!multiSampleColor) {
+        throw XglException("Camera has not rendered color yet.");
+      }
+      resolveColor();
+      normalFrameBuffer.unbind();
+      return normalColor->getId();
+    }
 
-        normalFrameBuffer.bind();       // Bind the normal FBO for reading
+    // Float depth texture written by depth renders (RenderTargetType::Depth).
+    GLuint getDepthTextureId() const {
+      if (!depthColor) {
+        throw XglException("Camera has not rendered depth yet.");
+      }
+      return depthColor->getId();
+    }
+
+    // Binds the RGBA32F point cloud target for drawing, see PointCloudPass. The target is also
+    // bound as read framebuffer, so the result can be read back directly afterwards.
+    void activatePointCloudTarget() {
+      if (!pointCloudColor) {
+        pointCloudColor = acquireSurface(SurfaceType::Texture, GL_RGBA32F);
+        pointCloudFrameBuffer.bind();
+        pointCloudColor->attach(GL_COLOR_ATTACHMENT0);
+        pointCloudFrameBuffer.check(true);
+      }
+
+      pointCloudFrameBuffer.bind();
+      glViewport(0, 0, im_width, im_height);
+      GLenum drawBuffers[1] = { GL_COLOR_ATTACHMENT0 };
+      glDrawBuffers(1, drawBuffers);
+      glReadBuffer(GL_COLOR_ATTACHMENT0);
+    }
+
+    // Prepares the layered texture that receives the results of a batch render, one layer per variant.
+    void beginBatch(int count, RenderTargetType type) {
+      if (count < 1) {
+        throw XglException("Batch must contain at least one variant.");
+      }
+
+      GLint maxLayers = 0;
+      glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+      if (count > maxLayers) {
+        throw XglException(string_format("Batch size %d exceeds the maximum number of texture array layers (%d).", count, maxLayers));
+      }
+
+      if (batchTextureId != 0 && batchLayerCount == count && batchType == type) {
+        return;
+      }
+
+      if (batchTextureId == 0) {
+        glGenTextures(1, &batchTextureId);
+      }
+      glBindTexture(GL_TEXTURE_2D_ARRAY, batchTextureId);
+      if (type == RenderTargetType::Depth) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, im_width, im_height, count, 0, GL_RED, GL_FLOAT, nullptr);
+      } else {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, im_width, im_height, count, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+      }
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+      batchLayerCount = count;
+      batchType = type;
+    }
+
+    // Resolves the current render target (multi-sampled color or float depth) into a batch layer.
+    void resolveToBatchLayer(int layer) {
+      if (batchTextureId == 0 || layer < 0 || layer >= batchLayerCount) {
+        throw XglException("Batch layer out of range.");
+      }
+
+      if (renderTarget == RenderTargetType::Depth) {
+        depthFrameBuffer.bind(GL_READ_FRAMEBUFFER);
+      } else if (fxaaEnabled) {
+        resolveColor();
+        normalFrameBuffer.bind(GL_READ_FRAMEBUFFER);
+      } else {
+        multiSampleFrameBuffer.bind(GL_READ_FRAMEBUFFER);
+      }
+
+      batchFrameBuffer.bind(GL_DRAW_FRAMEBUFFER);
+      glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, batchTextureId, 0, layer);
+      glBlitFramebuffer(0, 0, im_width, im_height, 0, 0, im_width, im_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+      batchFrameBuffer.unbind(GL_DRAW_FRAMEBUFFER);
+    }
+
+    int getBatchLayerCount() const {
+      return batchLayerCount;
+    }
+
+    RenderTargetType getBatchType() const {
+      return batchType;
+    }
+
+    // Reads all layers of the last batch with a single transfer, data receives layers x height x width pixels.
+    void copyBatchResult(void *data, bool vflip) {
+      if (batchTextureId == 0) {
+        throw XglException("No batch has been rendered.");
+      }
+
+      GLint packAlignment = 4;
+      glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, batchTextureId);
+      if (batchType == RenderTargetType::Depth) {
+        glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RED, GL_FLOAT, data);
+      } else {
+        glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+      }
+      glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+      glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+
+      if (vflip) {
+        const size_t layerSize = (size_t)im_width * im_height;
+        for (int i = 0; i < batchLayerCount; ++i) {
+          if (batchType == RenderTargetType::Depth) {
+            flipVInplace(static_cast<float *>(data) + i * layerSize, im_width, im_height, 1);
+          } else {
+            flipVInplace(static_cast<uint8_t *>(data) + i * layerSize * 3, im_width, im_height, 3);
+          }
+        }
       }
     }
 
+    // Starts an asynchronous readback of the last render result, see PixelPackRing.
+    int beginReadback(ReadbackFormat format) {
+      if (format == ReadbackFormat::RGB8) {
+        copyToNormalFrameBuffer();
+      }
+      return readbackRing.begin(im_width, im_height, format);
+    }
+
+    PixelPackRing& getReadbackRing() {
+      return readbackRing;
+    }
+
     void setProjectionMatrix(const glm::mat4& projection) {
       this->projection = projection;
       intrinsicsProjection = false;
@@ -257,26 +531,50 @@ public:
        view = glm::lookAtRH(eye, at, up);
     }
 
+    // Unprojects a dense depth image of the camera's size, points are written consecutively with
+    // outputStride floats per point. Depth values <= 0 produce NaN points.
     void unprojectDepthImage(float *depthInput, float *xyzOutput, int outputStride) {
+      PointOutput output = { xyzOutput, (size_t)outputStride, (size_t)outputStride * (size_t)im_width };
+      unprojectDepthImage(depthInput, (size_t)im_width, output, PointCloudFrame::Camera, 0, std::numeric_limits<float>::infinity());
+    }
 
-      for (float y = im_height - 0.5f; y > 0; y -= 1.0f) {
-
-        float ry_ = (y - im_height+cy) / fy;
-
-        for (float x = 0.5f; x < im_width; x += 1.0f) {
-
-          float rz = *depthInput++;
-          float ry = rz * ry_;
-          float rx = rz * (x - cx) / fx;
+    // Unprojects a depth image of the camera's size with depthRowStride floats per row, see
+    // DepthUnprojector. Depth values outside (minDepth, maxDepth) produce NaN points.
+    void unprojectDepthImage(const float *depth, size_t depthRowStride, const PointOutput &output, PointCloudFrame frame, float minDepth, float maxDepth) {
+      unprojector.setIntrinsics(fx, fy, cx, cy, (int)im_width, (int)im_height);
+      if (frame == PointCloudFrame::World) {
+        const glm::mat4 transform = getPointTransform(frame);
+        unprojector.unproject(depth, depthRowStride, output, &transform, minDepth, maxDepth);
+      } else {
+        unprojector.unproject(depth, depthRowStride, output, nullptr, minDepth, maxDepth);
+      }
+    }
 
-          xyzOutput[0] = rx;
-          xyzOutput[1] = ry;
-          xyzOutput[2] = rz;
+    // World space ray through a pixel position (pixel centers at +0.5). v counts from the bottom
+    // row like the unprojection rays, or from the top row if vflip is set (images copied with
+    // vflip). The direction has unit length.
+    Ray getPixelRay(const glm::vec2 &pixel, bool vflip) const {
+      const float v = vflip ? im_height - pixel.y : pixel.y;
+      const glm::vec3 direction((pixel.x - cx) / fx, (cy - v) / fy, 1.0f);
+      const glm::mat4 transform = getPointTransform(PointCloudFrame::World);
+      Ray ray;
+      ray.origin = glm::vec3(transform[3]);
+      ray.direction = glm::normalize(glm::vec3(transform * glm::vec4(direction, 0.0f)));
+      return ray;
+    }
 
-          xyzOutput += outputStride;
-        }
+    // Transforms unprojected camera frame points (y down, z forward) into frame.
+    glm::mat4 getPointTransform(PointCloudFrame frame) const {
+      if (frame != PointCloudFrame::World) {
+        return glm::mat4(1);
       }
-
+      // the GL camera looks down -z with y up
+      return getPose() * glm::mat4(
+        1,  0,  0, 0,
+        0, -1,  0, 0,
+        0,  0, -1, 0,
+        0,  0,  0, 1
+      );
     }
 
 private:
@@ -296,23 +594,40 @@ private:
   bool intrinsicsProjection;
   bool rebuildProjectionMatrix;
 
-  bool renderTargetReady;
+  int sampleCount;
+  bool fxaaEnabled;
+
   FrameBuffer normalFrameBuffer;
-  RenderBuffer normalColorBuffer;
-  GLuint normalTextureId;
+  std::unique_ptr<Surface> normalColor;
 
   FrameBuffer multiSampleFrameBuffer;
-  RenderBuffer multiSampleColorBuffer;
-  RenderBuffer multiSampleDepthBuffer;
-  GLuint renderTargetTextureId;
+  std::unique_ptr<Surface> multiSampleColor;
+  std::unique_ptr<Surface> multiSampleDepth;
+
+  FrameBuffer postProcessFrameBuffer;
+  std::unique_ptr<Surface> postProcessColor;     // resolved color, input of the FXAA pass
 
   FrameBuffer depthFrameBuffer;
-  RenderBuffer depthRenderBuffer;
-  RenderBuffer depthDepthBuffer;
-  GLuint depthTextureId;
+  std::unique_ptr<Surface> depthColor;
+  std::unique_ptr<Surface> depthDepth;
+
+  FrameBuffer batchFrameBuffer;
+  GLuint batchTextureId;
+  int batchLayerCount;
+  RenderTargetType batchType;
+
+  FrameBuffer pointCloudFrameBuffer;
+  std::unique_ptr<Surface> pointCloudColor;
+
+  FrameBuffer gBufferFrameBuffer;
+  std::unique_ptr<Surface> gBuffer[(int)GBufferComponent::Count];
+  std::unique_ptr<Surface> gBufferDepth;
 
   RenderTargetType renderTarget;
 
+  PixelPackRing readbackRing;
+  DepthUnprojector unprojector;
+
   void updateProjectionMatrix() {
     if (rebuildProjectionMatrix) {
       if (intrinsicsProjection) {
@@ -337,85 +652,111 @@ private:
     }
   }
 
-  void createRenderTarget() {
-    // create normal output texture
-    glGenTextures(1, &normalTextureId);
-    glBindTexture(GL_TEXTURE_2D, normalTextureId);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, im_width, im_height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
+  static void detachAll(FrameBuffer &frameBuffer, int colorAttachments) {
+    frameBuffer.bind();
+    for (int i = 0; i < colorAttachments; ++i) {
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_RENDERBUFFER, 0);
+    }
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, 0);
+    frameBuffer.unbind();
+  }
 
-    // normal color buffer
-    normalColorBuffer.bind();
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, im_width, im_height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, normalColorBuffer.getId());
+  std::unique_ptr<Surface> acquireSurface(SurfaceType type, GLenum internalFormat, int samples = 0) {
+    SurfaceDesc desc = { type, internalFormat, (int)im_width, (int)im_height, samples };
+    return renderTargetPool().acquire(desc);
+  }
 
+  void ensureNormalTarget() {
+    if (normalColor) {
+      return;
+    }
+    normalColor = acquireSurface(SurfaceType::Texture, GL_RGBA8);
     normalFrameBuffer.bind();
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, normalTextureId, 0);
+    normalColor->attach(GL_COLOR_ATTACHMENT0);
+    normalFrameBuffer.check(true);
     normalFrameBuffer.unbind();
+  }
 
-    // === multi sampling rendertarget ===
-    glGenTextures(1, &renderTargetTextureId);
-    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, renderTargetTextureId);
-    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 16, GL_RGB8, im_width, im_height, GL_TRUE);
-
-    // create color buffer
-    multiSampleColorBuffer.bind();
-    glRenderbufferStorageMultisample(GL_RENDERBUFFER, 16, GL_RGB8, im_width, im_height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, multiSampleColorBuffer.getId());
-
-    // create depth buffer
-    multiSampleDepthBuffer.bind();
-    glRenderbufferStorageMultisample(GL_RENDERBUFFER, 16, GL_DEPTH24_STENCIL8, im_width, im_height);
-
+  void ensureMultiSampleTarget() {
+    if (multiSampleColor) {
+      return;
+    }
+    const int samples = getMultiSampleCount();
+    multiSampleColor = acquireSurface(SurfaceType::Renderbuffer, GL_RGBA8, samples);
+    multiSampleDepth = acquireSurface(SurfaceType::Renderbuffer, GL_DEPTH24_STENCIL8, samples);
     multiSampleFrameBuffer.bind();
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, multiSampleDepthBuffer.getId());
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, multiSampleDepthBuffer.getId());
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, renderTargetTextureId, 0);
+    multiSampleColor->attach(GL_COLOR_ATTACHMENT0);
+    multiSampleDepth->attach(GL_DEPTH_STENCIL_ATTACHMENT);
     multiSampleFrameBuffer.check(true);
     multiSampleFrameBuffer.unbind();
+  }
 
-    // ==== float depth rendering ====
-    glGenTextures(1, &depthTextureId);
-    glBindTexture(GL_TEXTURE_2D, depthTextureId);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, im_width, im_height, 0, GL_RED, GL_FLOAT, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+  void releaseMultiSampleTarget() {
+    detachAll(multiSampleFrameBuffer, 1);
+    renderTargetPool().release(multiSampleColor);
+    renderTargetPool().release(multiSampleDepth);
+  }
 
-    depthRenderBuffer.bind();
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, im_width, im_height);
+  // Resolves the multi-sampled color target into the normal target, through the FXAA pass if
+  // enabled. Leaves the normal framebuffer bound for drawing.
+  void resolveColor() {
+    ensureNormalTarget();
+    multiSampleFrameBuffer.bind(GL_READ_FRAMEBUFFER);
+    if (!fxaaEnabled) {
+      normalFrameBuffer.bind(GL_DRAW_FRAMEBUFFER);
+      glBlitFramebuffer(0, 0, im_width, im_height, 0, 0, im_width, im_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+      return;
+    }
 
-    depthDepthBuffer.bind();
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, im_width, im_height);
+    if (!postProcessColor) {
+      postProcessColor = acquireSurface(SurfaceType::Texture, GL_RGBA8);
+      postProcessFrameBuffer.bind();
+      postProcessColor->attach(GL_COLOR_ATTACHMENT0);
+      postProcessFrameBuffer.check(true);
+      multiSampleFrameBuffer.bind(GL_READ_FRAMEBUFFER);
+    }
+    postProcessFrameBuffer.bind(GL_DRAW_FRAMEBUFFER);
+    glBlitFramebuffer(0, 0, im_width, im_height, 0, 0, im_width, im_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    normalFrameBuffer.bind(GL_DRAW_FRAMEBUFFER);
+    glViewport(0, 0, im_width, im_height);
+    GLenum drawBuffers[1] = { GL_COLOR_ATTACHMENT0 };
+    glDrawBuffers(1, drawBuffers);
+    fxaaPass().apply(postProcessColor->getId(), (int)im_width, (int)im_height);
+  }
 
+  void ensureDepthTarget() {
+    if (depthColor) {
+      return;
+    }
+    depthColor = acquireSurface(SurfaceType::Texture, GL_R32F);
+    depthDepth = acquireSurface(SurfaceType::Renderbuffer, GL_DEPTH24_STENCIL8);
     depthFrameBuffer.bind();
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthDepthBuffer.getId());
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthDepthBuffer.getId());
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, depthFrameBuffer.getId());
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, depthTextureId, 0);
+    depthColor->attach(GL_COLOR_ATTACHMENT0);
+    depthDepth->attach(GL_DEPTH_STENCIL_ATTACHMENT);
     depthFrameBuffer.check(true);
     depthFrameBuffer.unbind();
-
-    renderTargetReady = true;
   }
 
-  void destroyRenderTarget() {
-    if (normalTextureId != 0) {
-      glDeleteTextures(1, &normalTextureId);
-      normalTextureId = 0;
+  void ensureGBuffer() {
+    if (gBuffer[0]) {
+      return;
     }
-
-    if (renderTargetTextureId != 0) {
-      glDeleteTextures(1, &renderTargetTextureId);
-      renderTargetTextureId = 0;
-    }
-
-    if (depthTextureId != 0) {
-      glDeleteTextures(1, &depthTextureId);
-      depthTextureId = 0;
+    const GLenum formats[(int)GBufferComponent::Count] = {
+      GL_RGBA8,
+      GL_R32F,
+      GL_RGBA16F,           // RGB16F is not required to be renderable
+      GL_RG32UI
+    };
+
+    gBufferFrameBuffer.bind();
+    for (int i = 0; i < (int)GBufferComponent::Count; ++i) {
+      gBuffer[i] = acquireSurface(SurfaceType::Texture, formats[i]);
+      gBuffer[i]->attach(GL_COLOR_ATTACHMENT0 + i);
     }
-
-    renderTargetReady = false;
+    gBufferDepth = acquireSurface(SurfaceType::Renderbuffer, GL_DEPTH24_STENCIL8);
+    gBufferDepth->attach(GL_DEPTH_STENCIL_ATTACHMENT);
+    gBufferFrameBuffer.check(true);
+    gBufferFrameBuffer.unbind();
   }
 };
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <cstring>
+
+#ifdef XGL_WITH_EGL
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+
+// Owner of the OpenGL context. All rendering goes through the Camera FBOs, so a backend only has
+// to provide a current 3.3 core context and - optionally - a window to present results in.
+class RenderContext {
+public:
+  virtual ~RenderContext() {}
+
+  virtual const char *getName() const = 0;
+
+  virtual bool hasWindow() const { return false; }
+
+  virtual void getWindowSize(int &width, int &height) const {
+    width = 0;
+    height = 0;
+  }
+
+  virtual void swapBuffers() {}
+  virtual void pollEvents() {}
+  virtual bool windowShouldClose() const { return false; }
+};
+
+
+class GlfwContext : public RenderContext {
+public:
+  GlfwContext(bool visible, int width, int height)
+    : window(nullptr)
+    , visible(visible) {
+    if (!glfwInit()) {
+      throw XglException("GLFW initialization failed.");
+    }
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (!visible) {
+      glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    }
+    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+
+    window = glfwCreateWindow(width, height, "xgl_dummy_window", nullptr, nullptr);
+    if (window == nullptr) {
+      glfwTerminate();
+      throw XglException("Creating GLFW window failed.");
+    }
+    glfwMakeContextCurrent(window);
+  }
+
+  ~GlfwContext() {
+    glfwDestroyWindow(window);
+    glfwTerminate();
+  }
+
+  const char *getName() const override { return "glfw"; }
+
+  bool hasWindow() const override { return visible; }
+
+  void getWindowSize(int &width, int &height) const override {
+    glfwGetWindowSize(window, &width, &height);
+  }
+
+  void swapBuffers() override {
+    glfwSwapBuffers(window);
+  }
+
+  void pollEvents() override {
+    glfwPollEvents();
+  }
+
+  bool windowShouldClose() const override {
+    return glfwWindowShouldClose(window) != 0;
+  }
+
+private:
+  GLFWwindow *window;
+  bool visible;
+};
+
+
+#ifdef XGL_WITH_EGL
+
+// Window-less context, works without X server (e.g. Mesa llvmpipe via the surfaceless platform or
+// a GPU via EGL_EXT_platform_device). A 1x1 pbuffer is only created when the driver lacks
+// EGL_KHR_surfaceless_context, since rendering never touches the default framebuffer.
+class EglContext : public RenderContext {
+public:
+  EglContext()
+    : display(EGL_NO_DISPLAY)
+    , context(EGL_NO_CONTEXT)
+    , surface(EGL_NO_SURFACE) {
+    display = openDisplay();
+    if (display == EGL_NO_DISPLAY) {
+      throw XglException("EGL: No display available.");
+    }
+
+    EGLint major = 0, minor = 0;
+    if (!eglInitialize(display, &major, &minor)) {
+      throw XglException("EGL: eglInitialize failed.");
+    }
+
+    const bool surfaceless = hasExtension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+
+    const EGLint configAttribs[] = {
+      EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount < 1) {
+      release();
+      throw XglException("EGL: No matching framebuffer configuration.");
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+      release();
+      throw XglException("EGL: OpenGL API not supported.");
+    }
+
+    const EGLint contextAttribs[] = {
+      EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+      EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+      EGL_NONE
+    };
+
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (context == EGL_NO_CONTEXT) {
+      release();
+      throw XglException("EGL: Creating OpenGL 3.3 core context failed.");
+    }
+
+    if (!surfaceless) {
+      const EGLint pbufferAttribs[] = {
+        EGL_WIDTH, 1,
+        EGL_HEIGHT, 1,
+        EGL_NONE
+      };
+      surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+      if (surface == EGL_NO_SURFACE) {
+        release();
+        throw XglException("EGL: Creating pbuffer surface failed.");
+      }
+    }
+
+    if (!eglMakeCurrent(display, surface, surface, context)) {
+      release();
+      throw XglException("EGL: eglMakeCurrent failed.");
+    }
+  }
+
+  ~EglContext() {
+    release();
+  }
+
+  const char *getName() const override { return "egl"; }
+
+private:
+  EGLDisplay display;
+  EGLContext context;
+  EGLSurface surface;
+
+  static bool hasExtension(const char *extensions, const char *name) {
+    if (extensions == nullptr) {
+      return false;
+    }
+
+    const size_t length = strlen(name);
+    for (const char *p = strstr(extensions, name); p != nullptr; p = strstr(p + length, name)) {
+      if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0')) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static EGLDisplay openDisplay() {
+    const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = nullptr;
+    if (hasExtension(clientExtensions, "EGL_EXT_platform_base")) {
+      getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    }
+
+    if (getPlatformDisplay != nullptr) {
+      // Mesa (incl. llvmpipe) without any window system
+      if (hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+        EGLDisplay d = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (d != EGL_NO_DISPLAY) {
+          return d;
+        }
+      }
+
+      // vendor drivers expose their GPUs as EGL devices
+      if (hasExtension(clientExtensions, "EGL_EXT_platform_device")) {
+        PFNEGLQUERYDEVICESEXTPROC queryDevices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+        EGLDeviceEXT device;
+        EGLint deviceCount = 0;
+        if (queryDevices != nullptr && queryDevices(1, &device, &deviceCount) && deviceCount > 0) {
+          EGLDisplay d = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+          if (d != EGL_NO_DISPLAY) {
+            return d;
+          }
+        }
+      }
+    }
+
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+
+  void release() {
+    if (display == EGL_NO_DISPLAY) {
+      return;
+    }
+
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (surface != EGL_NO_SURFACE) {
+      eglDestroySurface(display, surface);
+      surface = EGL_NO_SURFACE;
+    }
+    if (context != EGL_NO_CONTEXT) {
+      eglDestroyContext(display, context);
+      context = EGL_NO_CONTEXT;
+    }
+    eglTerminate(display);
+    display = EGL_NO_DISPLAY;
+  }
+};
+
+#endif
+
+
+// Creates the context for the requested backend ("auto", "glfw" or "egl"). With "auto" a window-less
+// EGL context is preferred whenever no window is shown; GLFW (and thus an X server) is only
+// required for visible windows or as fallback.
+inline std::unique_ptr<RenderContext> createRenderContext(const std::string &backend, bool show_window, int window_width, int window_height) {
+  if (backend != "auto" && backend != "glfw" && backend != "egl") {
+    throw XglException(std::string("Unknown context backend: ") + backend);
+  }
+
+  if (backend == "egl" && show_window) {
+    throw XglException("The egl backend does not support visible windows.");
+  }
+
+  if (backend == "glfw" || show_window) {
+    return std::unique_ptr<RenderContext>(new GlfwContext(show_window, window_width, window_height));
+  }
+
+#ifdef XGL_WITH_EGL
+  try {
+    return std::unique_ptr<RenderContext>(new EglContext());
+  }
+  catch (const XglException &e) {
+    if (backend == "egl") {
+      throw;
+    }
+    printf("%s Falling back to hidden GLFW window.\n", e.what());
+  }
+#else
+  if (backend == "egl") {
+    throw XglException("xgl was built without EGL support.");
+  }
+#endif
+
+  return std::unique_ptr<RenderContext>(new GlfwContext(false, window_width, window_height));
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "gl_state.h"
+#include "shader.h"
+
+
+// Post-process anti-aliasing (FXAA) of a resolved color image: a full-screen triangle samples the
+// source texture and blends along luma edges into the bound draw framebuffer. Much cheaper than
+// multi-sampling at large image sizes, at the cost of slightly softer texture detail.
+class FxaaPass {
+public:
+  FxaaPass()
+    : VAO(0) {
+  }
+
+  FxaaPass & operator =(const FxaaPass &) = delete;
+  FxaaPass(const FxaaPass &) = delete;
+
+  // Switches the source texture to linear filtering, the edge search samples between texels.
+  void apply(GLuint sourceTexture, int width, int height) {
+    if (!shader) {
+      create();
+    }
+
+    GLStateCache &state = glState();
+    state.setDepthTest(false);
+    state.setBlending(false);
+    state.setFacetCulling(false);
+
+    shader->use();
+    texelSize.set(glm::vec2(1.0f / width, 1.0f / height));
+    image.set(0);
+    state.bindTexture(0, sourceTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    state.bindVertexArray(VAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+  }
+
+private:
+  std::unique_ptr<Shader> shader;
+  Uniform texelSize;
+  Uniform image;
+  GLuint VAO;     // empty, the vertex shader derives positions from gl_VertexID
+
+  void create() {
+    static const char *VERTEX_SHADER = R"(#version 330 core
+void main() {
+  vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+    static const char *FRAGMENT_SHADER = R"(#version 330 core
+uniform sampler2D image;
+uniform vec2 texelSize;
+out vec4 color;
+
+const float SPAN_MAX = 8.0;
+const float REDUCE_MUL = 1.0 / 8.0;
+const float REDUCE_MIN = 1.0 / 128.0;
+const float EDGE_THRESHOLD = 1.0 / 8.0;
+const float EDGE_THRESHOLD_MIN = 1.0 / 32.0;
+
+float luma(vec3 c) {
+  return dot(c, vec3(0.299, 0.587, 0.114));
+}
+
+void main() {
+  vec2 uv = gl_FragCoord.xy * texelSize;
+  vec4 rgbM = texture(image, uv);
+  float lumaNW = luma(texture(image, uv + vec2(-1.0, -1.0) * texelSize).rgb);
+  float lumaNE = luma(texture(image, uv + vec2( 1.0, -1.0) * texelSize).rgb);
+  float lumaSW = luma(texture(image, uv + vec2(-1.0,  1.0) * texelSize).rgb);
+  float lumaSE = luma(texture(image, uv + vec2( 1.0,  1.0) * texelSize).rgb);
+  float lumaM = luma(rgbM.rgb);
+
+  float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+  float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+  if (lumaMax - lumaMin < max(EDGE_THRESHOLD_MIN, lumaMax * EDGE_THRESHOLD)) {
+    color = rgbM;     // no edge, keep the pixel exact
+    return;
+  }
+
+  vec2 dir = vec2(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));
+  float dirReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25 * REDUCE_MUL, REDUCE_MIN);
+  float rcpDirMin = 1.0 / (min(abs(dir.x), abs(dir.y)) + dirReduce);
+  dir = clamp(dir * rcpDirMin, -SPAN_MAX, SPAN_MAX) * texelSize;
+
+  vec3 rgbA = 0.5 * (texture(image, uv + dir * (1.0 / 3.0 - 0.5)).rgb + texture(image, uv + dir * (2.0 / 3.0 - 0.5)).rgb);
+  vec3 rgbB = rgbA * 0.5 + 0.25 * (texture(image, uv - dir * 0.5).rgb + texture(image, uv + dir * 0.5).rgb);
+  float lumaB = luma(rgbB);
+  color = vec4((lumaB < lumaMin || lumaB > lumaMax) ? rgbA : rgbB, rgbM.a);
+}
+)";
+
+    std::unique_ptr<Shader> s(new Shader());
+    s->create(VERTEX_SHADER, FRAGMENT_SHADER);
+    texelSize = s->getUniform("texelSize");
+    image = s->getUniform("image");
+    shader.swap(s);
+
+    glGenVertexArrays(1, &VAO);
+  }
+};
+
+
+inline FxaaPass& fxaaPass() {
+  static FxaaPass pass;
+  return pass;
+}
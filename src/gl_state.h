@@ -0,0 +1,259 @@
+#pragma once
+
+
+// Per-frame render statistics. Also declared in env.lua (ffi), keep both in sync.
+struct RenderStats {
+  int drawCalls;
+  int skippedDrawCalls;
+  int stateChanges;
+  int redundantStateChanges;
+  int culledMeshes;       // set by the scene, outside of the view frustum
+  int occludedMeshes;     // set by the scene, hidden in the last occlusion test and drawn conditionally
+  int occlusionQueries;
+  int reducedMeshes;      // set by the scene, drawn at a reduced level of detail
+};
+
+
+// Shadow copy of the GL state touched by the xgl render path. Calls that would not change the
+// current state are skipped. Everything that binds programs, VAOs or textures or toggles the
+// tracked capabilities has to go through this cache, otherwise invalidate() must be called.
+class GLStateCache {
+public:
+  GLStateCache() {
+    invalidate();
+    resetStats();
+  }
+
+  // Forgets the cached state, the next call of each setter is passed to GL again.
+  void invalidate() {
+    program = UNKNOWN;
+    vertexArray = UNKNOWN;
+    activeTextureUnit = UNKNOWN;
+    for (auto &t : textures) {
+      t = UNKNOWN;
+    }
+    cullFace = depthTest = blend = depthMask = -1;
+    depthFunc = blendSrc = blendDst = UNKNOWN;
+    staleAttributes = ~0u;
+  }
+
+  void useProgram(GLuint value) {
+    if (update(program, value)) {
+      glUseProgram(value);
+    }
+  }
+
+  void bindVertexArray(GLuint value) {
+    if (update(vertexArray, value)) {
+      glBindVertexArray(value);
+    }
+  }
+
+  void activeTexture(GLuint unit) {
+    if (update(activeTextureUnit, unit)) {
+      glActiveTexture(GL_TEXTURE0 + unit);
+    }
+  }
+
+  // Binds a GL_TEXTURE_2D texture to the given texture unit.
+  void bindTexture(GLuint unit, GLuint texture) {
+    if (unit >= MAX_TEXTURE_UNITS) {
+      activeTexture(unit);
+      glBindTexture(GL_TEXTURE_2D, texture);
+      ++stats.stateChanges;
+      return;
+    }
+
+    if (textures[unit] == texture) {
+      ++stats.redundantStateChanges;
+      return;
+    }
+
+    activeTexture(unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    textures[unit] = texture;
+    ++stats.stateChanges;
+  }
+
+  // Binds texture 0 to firstUnit and all following units that have a texture bound.
+  void unbindTextures(GLuint firstUnit) {
+    if (firstUnit >= MAX_TEXTURE_UNITS) {
+      bindTexture(firstUnit, 0);
+      return;
+    }
+    for (GLuint unit = firstUnit; unit < MAX_TEXTURE_UNITS; ++unit) {
+      if (textures[unit] != 0) {
+        bindTexture(unit, 0);
+      }
+    }
+  }
+
+  // Binds a texture to unit 0 and makes unit 0 active, so following glTex* calls modify it.
+  // bindTexture alone leaves the active unit unchanged if the texture is already bound.
+  void bindTextureForUpdate(GLuint texture) {
+    bindTexture(0, texture);
+    activeTexture(0);
+  }
+
+  // The forget* functions must be called before deleting the object, GL silently binds 0 in
+  // place of deleted objects and the name may be reused afterwards.
+  void forgetTexture(GLuint texture) {
+    for (auto &t : textures) {
+      if (t == texture) {
+        t = UNKNOWN;
+      }
+    }
+  }
+
+  void forgetVertexArray(GLuint value) {
+    if (vertexArray == value) {
+      vertexArray = UNKNOWN;
+    }
+  }
+
+  void forgetProgram(GLuint value) {
+    if (program == value) {
+      program = UNKNOWN;
+    }
+  }
+
+  void setFacetCulling(bool enabled) {
+    setCapability(cullFace, GL_CULL_FACE, enabled);
+  }
+
+  void setDepthTest(bool enabled) {
+    setCapability(depthTest, GL_DEPTH_TEST, enabled);
+  }
+
+  void setBlending(bool enabled) {
+    setCapability(blend, GL_BLEND, enabled);
+  }
+
+  void setDepthMask(bool enabled) {
+    if (update(depthMask, enabled ? 1 : 0)) {
+      glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+    }
+  }
+
+  void setDepthFunc(GLenum func) {
+    if (update(depthFunc, func)) {
+      glDepthFunc(func);
+    }
+  }
+
+  void setBlendFunc(GLenum src, GLenum dst) {
+    if (blendSrc == src && blendDst == dst) {
+      ++stats.redundantStateChanges;
+      return;
+    }
+    glBlendFunc(src, dst);
+    blendSrc = src;
+    blendDst = dst;
+    ++stats.stateChanges;
+  }
+
+  // Sets the generic value read from an attribute whose array is disabled in the bound VAO.
+  // GL 3.3 leaves the generic value undefined after a draw that sourced the attribute from an
+  // array, so the draw calls restore it before drawing a VAO without that array.
+  void setDefaultAttribute(GLuint index, float x, float y, float z, float w) {
+    if (index >= MAX_DEFAULT_ATTRIBUTES) {
+      throw XglException("Default attribute index out of range.");
+    }
+    const float value[4] = { x, y, z, w };
+    std::copy(value, value + 4, defaultAttributes[index]);
+    defaultAttributeMask |= 1u << index;
+    staleAttributes |= 1u << index;
+  }
+
+  // arrayAttributes is the bit mask of attribute locations with an enabled array in the bound
+  // VAO, bit i for location i.
+  void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, uint32_t arrayAttributes) {
+    if (count <= 0) {
+      ++stats.skippedDrawCalls;
+      return;
+    }
+    restoreDefaultAttributes(arrayAttributes);
+    glDrawElements(mode, count, type, indices);
+    ++stats.drawCalls;
+  }
+
+  void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei instanceCount, uint32_t arrayAttributes) {
+    if (count <= 0 || instanceCount <= 0) {
+      ++stats.skippedDrawCalls;
+      return;
+    }
+    restoreDefaultAttributes(arrayAttributes);
+    glDrawElementsInstanced(mode, count, type, indices, instanceCount);
+    ++stats.drawCalls;
+  }
+
+  const RenderStats& getStats() const {
+    return stats;
+  }
+
+  void resetStats() {
+    stats = RenderStats();
+  }
+
+private:
+  static const GLuint UNKNOWN = 0xffffffff;
+  static const GLuint MAX_TEXTURE_UNITS = 16;
+  static const GLuint MAX_DEFAULT_ATTRIBUTES = 16;
+
+  GLuint program;
+  GLuint vertexArray;
+  GLuint activeTextureUnit;
+  GLuint textures[MAX_TEXTURE_UNITS];
+  int cullFace;
+  int depthTest;
+  int blend;
+  int depthMask;
+  GLenum depthFunc;
+  GLenum blendSrc;
+  GLenum blendDst;
+  float defaultAttributes[MAX_DEFAULT_ATTRIBUTES][4];
+  uint32_t defaultAttributeMask = 0;
+  uint32_t staleAttributes;     // generic values that may differ from their default
+
+  RenderStats stats;
+
+  template<typename T>
+  bool update(T &current, T value) {
+    if (current == value) {
+      ++stats.redundantStateChanges;
+      return false;
+    }
+    current = value;
+    ++stats.stateChanges;
+    return true;
+  }
+
+  // Sets the defaults read by the next draw, the attributes it sources from arrays become stale.
+  void restoreDefaultAttributes(uint32_t arrayAttributes) {
+    const uint32_t restore = staleAttributes & defaultAttributeMask & ~arrayAttributes;
+    for (GLuint i = 0; i < MAX_DEFAULT_ATTRIBUTES; ++i) {
+      if (restore & (1u << i)) {
+        glVertexAttrib4fv(i, defaultAttributes[i]);
+        ++stats.stateChanges;
+      }
+    }
+    staleAttributes = (staleAttributes & ~restore) | arrayAttributes;
+  }
+
+  void setCapability(int &current, GLenum cap, bool enabled) {
+    if (update(current, enabled ? 1 : 0)) {
+      if (enabled) {
+        glEnable(cap);
+      } else {
+        glDisable(cap);
+      }
+    }
+  }
+};
+
+
+// xgl uses a single GL context, so there is one state cache per process.
+inline GLStateCache& glState() {
+  static GLStateCache cache;
+  return cache;
+}
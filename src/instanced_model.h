@@ -0,0 +1,175 @@
+#pragma once
+
+#include "model.h"
+
+
+// Draws one shared mesh many times with a single glDrawElementsInstanced call. Each instance has
+// its own transform (applied after the model pose) and an optional color. The shader has to read
+// the per-instance attributes: mat4 at locations 4-7 and vec4 color at location 8 (see the
+// default shaders in init.lua). A color with alpha 0 keeps the mesh's vertex color.
+// Shaders reading the instance attributes also work for regular meshes, see
+// setDefaultInstanceAttributes().
+class InstancedModel : public Model {
+public:
+  struct Instance {
+    glm::mat4 transform;
+    glm::vec4 color;
+  };
+
+  InstancedModel(const std::shared_ptr<Mesh> &mesh, const std::shared_ptr<Shader> &defaultShader)
+    : Model(defaultShader)
+    , VAO(0)
+    , instanceVBO(0)
+    , instanceCapacity(0)
+    , meshBufferRevision(0)
+    , dirty(false) {
+    if (!mesh) {
+      throw XglException("Instanced model requires a mesh.");
+    }
+    addMesh(mesh);
+    setupInstanceBuffer();
+  }
+
+  InstancedModel & operator =(const InstancedModel &) = delete;
+  InstancedModel(const InstancedModel &) = delete;
+
+  ~InstancedModel() {
+    glState().forgetVertexArray(VAO);
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &instanceVBO);
+  }
+
+  // Replaces all instances. colors may be empty (vertex colors are used), contain a single color
+  // for all instances or one color per transform. The GPU buffer is written once at the next draw.
+  void setInstances(const std::vector<glm::mat4> &transforms, const std::vector<glm::vec4> &colors) {
+    if (colors.size() > 1 && colors.size() != transforms.size()) {
+      throw XglException("Number of instance colors must be 0, 1 or match the number of transforms.");
+    }
+
+    instances.resize(transforms.size());
+    for (size_t i = 0; i < transforms.size(); ++i) {
+      instances[i].transform = transforms[i];
+      if (colors.empty()) {
+        instances[i].color = glm::vec4(0, 0, 0, 0);
+      } else {
+        instances[i].color = colors.size() == 1 ? colors[0] : colors[i];
+      }
+    }
+    dirty = true;
+    invalidateBounds();
+    touchScene();
+  }
+
+  // Sets the generic (non-array) values of the instance attributes to an identity transform and
+  // a transparent color. These are used by all VAOs without instance buffer, so instance-aware
+  // shaders (e.g. the default depth shader) can draw regular meshes too. The state cache restores
+  // them after instanced draws, call this once after context creation.
+  static void setDefaultInstanceAttributes() {
+    for (GLuint i = 0; i < 4; ++i) {
+      glm::vec4 column(0, 0, 0, 0);
+      column[i] = 1;
+      glState().setDefaultAttribute(4 + i, column.x, column.y, column.z, column.w);
+    }
+    glState().setDefaultAttribute(8, 0, 0, 0, 0);
+  }
+
+  size_t getInstanceCount() const {
+    return instances.size();
+  }
+
+  const std::vector<Instance>& getInstances() const {
+    return instances;
+  }
+
+  void getInstancePoses(std::vector<glm::mat4> &output) const override {
+    output.resize(instances.size());
+    for (size_t i = 0; i < instances.size(); ++i) {
+      output[i] = getPose() * instances[i].transform;
+    }
+  }
+
+  // Instances are always drawn at full detail.
+  bool supportsLods() const override { return false; }
+
+  void drawMesh(size_t index, const glm::mat4 &view, const glm::mat4 &projection, const Light& light, Material *overrideMaterial = nullptr, size_t /*lod*/ = 0) override {
+    Mesh *mesh = getMeshAt(index).get();
+    Material *material = overrideMaterial != nullptr ? overrideMaterial : mesh->getMaterial().get();
+
+    prepareShader(*material, index, view, projection, light);
+    upload();
+    material->bind();
+
+    glState().bindVertexArray(VAO);
+    if (mesh->getBufferRevision() != meshBufferRevision) {
+      // the mesh was updated and draws from a different buffer of its ring now
+      mesh->setupVertexAttributes();
+      meshBufferRevision = mesh->getBufferRevision();
+    }
+    glState().drawElementsInstanced(GL_TRIANGLES, (GLsizei)mesh->getIndexCount(), mesh->getIndexType(), 0, (GLsizei)instances.size(), mesh->getLayout().getArrayAttributes() | INSTANCE_ATTRIBUTES);
+  }
+
+protected:
+  // Bounds enclosing all instances, empty without instances.
+  WorldBounds computeWorldBounds(const Mesh &mesh) const override {
+    WorldBounds bounds;
+    for (const Instance &instance : instances) {
+      bounds.box.add(mesh.getBounds().transform(getPose() * instance.transform));
+    }
+    if (!bounds.box.isEmpty()) {
+      bounds.sphere = BoundingSphere(bounds.box.getCenter(), glm::length(bounds.box.getExtent()));
+    }
+    return bounds;
+  }
+
+private:
+  static const uint32_t INSTANCE_ATTRIBUTES = 0x1f0;   // locations 4-8 of the instance buffer
+
+  GLuint VAO;
+  GLuint instanceVBO;
+  size_t instanceCapacity;
+  uint64_t meshBufferRevision;
+  std::vector<Instance> instances;
+  bool dirty;
+
+  void setupInstanceBuffer() {
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &instanceVBO);
+
+    glState().bindVertexArray(VAO);
+    getMeshAt(0)->setupVertexAttributes();
+    meshBufferRevision = getMeshAt(0)->getBufferRevision();
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+
+    // a mat4 attribute occupies four consecutive vec4 locations
+    for (GLuint i = 0; i < 4; ++i) {
+      glEnableVertexAttribArray(4 + i);
+      glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (GLvoid*)(offsetof(Instance, transform) + i * sizeof(glm::vec4)));
+      glVertexAttribDivisor(4 + i, 1);
+    }
+
+    glEnableVertexAttribArray(8);
+    glVertexAttribPointer(8, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (GLvoid*)offsetof(Instance, color));
+    glVertexAttribDivisor(8, 1);
+
+    glState().bindVertexArray(0);
+  }
+
+  void upload() {
+    if (!dirty) {
+      return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    if (instances.size() > instanceCapacity) {
+      instanceCapacity = instances.size();
+      glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(Instance), instances.data(), GL_DYNAMIC_DRAW);
+    } else if (!instances.empty()) {
+      // orphan the old storage so the driver does not wait for draws still reading it
+      glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(Instance), nullptr, GL_DYNAMIC_DRAW);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(Instance), instances.data());
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    dirty = false;
+  }
+};
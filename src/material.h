@@ -1,10 +1,21 @@
 #pragma once
 
+#include "streaming_texture.h"
+
+
+enum class TextureType {
+  Diffuse,    // bound to sampler texture_diffuseN
+  Specular    // bound to sampler texture_specularN
+};
+
 
 struct Texture {
   GLuint id;
-  std::string type;
+  TextureType type;
   aiString path;
+  std::shared_ptr<TextureObject> object;    // keeps the GL texture alive
+  std::shared_ptr<StreamingTexture> stream;
+  bool flipV = false;     // rows are stored top to bottom, shaders flip the v coordinate
 };
 
 
@@ -23,20 +34,21 @@ public:
   void setDiffuseColor(const glm::vec4& color) { this->diffuseColor = color; }
 
   std::shared_ptr<Shader> getShader() const { return shader; }
-  void setShader(const std::shared_ptr<Shader>& shader) { this->shader = shader; }
+  void setShader(const std::shared_ptr<Shader>& shader) { this->shader = shader; touchScene(); }
 
-  void addTexture(const Texture& texture) { textures.push_back(texture); }
+  void addTexture(const Texture& texture) { textures.push_back(texture); touchScene(); }
   
   template<typename TIter>
   void addTextures(TIter begin, TIter end) {
     textures.insert(textures.end(), begin, end);
+    touchScene();
   }
   
   float getShininess() const { return shininess; }
   void setShininess(float value) { shininess = value; }
   
   float getOpacity() const { return opacity; }
-  void setOpacity(float value) { opacity = value; }
+  void setOpacity(float value) { opacity = value; touchScene(); }
   
   bool getFacetCulling() const { return facetCulling; }
   void setFacetCulling(bool value) { facetCulling = value; }
@@ -45,6 +57,12 @@ public:
   void setDepthTest(bool value) { depthTest = value; }
   
   bool getDepthWrite() const { return depthWrite; }
+
+  // True if the material is drawn in the blended (back-to-front sorted) pass.
+  bool isTransparent() const { return opacity < 1; }
+
+  // Texture used as sort key to group draws sharing the same texture, 0 if untextured.
+  GLuint getPrimaryTextureId() const { return textures.empty() ? 0 : textures.front().id; }
   void setDepthWrite(bool value) { depthWrite = value; }
 
   void bind() const {
@@ -52,90 +70,107 @@ public:
       return;
       
     shader->use();
+    const StandardUniforms &uniforms = shader->getStandardUniforms();
 
     // Bind appropriate textures
-    GLuint diffuse_index = 1;
-    GLuint specular_index = 1;
+    size_t diffuse_index = 0;
+    size_t specular_index = 0;
     
     for (GLuint i = 0; i < textures.size(); ++i) {
-      glActiveTexture(GL_TEXTURE0 + i); // Active proper texture unit before binding
-      // Retrieve texture number (the N in diffuse_textureN)
-      std::stringstream ss;
-      std::string number;
-      std::string name = textures[i].type;
-
-      if (name == "texture_diffuse")
-        ss << diffuse_index++; // Transfer GLuint to stream
-      else if (name == "texture_specular")
-        ss << specular_index++; // Transfer GLuint to stream
-      number = ss.str();
-
-      // Now set the sampler to the correct texture unit
-      auto samplerName = name + number;
-      glUniform1i(glGetUniformLocation(shader->getProgram(), samplerName.c_str()), i);
-
-      // And finally bind the texture
-      glBindTexture(GL_TEXTURE_2D, textures[i].id);
+      // Set the sampler (texture_diffuseN or texture_specularN) to the texture unit
+      if (textures[i].type == TextureType::Diffuse) {
+        StandardUniforms::at(uniforms.diffuseSamplers, diffuse_index++).set((GLint)i);
+      } else {
+        StandardUniforms::at(uniforms.specularSamplers, specular_index++).set((GLint)i);
+      }
+
+      glState().bindTexture(i, textures[i].id);
     }
 
-    glUniform3fv(glGetUniformLocation(shader->getProgram(), "material.diffuse"), 1, glm::value_ptr(diffuseColor));
-    glUniform1f(glGetUniformLocation(shader->getProgram(), "material.shininess"), this->shininess);
-    glUniform1f(glGetUniformLocation(shader->getProgram(), "material.opacity"), this->opacity);
-    
-    if (facetCulling) {
-      glEnable(GL_CULL_FACE);
-    } else {
-      glDisable(GL_CULL_FACE);
+    // samplers without a texture read the first unit after the textures, which is left empty
+    // (like units of textures drawn before) so they do not see textures of earlier draws
+    const GLint emptyUnit = (GLint)textures.size();
+    for (size_t i = diffuse_index; i < uniforms.diffuseSamplers.size(); ++i) {
+      uniforms.diffuseSamplers[i].set(emptyUnit);
     }
-    
-    if (depthTest) {
-      glEnable(GL_DEPTH_TEST);
-    } else {
-      glDisable(GL_DEPTH_TEST);
-    }
-
-    if (depthWrite) {
-      glDepthMask(GL_TRUE);
-    } else {
-      glDepthMask(GL_FALSE);
+    for (size_t i = specular_index; i < uniforms.specularSamplers.size(); ++i) {
+      uniforms.specularSamplers[i].set(emptyUnit);
     }
-    
-    if (opacity < 1) {
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    }
-  }
-  
-  void unbind() const {
-    for (GLuint i = 0; i < this->textures.size(); ++i) {
-      glActiveTexture(GL_TEXTURE0 + i);
-      glBindTexture(GL_TEXTURE_2D, 0);
+    glState().unbindTextures((GLuint)textures.size());
+
+    uniforms.flipTextureV.set((GLint)(!textures.empty() && textures.front().flipV));
+    uniforms.materialDiffuse.set(glm::vec3(diffuseColor));
+    uniforms.materialShininess.set(this->shininess);
+    uniforms.materialOpacity.set(this->opacity);
+
+    GLStateCache &state = glState();
+    state.setFacetCulling(facetCulling);
+    state.setDepthTest(depthTest);
+    state.setDepthMask(depthWrite);
+
+    // blending has to be switched off again for opaque materials
+    state.setBlending(isTransparent());
+    if (isTransparent()) {
+      state.setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
   }
 
   void updateTextureRGB8(int index, int width, int height, uint8_t *data, bool generateMipmap = false) {
     if (index == textures.size()) {
       Texture texture;
-      texture.type = "texture_diffuse";
+      texture.type = TextureType::Diffuse;
       texture.path = "<dynamic>";
-      glGenTextures(1, &texture.id);
+      texture.object = std::make_shared<TextureObject>();
+      texture.id = texture.object->getId();
       textures.push_back(texture);
+      touchScene();
     }
     else if (index > textures.size()) {
       throw XglException("Texture index out of range.");
     }
 
-    const Texture& texture = textures[index];
-    glBindTexture(GL_TEXTURE_2D, texture.id);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    if (generateMipmap) {
-      glGenerateMipmap(GL_TEXTURE_2D);
+    Texture& texture = textures[index];
+    if (!(texture.path == aiString("<dynamic>"))) {
+      // file textures are shared through the texture cache, replace instead of overwriting
+      texture.path = "<dynamic>";
+      texture.stream.reset();
+      texture.flipV = false;
+      texture.object = std::make_shared<TextureObject>();
+      texture.id = texture.object->getId();
+      touchScene();
+    }
+    texture.object->setImage(width, height, data, generateMipmap);
+  }
+
+  // Streams an image into the texture at index (appended if index equals the texture count).
+  // flipV is applied to the texture coordinates instead of the pixels. Shaders flip the
+  // coordinates of all textures by the first one, so only texture 0 can be flipped.
+  void updateStreamingTexture(int index, int width, int height, PixelFormat format, const uint8_t *data, bool flipV, bool generateMipmap = false) {
+    if (index < 0 || (size_t)index > textures.size()) {
+      throw XglException("Texture index out of range.");
+    }
+    if (flipV && index != 0) {
+      throw XglException("Only the first texture of a material can be flipped.");
+    }
+    if ((size_t)index == textures.size()) {
+      Texture texture;
+      texture.id = 0;
+      texture.type = TextureType::Diffuse;
+      textures.push_back(texture);
+    }
+
+    Texture& texture = textures[index];
+    if (!texture.stream) {
+      texture.path = "<stream>";
+      texture.object.reset();
+      texture.stream = std::make_shared<StreamingTexture>();
+    }
+    texture.stream->update(width, height, format, data, generateMipmap);
+    texture.flipV = flipV;
+    if (texture.id != texture.stream->getId()) {
+      texture.id = texture.stream->getId();
+      touchScene();
     }
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
   }
 
 private:
@@ -1,14 +1,10 @@
 #pragma once
 
+#include "bvh.h"
 #include "material.h"
-
-
-struct Vertex {
-  glm::vec3 Position;
-  glm::vec3 Normal;
-  glm::vec2 TexCoords;
-  glm::vec4 Color;
-};
+#include "vertex_layout.h"
+#include "buffer_ring.h"
+#include "mesh_simplifier.h"
 
 
 class Mesh {
@@ -36,87 +32,554 @@ public:
   Mesh(
     const std::vector<Vertex> &vertices,
     const std::vector<GLuint> &indices,
-    const std::shared_ptr<Material>& material = std::shared_ptr<Material>()
+    const std::shared_ptr<Material>& material = std::shared_ptr<Material>(),
+    VertexPrecision precision = VertexPrecision::Compact,
+    bool keepData = false
   )
-    : vertices(vertices)
-    , indices(indices)
-    , material(material)
-    , VAO(0), VBO(0), EBO(0) {
-    this->setupMesh();      // set the vertex buffers and its attribute pointers
+    : material(material)
+    , keepData(false)
+    , vertexCount(0), indexCount(0), maxIndex(0)
+    , VAO(0), VBO(0), EBO(0)
+    , lodVAO(0), lodEBO(0), lodIndexTotal(0)
+    , indexType(GL_UNSIGNED_INT)
+    , bufferRevision(0)
+    , bvhRevision(0) {
+    this->setupMesh(VertexSource(vertices), indices.data(), indices.size(), precision, keepData);
+  }
+
+  // Creates the mesh directly from (tensor) storage. Rows already in the buffer layout are uploaded
+  // without intermediate copy, all others are packed straight into the mapped GPU buffer. A CPU
+  // copy of vertices and indices is only retained if keepData is set.
+  Mesh(
+    const VertexSource &vertices,
+    const uint32_t *indices,
+    size_t numIndices,
+    const std::shared_ptr<Material>& material = std::shared_ptr<Material>(),
+    VertexPrecision precision = VertexPrecision::Compact,
+    bool keepData = false
+  )
+    : material(material)
+    , keepData(false)
+    , vertexCount(0), indexCount(0), maxIndex(0)
+    , VAO(0), VBO(0), EBO(0)
+    , lodVAO(0), lodEBO(0), lodIndexTotal(0)
+    , indexType(GL_UNSIGNED_INT)
+    , bufferRevision(0)
+    , bvhRevision(0) {
+    this->setupMesh(vertices, indices, numIndices, precision, keepData);
   }
 
   Mesh & operator =(const Mesh &) = delete;
   Mesh(const Mesh &) = delete;
 
   ~Mesh() {
+    glState().forgetVertexArray(VAO);
     glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
+    // buffers adopted by a ring are deleted with it
+    if (!vertexRing) {
+      glDeleteBuffers(1, &VBO);
+    }
+    if (!indexRing) {
+      glDeleteBuffers(1, &EBO);
+    }
+    releaseLods();
   }
 
-  void draw(Material *overrideMaterial = nullptr) const {
+  // Draws the given level of detail, 0 is the full mesh, levels beyond getLodCount() draw the
+  // coarsest one.
+  void draw(Material *overrideMaterial = nullptr, size_t lod = 0) const {
     Material *material = overrideMaterial != nullptr ? overrideMaterial : this->material.get();
 
+    if (indexCount > 0 && maxIndex >= vertexCount) {
+      throw XglException("Mesh indices reference vertices which do not exist.");
+    }
+
     if (material) {
       material->bind();
     }
 
     // Draw mesh
-    glBindVertexArray(this->VAO);
-    glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    const size_t level = std::min(lod, lods.size());
+    if (level == 0) {
+      glState().bindVertexArray(this->VAO);
+      glState().drawElements(GL_TRIANGLES, (GLsizei)indexCount, indexType, 0, layout.getArrayAttributes());
+    } else {
+      const LodLevel &l = lods[level - 1];
+      glState().bindVertexArray(lodVAO);
+      glState().drawElements(GL_TRIANGLES, (GLsizei)l.indexCount, indexType, reinterpret_cast<const GLvoid *>((size_t)l.indexOffset * getIndexSize()), layout.getArrayAttributes());
+    }
+  }
 
-    if (material) {
-      material->unbind();
+  // Simplified levels of detail besides the full mesh, they share its vertices. Replaced by
+  // updates of the vertices or indices.
+  size_t getLodCount() const {
+    return lods.size();
+  }
+
+  // Estimated deviation of a level from the full mesh in model units, 0 for level 0. It is the
+  // largest RMS quadric distance of a collapse, not a bound on the maximum deviation.
+  float getLodError(size_t level) const {
+    return level == 0 || lods.empty() ? 0.0f : lods[std::min(level, lods.size()) - 1].error;
+  }
+
+  size_t getLodIndexCount(size_t level) const {
+    return level == 0 || lods.empty() ? indexCount : lods[std::min(level, lods.size()) - 1].indexCount;
+  }
+
+  // Uploads simplified index buffers (see buildLods), levelCount ranges of lodIndices.
+  void setLods(const LodLevel *levels, size_t levelCount, const uint32_t *lodIndices, size_t lodIndexCount) {
+    releaseLods();
+    if (levelCount == 0) {
+      return;
+    }
+    for (size_t i = 0; i < levelCount; ++i) {
+      if ((size_t)levels[i].indexOffset + levels[i].indexCount > lodIndexCount) {
+        throw XglException("Level of detail index range out of bounds.");
+      }
+    }
+    for (size_t i = 0; i < lodIndexCount; ++i) {
+      if (lodIndices[i] >= vertexCount) {
+        throw XglException("Mesh index out of range.");
+      }
+    }
+
+    glGenVertexArrays(1, &lodVAO);
+    glGenBuffers(1, &lodEBO);
+    glState().bindVertexArray(lodVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lodEBO);
+    if (indexType == GL_UNSIGNED_SHORT) {
+      GLushort *dst = static_cast<GLushort *>(allocateAndMap(GL_ELEMENT_ARRAY_BUFFER, lodIndexCount * sizeof(GLushort)));
+      if (dst != nullptr) {
+        std::copy(lodIndices, lodIndices + lodIndexCount, dst);
+        unmap(GL_ELEMENT_ARRAY_BUFFER);
+      }
+    } else {
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, lodIndexCount * sizeof(GLuint), lodIndices, GL_STATIC_DRAW);
+    }
+    layout.setupAttributes();
+    glState().bindVertexArray(0);
+
+    lods.assign(levels, levels + levelCount);
+    lodIndexTotal = lodIndexCount;
+    touchScene();
+  }
+
+  // Simplifies the current vertices and indices, see buildLods. Has to be called on the GL thread.
+  void generateLods(uint32_t levelCount) {
+    std::vector<Vertex> v;
+    getVertices(v);
+    std::vector<GLuint> i;
+    getIndices(i);
+
+    std::vector<uint32_t> lodIndices;
+    std::vector<LodLevel> levels;
+    buildLods(v.data(), v.size(), i.data(), i.size(), levelCount, lodIndices, levels);
+    setLods(levels.data(), levels.size(), lodIndices.data(), lodIndices.size());
+  }
+
+  // Returns the vertices, read back from the GPU if no CPU copy was kept.
+  void getVertices(std::vector<Vertex> &output) const {
+    if (hasData()) {
+      output = vertices;
+      return;
+    }
+
+    if (vertexRing) {
+      layout.unpack(vertexRing->getShadow().data(), vertexCount, output);
+      return;
+    }
+
+    const std::vector<uint8_t> buffer = readBuffer(VBO, vertexCount * layout.getStride());
+    layout.unpack(buffer.data(), vertexCount, output);
+  }
+
+  // Returns the indices, read back from the GPU if no CPU copy was kept.
+  void getIndices(std::vector<GLuint> &output) const {
+    if (hasData()) {
+      output = indices;
+      return;
     }
+
+    const std::vector<uint8_t> buffer = indexRing ? indexRing->getShadow() : readBuffer(EBO, indexCount * getIndexSize());
+    output.resize(indexCount);
+    if (indexType == GL_UNSIGNED_SHORT) {
+      const GLushort *src = reinterpret_cast<const GLushort *>(buffer.data());
+      std::copy(src, src + indexCount, output.begin());
+    } else {
+      const GLuint *src = reinterpret_cast<const GLuint *>(buffer.data());
+      std::copy(src, src + indexCount, output.begin());
+    }
+  }
+
+  // Overwrites vertices starting at offset, rows past the current end are appended. The vertex
+  // layout chosen at creation is kept, attributes it does not store are dropped. The first update
+  // moves the vertex buffer into a ring of dynamic buffers, so updates do not wait for draws
+  // still reading the previous contents and only the changed range is uploaded.
+  void updateVertices(const VertexSource &source, size_t offset) {
+    if (offset > vertexCount) {
+      throw XglException("Vertex update offset out of range.");
+    }
+
+    BufferRing &ring = getVertexRing();
+    const size_t stride = layout.getStride();
+    layout.pack(source, ring.write(offset * stride, source.count * stride));
+    vertexCount = std::max(vertexCount, offset + source.count);
+    commitVertices(source, offset);
+  }
+
+  // Replaces all vertices, the vertex count may change.
+  void setVertices(const VertexSource &source) {
+    BufferRing &ring = getVertexRing();
+    ring.resize(0);
+    layout.pack(source, ring.write(0, source.count * layout.getStride()));
+    vertexCount = source.count;
+    commitVertices(source, 0);
+  }
+
+  // Overwrites indices starting at offset, indices past the current end are appended. Indices
+  // are checked against the vertex count when drawing, so vertices and indices can be updated in
+  // any order.
+  void updateIndices(const uint32_t *sourceIndices, size_t count, size_t offset) {
+    if (offset > indexCount) {
+      throw XglException("Index update offset out of range.");
+    }
+
+    BufferRing &ring = getIndexRing();
+    writeIndices(ring, sourceIndices, count, offset);
+    indexCount = std::max(indexCount, offset + count);
+    commitIndices(sourceIndices, count, offset);
   }
 
-  std::vector<Vertex> *getVertices(){
-    return &vertices;
+  // Replaces all indices, the index count may change.
+  void setIndices(const uint32_t *sourceIndices, size_t count) {
+    BufferRing &ring = getIndexRing();
+    ring.resize(0);
+    indexCount = count;     // before writing, widening copies indexCount indices of the new buffer
+    writeIndices(ring, sourceIndices, count, 0);
+    commitIndices(sourceIndices, count, 0);
+  }
+
+  // True once vertices or indices were updated after creation.
+  bool isDynamic() const {
+    return vertexRing || indexRing;
+  }
+
+  // Incremented whenever the vertex or index buffer object changes, VAOs sharing the mesh
+  // buffers have to call setupVertexAttributes() again.
+  uint64_t getBufferRevision() const {
+    return bufferRevision;
+  }
+
+  // True if a CPU copy of vertices and indices is kept.
+  bool hasData() const {
+    return keepData;
+  }
+
+  size_t getVertexCount() const {
+    return vertexCount;
+  }
+
+  size_t getIndexCount() const {
+    return indexCount;
+  }
+
+  // Binds the vertex and index buffers to the currently bound VAO and declares the vertex
+  // attributes 0-3, allows other VAOs (e.g. of instanced models) to share the mesh buffers.
+  void setupVertexAttributes() const {
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    layout.setupAttributes();
+  }
+
+  const VertexLayout& getLayout() const { return layout; }
+
+  // GL_UNSIGNED_SHORT if all vertices can be addressed with 16 bit, GL_UNSIGNED_INT otherwise.
+  GLenum getIndexType() const { return indexType; }
+
+  // Size of the vertex and index buffers on the GPU in bytes.
+  size_t getGpuMemorySize() const {
+    const size_t vertexBytes = vertexRing ? vertexRing->getAllocatedSize() : vertexCount * layout.getStride();
+    const size_t indexBytes = indexRing ? indexRing->getAllocatedSize() : indexCount * getIndexSize();
+    return vertexBytes + indexBytes + lodIndexTotal * getIndexSize();
   }
 
   const std::shared_ptr<Material>& getMaterial() const { return material; }
-  void setMaterial(const std::shared_ptr<Material>& material) { this->material = material; }
+  void setMaterial(const std::shared_ptr<Material>& material) { this->material = material; touchScene(); }
+
+  // Center of the axis aligned bounding box in model coordinates, used for depth sorting.
+  glm::vec3 getCenter() const { return bounds.getCenter(); }
+
+  // Bounds of the vertex positions in model coordinates, updated with the vertices.
+  const BoundingBox& getBounds() const { return bounds; }
+  const BoundingSphere& getBoundingSphere() const { return boundingSphere; }
+
+  // Triangle BVH for ray casts, built from the CPU copy of the mesh (read back from the GPU if
+  // none was kept) on first use and again after updates. Has to be called on the GL thread.
+  const MeshBVH& getBVH() {
+    if (!bvh || bvhRevision != bufferRevision) {
+      std::vector<Vertex> v;
+      getVertices(v);
+      std::vector<GLuint> i;
+      getIndices(i);
+
+      std::vector<glm::vec3> positions(v.size());
+      for (size_t k = 0; k < v.size(); ++k) {
+        positions[k] = v[k].Position;
+      }
+
+      std::unique_ptr<MeshBVH> b(new MeshBVH());
+      b->build(positions, i);
+      bvh.swap(b);
+      bvhRevision = bufferRevision;
+    }
+    return *bvh;
+  }
 
 private:
   std::shared_ptr<Material> material;
-  std::vector<Vertex> vertices;
+  std::vector<Vertex> vertices;       // CPU copy, only if keepData
   std::vector<GLuint> indices;
+  bool keepData;
+  size_t vertexCount;
+  size_t indexCount;
+  size_t maxIndex;
 
   GLuint VAO, VBO, EBO;
+  GLuint lodVAO, lodEBO;              // all levels of detail in one index buffer
+  std::vector<LodLevel> lods;
+  size_t lodIndexTotal;
+  VertexLayout layout;
+  GLenum indexType;
+  BoundingBox bounds;
+  BoundingSphere boundingSphere;
+
+  std::unique_ptr<BufferRing> vertexRing;   // created by the first update
+  std::unique_ptr<BufferRing> indexRing;
+  uint64_t bufferRevision;
+
+  std::unique_ptr<MeshBVH> bvh;
+  uint64_t bvhRevision;
 
   // Initializes all the buffer objects/arrays
-  void setupMesh() {
+  void setupMesh(const VertexSource &source, const uint32_t *sourceIndices, size_t sourceIndexCount, VertexPrecision precision, bool keepData) {
+    this->keepData = keepData;
+    vertexCount = source.count;
+    indexCount = sourceIndexCount;
+    layout = VertexLayout::detect(source, precision);
+    indexType = vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    computeBounds(source);
+
+    maxIndex = 0;
+    for (size_t i = 0; i < indexCount; ++i) {
+      if (sourceIndices[i] >= vertexCount) {
+        throw XglException("Mesh index out of range.");
+      }
+      maxIndex = std::max<size_t>(maxIndex, sourceIndices[i]);
+    }
+
+    if (keepData) {
+      vertices.resize(vertexCount);
+      for (size_t i = 0; i < vertexCount; ++i) {
+        vertices[i] = source.get(i);
+      }
+      indices.assign(sourceIndices, sourceIndices + indexCount);
+    }
+
     // Create buffers/arrays
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
-    glBindVertexArray(VAO);
+    glState().bindVertexArray(VAO);
 
     // Load data into vertex buffers
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices.front(), GL_STATIC_DRAW);
+    const size_t vertexBytes = vertexCount * layout.getStride();
+    if (layout.matches(source)) {
+      glBufferData(GL_ARRAY_BUFFER, vertexBytes, source.data, GL_STATIC_DRAW);
+    } else {
+      uint8_t *dst = static_cast<uint8_t *>(allocateAndMap(GL_ARRAY_BUFFER, vertexBytes));
+      if (dst != nullptr) {
+        layout.pack(source, dst);
+        unmap(GL_ARRAY_BUFFER);
+      }
+    }
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices.front(), GL_STATIC_DRAW);
+    if (indexType == GL_UNSIGNED_SHORT) {
+      GLushort *dst = static_cast<GLushort *>(allocateAndMap(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLushort)));
+      if (dst != nullptr) {
+        std::copy(sourceIndices, sourceIndices + indexCount, dst);
+        unmap(GL_ELEMENT_ARRAY_BUFFER);
+      }
+    } else {
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLuint), sourceIndices, GL_STATIC_DRAW);
+    }
 
     // Set the vertex attribute pointers
-    // Vertex Positions
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)nullptr);
+    setupVertexAttributes();
+
+    glState().bindVertexArray(0);
+  }
+
+  // Returns a write-only mapping of a new buffer store, nullptr for empty buffers.
+  static void *allocateAndMap(GLenum target, size_t size) {
+    glBufferData(target, size, nullptr, GL_STATIC_DRAW);
+    if (size == 0) {
+      return nullptr;
+    }
+
+    void *ptr = glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (ptr == nullptr) {
+      throw XglException("Mapping mesh buffer failed.");
+    }
+    return ptr;
+  }
 
-    // Vertex Normals
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+  static void unmap(GLenum target) {
+    if (glUnmapBuffer(target) != GL_TRUE) {
+      throw XglException("Mesh buffer contents got corrupted during upload.");
+    }
+  }
+
+  size_t getIndexSize() const {
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+  }
 
-    // Vertex Texture Coords
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+  static std::vector<uint8_t> readBuffer(GLuint buffer, size_t size) {
+    std::vector<uint8_t> content(size);
+    if (size > 0) {
+      // GL_ELEMENT_ARRAY_BUFFER is VAO state, read through the copy binding point instead
+      glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+      glGetBufferSubData(GL_COPY_READ_BUFFER, 0, size, content.data());
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    return content;
+  }
 
-    // Vertex Color
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Color));
+  BufferRing &getVertexRing() {
+    if (!vertexRing) {
+      vertexRing.reset(new BufferRing(VBO, readBuffer(VBO, vertexCount * layout.getStride())));
+    }
+    return *vertexRing;
+  }
 
-    glBindVertexArray(0);
+  BufferRing &getIndexRing() {
+    if (!indexRing) {
+      indexRing.reset(new BufferRing(EBO, readBuffer(EBO, indexCount * getIndexSize())));
+    }
+    return *indexRing;
+  }
+
+  void writeIndices(BufferRing &ring, const uint32_t *sourceIndices, size_t count, size_t offset) {
+    uint8_t *dst = ring.write(offset * getIndexSize(), count * getIndexSize());
+    if (indexType == GL_UNSIGNED_SHORT) {
+      for (size_t i = 0; i < count; ++i) {
+        if (sourceIndices[i] > 0xffff) {
+          widenIndices();
+          writeIndices(*indexRing, sourceIndices, count, offset);
+          return;
+        }
+        reinterpret_cast<GLushort *>(dst)[i] = (GLushort)sourceIndices[i];
+      }
+    } else {
+      std::copy(sourceIndices, sourceIndices + count, reinterpret_cast<GLuint *>(dst));
+    }
+  }
+
+  // Switches from 16 to 32 bit indices, needed once the mesh grows beyond 65536 vertices.
+  void widenIndices() {
+    if (indexType == GL_UNSIGNED_INT) {
+      return;
+    }
+
+    BufferRing &ring = getIndexRing();
+    std::vector<GLuint> wide(indexCount);
+    const GLushort *src = reinterpret_cast<const GLushort *>(ring.getShadow().data());
+    std::copy(src, src + indexCount, wide.begin());
+
+    indexType = GL_UNSIGNED_INT;
+    ring.resize(0);
+    if (!wide.empty()) {
+      std::memcpy(ring.write(0, wide.size() * sizeof(GLuint)), wide.data(), wide.size() * sizeof(GLuint));
+    }
+  }
+
+  void commitVertices(const VertexSource &source, size_t offset) {
+    if (keepData) {
+      vertices.resize(vertexCount);
+      for (size_t i = 0; i < source.count; ++i) {
+        vertices[offset + i] = source.get(i);
+      }
+    }
+
+    if (vertexCount > 65536 && indexType == GL_UNSIGNED_SHORT) {
+      widenIndices();
+      EBO = indexRing->commit();
+    }
+
+    VBO = vertexRing->commit();
+    computeBounds(VertexSource(reinterpret_cast<const float *>(vertexRing->getShadow().data()), vertexCount, 3, layout.getStride() / sizeof(float)));
+    rebindBuffers();
+  }
+
+  void commitIndices(const uint32_t *sourceIndices, size_t count, size_t offset) {
+    if (keepData) {
+      indices.resize(indexCount);
+      std::copy(sourceIndices, sourceIndices + count, indices.begin() + offset);
+    }
+
+    // exact maximum, overwritten indices may have been the largest
+    maxIndex = 0;
+    const uint8_t *shadow = indexRing->getShadow().data();
+    for (size_t i = 0; i < indexCount; ++i) {
+      const size_t index = indexType == GL_UNSIGNED_SHORT ? reinterpret_cast<const GLushort *>(shadow)[i] : reinterpret_cast<const GLuint *>(shadow)[i];
+      maxIndex = std::max(maxIndex, index);
+    }
+
+    EBO = indexRing->commit();
+    rebindBuffers();
+  }
+
+  void releaseLods() {
+    if (lodVAO != 0) {
+      glState().forgetVertexArray(lodVAO);
+      glDeleteVertexArrays(1, &lodVAO);
+      glDeleteBuffers(1, &lodEBO);
+      lodVAO = lodEBO = 0;
+    }
+    lods.clear();
+    lodIndexTotal = 0;
+  }
+
+  // The levels of detail are derived from the previous contents, they are dropped.
+  void rebindBuffers() {
+    releaseLods();
+    glState().bindVertexArray(VAO);
+    setupVertexAttributes();
+    glState().bindVertexArray(0);
+    ++bufferRevision;
+    touchScene();
+  }
+
+  void computeBounds(const VertexSource &source) {
+    bounds = BoundingBox();
+    for (size_t i = 0; i < source.count; ++i) {
+      const float *r = source.row(i);
+      bounds.add(glm::vec3(r[0], r[1], r[2]));
+    }
+
+    // sphere around the box center, tighter than the box diagonal for most meshes
+    boundingSphere = BoundingSphere();
+    if (!bounds.isEmpty()) {
+      const glm::vec3 center = bounds.getCenter();
+      float radiusSquared = 0;
+      for (size_t i = 0; i < source.count; ++i) {
+        const float *r = source.row(i);
+        const glm::vec3 d = glm::vec3(r[0], r[1], r[2]) - center;
+        radiusSquared = std::max(radiusSquared, glm::dot(d, d));
+      }
+      boundingSphere = BoundingSphere(center, std::sqrt(radiusSquared));
+    }
   }
 };
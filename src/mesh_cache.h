@@ -0,0 +1,431 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "material.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "utils.h"
+#include "vertex_layout.h"
+
+
+// Texture referenced by an imported mesh, path relative to the model file.
+struct TextureRef {
+  TextureType type;
+  std::string path;
+};
+
+
+// Vertices and indices of an imported mesh, either owned (fresh import) or pointing into a
+// mapped cache file.
+struct ImportedMesh {
+  const Vertex *vertices;
+  size_t vertexCount;
+  const uint32_t *indices;
+  size_t indexCount;
+  const LodLevel *lods;           // simplified levels, ranges of lodIndices
+  size_t lodCount;
+  const uint32_t *lodIndices;
+  size_t lodIndexCount;
+  std::vector<TextureRef> textures;
+
+  std::vector<Vertex> vertexStorage;
+  std::vector<uint32_t> indexStorage;
+  std::vector<LodLevel> lodStorage;
+  std::vector<uint32_t> lodIndexStorage;
+
+  ImportedMesh()
+    : vertices(nullptr), vertexCount(0), indices(nullptr), indexCount(0)
+    , lods(nullptr), lodCount(0), lodIndices(nullptr), lodIndexCount(0) {
+  }
+
+  // Points vertices, indices and levels of detail at the owned storage.
+  void attachStorage() {
+    vertices = vertexStorage.data();
+    vertexCount = vertexStorage.size();
+    indices = indexStorage.data();
+    indexCount = indexStorage.size();
+    lods = lodStorage.data();
+    lodCount = lodStorage.size();
+    lodIndices = lodIndexStorage.data();
+    lodIndexCount = lodIndexStorage.size();
+  }
+};
+
+
+// Read-only mapping of a mesh cache file, the meshes point into the mapped pages.
+class MeshCacheFile {
+public:
+  MeshCacheFile(void *mapping, size_t size, std::vector<ImportedMesh> &&meshes)
+    : mapping(mapping), size(size), meshes(std::move(meshes)) {
+  }
+
+  ~MeshCacheFile() {
+    munmap(mapping, size);
+  }
+
+  MeshCacheFile & operator =(const MeshCacheFile &) = delete;
+  MeshCacheFile(const MeshCacheFile &) = delete;
+
+  const std::vector<ImportedMesh>& getMeshes() const {
+    return meshes;
+  }
+
+private:
+  void *mapping;
+  size_t size;
+  std::vector<ImportedMesh> meshes;
+};
+
+
+// On-disk cache of imported models, so repeated loads skip the Assimp import. One file per model
+// holds the triangulated meshes, their levels of detail and texture references, keyed by the
+// absolute source path, its modification time and size, the import flags, optimization and LOD
+// options. Files are mapped, vertex and index data are packed into GL buffers directly from the
+// mapped pages.
+//
+// File layout (native byte order, sections 16 byte aligned):
+//   FileHeader, source path, MeshRecord[meshCount], texture table, vertex, index and LOD data
+//   (LodLevel[lodCount] followed by the LOD indices) per mesh
+class MeshCache {
+public:
+  MeshCache()
+    : directory(getDefaultDirectory()) {
+  }
+
+  MeshCache & operator =(const MeshCache &) = delete;
+  MeshCache(const MeshCache &) = delete;
+
+  // An empty directory disables the cache.
+  void setDirectory(const std::string &path) {
+    directory = path;
+  }
+
+  const std::string& getDirectory() const {
+    return directory;
+  }
+
+  bool isEnabled() const {
+    return !directory.empty();
+  }
+
+  // Returns the cached import of sourcePath or null if there is none for its current version.
+  std::unique_ptr<MeshCacheFile> load(const std::string &sourcePath, uint32_t importFlags, const OptimizeOptions &optimizeOptions, const LodOptions &lodOptions) const {
+    SourceKey key;
+    if (!isEnabled() || !getSourceKey(sourcePath, importFlags, optimizeOptions, lodOptions, key)) {
+      return nullptr;
+    }
+
+    const int fd = open(getCachePath(key).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return nullptr;
+    }
+
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(FileHeader)) {
+      mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      return nullptr;
+    }
+
+    std::vector<ImportedMesh> meshes;
+    if (!parse(static_cast<const uint8_t *>(mapping), st.st_size, key, meshes)) {
+      munmap(mapping, st.st_size);
+      return nullptr;
+    }
+    return std::unique_ptr<MeshCacheFile>(new MeshCacheFile(mapping, st.st_size, std::move(meshes)));
+  }
+
+  // Writes the import of sourcePath to the cache. Failures are reported and otherwise ignored,
+  // the cache is an optimization only.
+  void store(const std::string &sourcePath, uint32_t importFlags, const OptimizeOptions &optimizeOptions, const LodOptions &lodOptions, const std::vector<ImportedMesh> &meshes) const {
+    SourceKey key;
+    if (!isEnabled() || !getSourceKey(sourcePath, importFlags, optimizeOptions, lodOptions, key) || !createDirectories(directory)) {
+      return;
+    }
+
+    std::vector<uint8_t> textureTable;
+    std::vector<MeshRecord> records(meshes.size());
+    uint64_t offset = align(sizeof(FileHeader) + key.path.size()) + align(sizeof(MeshRecord) * meshes.size());
+
+    for (size_t i = 0; i < meshes.size(); ++i) {
+      const ImportedMesh &mesh = meshes[i];
+      MeshRecord &r = records[i];
+      r.vertexCount = mesh.vertexCount;
+      r.indexCount = mesh.indexCount;
+      r.lodCount = mesh.lodCount;
+      r.lodIndexCount = mesh.lodIndexCount;
+      r.textureCount = mesh.textures.size();
+      r.textureOffset = textureTable.size();
+      for (const TextureRef &t : mesh.textures) {
+        const uint32_t entry[2] = { (uint32_t)t.type, (uint32_t)t.path.size() };
+        textureTable.insert(textureTable.end(), reinterpret_cast<const uint8_t *>(entry), reinterpret_cast<const uint8_t *>(entry + 2));
+        textureTable.insert(textureTable.end(), t.path.begin(), t.path.end());
+      }
+    }
+
+    offset += align(textureTable.size());
+    for (size_t i = 0; i < meshes.size(); ++i) {
+      records[i].vertexOffset = offset;
+      offset += align(meshes[i].vertexCount * sizeof(Vertex));
+      records[i].indexOffset = offset;
+      offset += align(meshes[i].indexCount * sizeof(uint32_t));
+      records[i].lodOffset = offset;
+      offset += align(getLodBytes(records[i]));
+    }
+
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, getMagic(), sizeof(header.magic));
+    header.version = VERSION;
+    header.importFlags = importFlags;
+    header.optimize = optimizeOptions.enabled;
+    header.weldTolerance = optimizeOptions.weldTolerance;
+    header.weldNormalAngle = optimizeOptions.weldNormalAngle;
+    header.lodLevelCount = lodOptions.levelCount;
+    header.lodMinTriangles = lodOptions.minTriangles;
+    header.sourceMTime = key.mtime;
+    header.sourceSize = key.size;
+    header.pathLength = key.path.size();
+    header.meshCount = meshes.size();
+    header.textureTableSize = textureTable.size();
+    header.fileSize = offset;
+
+    // written under a temporary name and renamed, concurrent loads never see partial files. The
+    // counter keeps concurrent stores of the same file in one process apart.
+    static std::atomic<unsigned> storeCounter(0);
+    const std::string path = getCachePath(key);
+    const std::string tempPath = path + string_format(".%d.%u.tmp", (int)getpid(), storeCounter++);
+    FILE *f = fopen(tempPath.c_str(), "wb");
+    if (f == nullptr) {
+      fprintf(stderr, "xgl: Cannot write mesh cache file '%s': %s\n", tempPath.c_str(), strerror(errno));
+      return;
+    }
+
+    bool ok = writePadded(f, &header, sizeof(header), 0)
+      && writePadded(f, key.path.data(), key.path.size(), sizeof(header) + key.path.size())
+      && writePadded(f, records.data(), records.size() * sizeof(MeshRecord), records.size() * sizeof(MeshRecord))
+      && writePadded(f, textureTable.data(), textureTable.size(), textureTable.size());
+    for (size_t i = 0; ok && i < meshes.size(); ++i) {
+      const size_t vertexBytes = meshes[i].vertexCount * sizeof(Vertex);
+      const size_t indexBytes = meshes[i].indexCount * sizeof(uint32_t);
+      const size_t lodBytes = meshes[i].lodCount * sizeof(LodLevel);
+      const size_t lodIndexBytes = meshes[i].lodIndexCount * sizeof(uint32_t);
+      ok = writePadded(f, meshes[i].vertices, vertexBytes, vertexBytes) && writePadded(f, meshes[i].indices, indexBytes, indexBytes)
+        && writePadded(f, meshes[i].lods, lodBytes, 0) && writePadded(f, meshes[i].lodIndices, lodIndexBytes, lodBytes + lodIndexBytes);
+    }
+    ok = fclose(f) == 0 && ok;
+
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+      fprintf(stderr, "xgl: Cannot write mesh cache file '%s': %s\n", path.c_str(), strerror(errno));
+      unlink(tempPath.c_str());
+    }
+  }
+
+private:
+  enum : uint32_t { VERSION = 4 };
+
+  static const char* getMagic() {
+    return "XGLMESH";     // 8 bytes with the terminator
+  }
+
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t importFlags;
+    uint32_t lodLevelCount;
+    uint32_t lodMinTriangles;
+    uint32_t optimize;
+    float weldTolerance;
+    float weldNormalAngle;
+    int64_t sourceMTime;      // nanoseconds
+    uint64_t sourceSize;
+    uint32_t pathLength;
+    uint32_t meshCount;
+    uint64_t textureTableSize;
+    uint64_t fileSize;
+  };
+
+  struct MeshRecord {
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t lodCount;
+    uint64_t lodIndexCount;
+    uint64_t lodOffset;
+    uint32_t textureCount;
+    uint32_t textureOffset;   // within the texture table
+  };
+
+  struct SourceKey {
+    std::string path;         // absolute
+    uint32_t importFlags;
+    OptimizeOptions optimizeOptions;
+    LodOptions lodOptions;
+    int64_t mtime;
+    uint64_t size;
+  };
+
+  std::string directory;
+
+  static size_t align(size_t size) {
+    return (size + 15) & ~(size_t)15;
+  }
+
+  static size_t getLodBytes(const MeshRecord &r) {
+    return r.lodCount * sizeof(LodLevel) + r.lodIndexCount * sizeof(uint32_t);
+  }
+
+  static bool writePadded(FILE *f, const void *data, size_t size, size_t alignedFrom) {
+    static const uint8_t zeros[16] = {};
+    if (size > 0 && fwrite(data, 1, size, f) != size) {
+      return false;
+    }
+    const size_t padding = align(alignedFrom) - alignedFrom;
+    return padding == 0 || fwrite(zeros, 1, padding, f) == padding;
+  }
+
+  static std::string getDefaultDirectory() {
+    const char *path = getenv("XGL_MESH_CACHE");
+    if (path != nullptr) {
+      return path;      // set but empty disables the cache
+    }
+    const char *cacheHome = getenv("XDG_CACHE_HOME");
+    if (cacheHome != nullptr && *cacheHome != 0) {
+      return std::string(cacheHome) + "/xamla-xgl/meshes";
+    }
+    const char *home = getenv("HOME");
+    if (home != nullptr && *home != 0) {
+      return std::string(home) + "/.cache/xamla-xgl/meshes";
+    }
+    return std::string();
+  }
+
+  static bool createDirectories(const std::string &path) {
+    for (size_t i = 1; i <= path.size(); ++i) {
+      if (i == path.size() || path[i] == '/') {
+        const std::string part = path.substr(0, i);
+        if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) {
+          fprintf(stderr, "xgl: Cannot create mesh cache directory '%s': %s\n", part.c_str(), strerror(errno));
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  static bool getSourceKey(const std::string &sourcePath, uint32_t importFlags, const OptimizeOptions &optimizeOptions, const LodOptions &lodOptions, SourceKey &key) {
+    char resolved[PATH_MAX];
+    struct stat st;
+    if (realpath(sourcePath.c_str(), resolved) == nullptr || stat(resolved, &st) != 0) {
+      return false;
+    }
+    key.path = resolved;
+    key.importFlags = importFlags;
+    key.optimizeOptions = optimizeOptions;
+    key.lodOptions = lodOptions;
+    key.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    key.size = st.st_size;
+    return true;
+  }
+
+  // FNV-1a of path, import flags, optimization and LOD options, so a changed source replaces its
+  // old entry. The header holds the full key to detect stale files and hash collisions.
+  std::string getCachePath(const SourceKey &key) const {
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash](const void *data, size_t size) {
+      const uint8_t *p = static_cast<const uint8_t *>(data);
+      for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+      }
+    };
+    mix(key.path.data(), key.path.size());
+    mix(&key.importFlags, sizeof(key.importFlags));
+    mix(&key.optimizeOptions.enabled, sizeof(key.optimizeOptions.enabled));
+    mix(&key.optimizeOptions.weldTolerance, sizeof(key.optimizeOptions.weldTolerance));
+    mix(&key.optimizeOptions.weldNormalAngle, sizeof(key.optimizeOptions.weldNormalAngle));
+    mix(&key.lodOptions.levelCount, sizeof(key.lodOptions.levelCount));
+    mix(&key.lodOptions.minTriangles, sizeof(key.lodOptions.minTriangles));
+    return directory + string_format("/%016llx.xglmesh", (unsigned long long)hash);
+  }
+
+  static bool parse(const uint8_t *data, size_t size, const SourceKey &key, std::vector<ImportedMesh> &meshes) {
+    FileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, getMagic(), sizeof(header.magic)) != 0 || header.version != VERSION
+      || header.importFlags != key.importFlags || header.optimize != key.optimizeOptions.enabled
+      || header.weldTolerance != key.optimizeOptions.weldTolerance || header.weldNormalAngle != key.optimizeOptions.weldNormalAngle
+      || header.lodLevelCount != key.lodOptions.levelCount
+      || header.lodMinTriangles != key.lodOptions.minTriangles || header.sourceMTime != key.mtime || header.sourceSize != key.size
+      || header.fileSize != size || header.pathLength != key.path.size()
+      || std::memcmp(data + sizeof(header), key.path.data(), key.path.size()) != 0) {
+      return false;
+    }
+
+    const size_t recordsOffset = align(sizeof(FileHeader) + header.pathLength);
+    const size_t textureTableOffset = recordsOffset + align(sizeof(MeshRecord) * header.meshCount);
+    if (textureTableOffset + header.textureTableSize > size) {
+      return false;
+    }
+
+    const MeshRecord *records = reinterpret_cast<const MeshRecord *>(data + recordsOffset);
+    const uint8_t *textureTable = data + textureTableOffset;
+    meshes.resize(header.meshCount);
+    for (uint32_t i = 0; i < header.meshCount; ++i) {
+      const MeshRecord &r = records[i];
+      if (r.vertexOffset + r.vertexCount * sizeof(Vertex) > size || r.indexOffset + r.indexCount * sizeof(uint32_t) > size
+        || r.lodOffset + getLodBytes(r) > size) {
+        return false;
+      }
+
+      ImportedMesh &mesh = meshes[i];
+      mesh.vertices = reinterpret_cast<const Vertex *>(data + r.vertexOffset);
+      mesh.vertexCount = r.vertexCount;
+      mesh.indices = reinterpret_cast<const uint32_t *>(data + r.indexOffset);
+      mesh.indexCount = r.indexCount;
+      mesh.lods = reinterpret_cast<const LodLevel *>(data + r.lodOffset);
+      mesh.lodCount = r.lodCount;
+      mesh.lodIndices = reinterpret_cast<const uint32_t *>(data + r.lodOffset + r.lodCount * sizeof(LodLevel));
+      mesh.lodIndexCount = r.lodIndexCount;
+
+      size_t p = r.textureOffset;
+      for (uint32_t j = 0; j < r.textureCount; ++j) {
+        uint32_t entry[2];
+        if (p + sizeof(entry) > header.textureTableSize) {
+          return false;
+        }
+        std::memcpy(entry, textureTable + p, sizeof(entry));
+        p += sizeof(entry);
+        if (p + entry[1] > header.textureTableSize) {
+          return false;
+        }
+        TextureRef t = { (TextureType)entry[0], std::string(reinterpret_cast<const char *>(textureTable + p), entry[1]) };
+        mesh.textures.push_back(t);
+        p += entry[1];
+      }
+    }
+    return true;
+  }
+};
+
+
+inline MeshCache& meshCache() {
+  static MeshCache cache;
+  return cache;
+}
@@ -0,0 +1,478 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+#include "vertex_layout.h"
+
+
+// Vertex welding and reordering of model imports.
+struct OptimizeOptions {
+  uint32_t enabled;         // 0 keeps imported meshes as they are
+  float weldTolerance;      // largest distance of welded vertex positions, in model units
+  float weldNormalAngle;    // largest angle between welded normals in degrees, 0 for equal normals
+};
+
+// Process-wide, set before loading, see importLodOptions.
+inline OptimizeOptions& importOptimizeOptions() {
+  static OptimizeOptions options = { 1, 1e-6f, 0 };
+  return options;
+}
+
+
+// Sizes before and after optimizing, cache misses are counted for a 16 entry FIFO post-transform
+// cache (transformed vertices).
+struct ImportOptimizeStats {
+  double meshCount;
+  double inputVertices;
+  double outputVertices;
+  double inputIndices;
+  double outputIndices;
+  double inputCacheMisses;
+  double outputCacheMisses;
+};
+
+
+// Totals of all meshes optimized since the last reset. Imports served by the mesh cache are
+// not counted, they were optimized when the cache entry was written.
+class ImportOptimizeCounters {
+public:
+  ImportOptimizeCounters() {
+    reset();
+  }
+
+  ImportOptimizeCounters & operator =(const ImportOptimizeCounters &) = delete;
+  ImportOptimizeCounters(const ImportOptimizeCounters &) = delete;
+
+  void add(const ImportOptimizeStats &mesh) {
+    std::lock_guard<std::mutex> lock(mutex);
+    totals.meshCount += mesh.meshCount;
+    totals.inputVertices += mesh.inputVertices;
+    totals.outputVertices += mesh.outputVertices;
+    totals.inputIndices += mesh.inputIndices;
+    totals.outputIndices += mesh.outputIndices;
+    totals.inputCacheMisses += mesh.inputCacheMisses;
+    totals.outputCacheMisses += mesh.outputCacheMisses;
+  }
+
+  ImportOptimizeStats getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return totals;
+  }
+
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    totals = ImportOptimizeStats();
+  }
+
+private:
+  mutable std::mutex mutex;
+  ImportOptimizeStats totals;
+};
+
+inline ImportOptimizeCounters& importOptimizeCounters() {
+  static ImportOptimizeCounters counters;
+  return counters;
+}
+
+
+// Post-transform cache misses of drawing the triangles with a FIFO cache of cacheSize entries.
+inline size_t countCacheMisses(const uint32_t *indices, size_t indexCount, size_t vertexCount, size_t cacheSize = 16) {
+  std::vector<size_t> missed(vertexCount, 0);     // miss number that loaded the vertex, 0 if never
+  size_t misses = 0;
+  for (size_t i = 0; i < indexCount; ++i) {
+    const uint32_t v = indices[i];
+    if (missed[v] == 0 || misses - missed[v] >= cacheSize) {
+      missed[v] = ++misses;
+    }
+  }
+  return misses;
+}
+
+
+// Replaces each vertex by the first earlier vertex within tolerance (positions) with equal
+// normal, texture coordinates and color, and removes triangles that became degenerate. With a
+// normalAngle above 0 normals up to that many degrees apart are welded too (e.g. the per-face
+// normals of STL files) and welded vertices get the corner angle weighted average normal.
+// Unreferenced vertices are dropped by optimizeVertexFetch.
+inline void weldVertices(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, float tolerance, float normalAngle = 0) {
+  const size_t vertexCount = vertices.size();
+
+  // positions are hashed by grid cells twice the tolerance wide, candidates are in the cells
+  // touched by the tolerance box around a vertex (at most two per axis)
+  const double inverseCell = tolerance > 0 ? 0.5 / tolerance : 0;
+  auto cellOf = [inverseCell](float x) -> int64_t {
+    const double c = std::floor(x * inverseCell);
+    return (int64_t)std::max(-4.0e18, std::min(4.0e18, c));
+  };
+  auto hashCell = [](int64_t x, int64_t y, int64_t z) -> uint64_t {
+    uint64_t h = (uint64_t)x * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 29) ^ (uint64_t)y) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 31) ^ (uint64_t)z) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 32);
+  };
+  auto positionKey = [&](const glm::vec3 &p) -> uint64_t {
+    if (tolerance > 0) {
+      return hashCell(cellOf(p.x), cellOf(p.y), cellOf(p.z));
+    }
+    // exact matches only, +0 and -0 are equal
+    int32_t bits[3];
+    for (int k = 0; k < 3; ++k) {
+      const float c = p[k] == 0 ? 0.0f : p[k];
+      std::memcpy(&bits[k], &c, sizeof(float));
+    }
+    return hashCell(bits[0], bits[1], bits[2]);
+  };
+  const float normalCos = std::cos(glm::radians(std::min(normalAngle, 180.0f)));
+  auto normalsMatch = [normalAngle, normalCos](const glm::vec3 &a, const glm::vec3 &b) {
+    if (glm::length(a - b) <= 1e-3f) {
+      return true;
+    }
+    const float d = glm::dot(a, b);
+    return normalAngle > 0 && d > 0 && d >= normalCos * glm::length(a) * glm::length(b);
+  };
+  auto matches = [tolerance, &normalsMatch](const Vertex &a, const Vertex &b) {
+    const glm::vec3 d = a.Position - b.Position;
+    return glm::dot(d, d) <= tolerance * tolerance
+      && normalsMatch(a.Normal, b.Normal)
+      && std::abs(a.TexCoords.x - b.TexCoords.x) <= 1e-5f && std::abs(a.TexCoords.y - b.TexCoords.y) <= 1e-5f
+      && glm::length(a.Color - b.Color) <= 1e-3f;
+  };
+
+  // representatives per cell hash, chained through next (hash collisions only add candidates)
+  const uint32_t NONE = ~0u;
+  std::unordered_map<uint64_t, uint32_t> heads;
+  heads.reserve(vertexCount);
+  std::vector<uint32_t> next;
+  std::vector<uint32_t> remap(vertexCount);
+  for (uint32_t v = 0; v < vertexCount; ++v) {
+    const Vertex &vertex = vertices[v];
+    uint32_t found = NONE;
+    auto search = [&](uint64_t key) {
+      auto head = heads.find(key);
+      for (uint32_t r = head != heads.end() ? head->second : NONE; r != NONE; r = next[r]) {
+        if (r < found && matches(vertices[r], vertex)) {
+          found = r;
+        }
+      }
+    };
+
+    if (tolerance > 0) {
+      int64_t lo[3], hi[3];
+      for (int k = 0; k < 3; ++k) {
+        lo[k] = cellOf(vertex.Position[k] - tolerance);
+        hi[k] = cellOf(vertex.Position[k] + tolerance);
+      }
+      for (int64_t x = lo[0]; x <= hi[0]; ++x) {
+        for (int64_t y = lo[1]; y <= hi[1]; ++y) {
+          for (int64_t z = lo[2]; z <= hi[2]; ++z) {
+            search(hashCell(x, y, z));
+          }
+        }
+      }
+    } else {
+      search(positionKey(vertex.Position));
+    }
+
+    if (found != NONE) {
+      remap[v] = found;
+      next.push_back(NONE);
+    } else {
+      remap[v] = v;
+      uint32_t &head = heads.emplace(positionKey(vertex.Position), NONE).first->second;
+      next.push_back(head);
+      head = v;
+    }
+  }
+
+  // representatives are compared with their original normal above, averaging happens afterwards
+  if (normalAngle > 0) {
+    std::vector<glm::vec3> sums(vertexCount, glm::vec3(0.0f));
+    std::vector<bool> merged(vertexCount, false);
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+      if (remap[v] != v) {
+        merged[remap[v]] = true;
+      }
+    }
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      for (size_t k = 0; k < 3; ++k) {
+        const uint32_t v = indices[i + k];
+        const glm::vec3 &p = vertices[v].Position;
+        const glm::vec3 e1 = vertices[indices[i + (k + 1) % 3]].Position - p;
+        const glm::vec3 e2 = vertices[indices[i + (k + 2) % 3]].Position - p;
+        const float lengths = glm::length(e1) * glm::length(e2);
+        if (merged[remap[v]] && lengths > 0) {
+          const float angle = std::acos(std::max(-1.0f, std::min(1.0f, glm::dot(e1, e2) / lengths)));
+          sums[remap[v]] += vertices[v].Normal * angle;
+        }
+      }
+    }
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+      const float length = glm::length(sums[v]);
+      if (merged[v] && length > 0) {
+        vertices[v].Normal = sums[v] / length;
+      }
+    }
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const uint32_t a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+    if (a != b && b != c && c != a) {
+      indices[count++] = a;
+      indices[count++] = b;
+      indices[count++] = c;
+    }
+  }
+  indices.resize(count);
+}
+
+
+// Reorders triangles for post-transform cache reuse with the greedy scoring of T. Forsyth,
+// "Linear-Speed Vertex Cache Optimisation": the next triangle is the best scored one among
+// those of the cached vertices, scores favor recently used vertices and vertices with few
+// remaining triangles. Ties keep the input order, the result is deterministic.
+inline void optimizeVertexCache(uint32_t *indices, size_t indexCount, size_t vertexCount) {
+  enum { CACHE_SIZE = 32 };
+  const size_t triangleCount = indexCount / 3;
+  if (triangleCount < 2) {
+    return;
+  }
+
+  auto vertexScore = [](int cachePosition, uint32_t remaining) -> float {
+    if (remaining == 0) {
+      return -1.0f;
+    }
+    float score = 0;
+    if (cachePosition >= 0) {
+      // the vertices of the last triangle get a fixed score, they would be used by its neighbors anyway
+      score = cachePosition < 3 ? 0.75f : std::pow(1.0f - (cachePosition - 3) / (float)(CACHE_SIZE - 3), 1.5f);
+    }
+    return score + 2.0f / std::sqrt((float)remaining);
+  };
+
+  // triangles per vertex, live ones first
+  std::vector<uint32_t> offsets(vertexCount + 1, 0);
+  for (size_t i = 0; i < triangleCount * 3; ++i) {
+    ++offsets[indices[i] + 1];
+  }
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  std::vector<uint32_t> remaining(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    remaining[v] = offsets[v + 1] - offsets[v];
+  }
+  std::vector<uint32_t> adjacency(triangleCount * 3);
+  {
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+      adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+    }
+  }
+
+  std::vector<int> cachePosition(vertexCount, -1);
+  std::vector<float> scores(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    scores[v] = vertexScore(-1, remaining[v]);
+  }
+  std::vector<float> triangleScores(triangleCount);
+  uint32_t best = 0;
+  for (size_t t = 0; t < triangleCount; ++t) {
+    triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+    if (triangleScores[t] > triangleScores[best]) {
+      best = (uint32_t)t;
+    }
+  }
+
+  const uint32_t NONE = ~0u;
+  std::vector<uint32_t> input(indices, indices + triangleCount * 3);
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<uint32_t> cache, newCache;
+  cache.reserve(CACHE_SIZE + 3);
+  newCache.reserve(CACHE_SIZE + 3);
+  size_t cursor = 0;        // triangles before it are emitted, used when the cache has no candidates
+
+  for (size_t output = 0; output < triangleCount; ++output) {
+    if (best == NONE) {
+      while (emitted[cursor]) {
+        ++cursor;
+      }
+      best = (uint32_t)cursor;
+    }
+
+    const uint32_t *corners = &input[best * 3];
+    std::copy(corners, corners + 3, indices + output * 3);
+    emitted[best] = true;
+
+    for (size_t k = 0; k < 3; ++k) {
+      const uint32_t v = corners[k];
+      uint32_t *live = &adjacency[offsets[v]];
+      const uint32_t last = --remaining[v];
+      *std::find(live, live + last, best) = live[last];
+    }
+
+    // emitted vertices move to the front, the others keep their order
+    newCache.assign(corners, corners + 3);
+    for (uint32_t v : cache) {
+      if (v != corners[0] && v != corners[1] && v != corners[2]) {
+        newCache.push_back(v);
+      }
+    }
+
+    for (size_t i = 0; i < newCache.size(); ++i) {
+      const uint32_t v = newCache[i];
+      cachePosition[v] = i < CACHE_SIZE ? (int)i : -1;
+      const float score = vertexScore(cachePosition[v], remaining[v]);
+      const float delta = score - scores[v];
+      scores[v] = score;
+      for (uint32_t j = offsets[v]; j < offsets[v] + remaining[v]; ++j) {
+        triangleScores[adjacency[j]] += delta;
+      }
+    }
+    if (newCache.size() > CACHE_SIZE) {
+      newCache.resize(CACHE_SIZE);
+    }
+    cache.swap(newCache);
+
+    best = NONE;
+    float bestScore = -1;
+    for (uint32_t v : cache) {
+      for (uint32_t j = offsets[v]; j < offsets[v] + remaining[v]; ++j) {
+        const uint32_t t = adjacency[j];
+        if (triangleScores[t] > bestScore || (triangleScores[t] == bestScore && t < best)) {
+          bestScore = triangleScores[t];
+          best = t;
+        }
+      }
+    }
+  }
+}
+
+
+// Reorders clusters of a vertex cache optimized triangle sequence to reduce overdraw, after
+// P. Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw". Clusters
+// start where all vertices of a triangle miss the cache, so moving them keeps the cache
+// efficiency. Clusters facing away from the mesh center are drawn first, they are likely to
+// occlude the others.
+inline void optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices) {
+  enum { CACHE_SIZE = 16 };
+  const size_t triangleCount = indices.size() / 3;
+  if (triangleCount < 2) {
+    return;
+  }
+
+  std::vector<uint32_t> clusterStarts;
+  std::vector<size_t> missed(vertices.size(), 0);
+  size_t misses = 0;
+  for (size_t t = 0; t < triangleCount; ++t) {
+    size_t triangleMisses = 0;
+    for (size_t k = 0; k < 3; ++k) {
+      const uint32_t v = indices[t * 3 + k];
+      if (missed[v] == 0 || misses - missed[v] >= CACHE_SIZE) {
+        missed[v] = ++misses;
+        ++triangleMisses;
+      }
+    }
+    if (t == 0 || triangleMisses == 3) {
+      clusterStarts.push_back((uint32_t)t);
+    }
+  }
+  if (clusterStarts.size() < 2) {
+    return;
+  }
+  clusterStarts.push_back((uint32_t)triangleCount);
+
+  // area weighted centroids and normals
+  const size_t clusterCount = clusterStarts.size() - 1;
+  std::vector<glm::vec3> centroids(clusterCount), normals(clusterCount);
+  std::vector<float> areas(clusterCount);
+  glm::vec3 meshCentroid(0, 0, 0);
+  float meshArea = 0;
+  for (size_t c = 0; c < clusterCount; ++c) {
+    glm::vec3 centroid(0, 0, 0), normal(0, 0, 0);
+    float area = 0;
+    for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t) {
+      const glm::vec3 &p0 = vertices[indices[t * 3]].Position;
+      const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].Position;
+      const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].Position;
+      const glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+      const float a = glm::length(n);
+      centroid += (p0 + p1 + p2) * (a / 3.0f);
+      normal += n;
+      area += a;
+    }
+    meshCentroid += centroid;
+    meshArea += area;
+    centroids[c] = area > 0 ? centroid / area : vertices[indices[clusterStarts[c] * 3]].Position;
+    normals[c] = normal;
+    areas[c] = area;
+  }
+  if (meshArea > 0) {
+    meshCentroid = meshCentroid / meshArea;
+  }
+
+  std::vector<float> keys(clusterCount);
+  for (size_t c = 0; c < clusterCount; ++c) {
+    const float length = glm::length(normals[c]);
+    keys[c] = length > 0 ? glm::dot(centroids[c] - meshCentroid, normals[c]) / length : 0;
+  }
+  std::vector<uint32_t> order(clusterCount);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+  std::vector<uint32_t> sorted;
+  sorted.reserve(triangleCount * 3);
+  for (uint32_t c : order) {
+    sorted.insert(sorted.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+  }
+  indices.swap(sorted);
+}
+
+
+// Renumbers the vertices in the order of their first use, so the vertex fetch reads the buffer
+// front to back. Unreferenced vertices are dropped.
+inline void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices) {
+  const uint32_t NONE = ~0u;
+  std::vector<uint32_t> remap(vertices.size(), NONE);
+  std::vector<Vertex> ordered;
+  ordered.reserve(vertices.size());
+  for (uint32_t &index : indices) {
+    if (remap[index] == NONE) {
+      remap[index] = (uint32_t)ordered.size();
+      ordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices.swap(ordered);
+}
+
+
+// Welds and reorders an imported mesh, see the functions above. Meshes that are not triangle
+// lists are left as they are.
+inline ImportOptimizeStats optimizeMesh(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, float weldTolerance, float weldNormalAngle = 0) {
+  ImportOptimizeStats stats = ImportOptimizeStats();
+  stats.meshCount = 1;
+  stats.inputVertices = (double)vertices.size();
+  stats.inputIndices = (double)indices.size();
+
+  const bool valid = indices.size() % 3 == 0
+    && std::all_of(indices.begin(), indices.end(), [&vertices](uint32_t i) { return i < vertices.size(); });
+  if (valid) {
+    stats.inputCacheMisses = (double)countCacheMisses(indices.data(), indices.size(), vertices.size());
+    weldVertices(vertices, indices, weldTolerance, weldNormalAngle);
+    optimizeVertexCache(indices.data(), indices.size(), vertices.size());
+    optimizeOverdraw(indices, vertices);
+    optimizeVertexFetch(vertices, indices);
+  }
+
+  stats.outputVertices = (double)vertices.size();
+  stats.outputIndices = (double)indices.size();
+  if (valid) {
+    stats.outputCacheMisses = (double)countCacheMisses(indices.data(), indices.size(), vertices.size());
+  }
+  return stats;
+}
@@ -0,0 +1,407 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh_optimizer.h"
+#include "vertex_layout.h"
+
+
+// Simplified index buffer of a mesh, see Mesh::setLods.
+struct LodLevel {
+  uint32_t indexOffset;     // into the LOD index array
+  uint32_t indexCount;
+  float error;              // largest RMS quadric distance of its collapses, in model units
+};
+
+static_assert(sizeof(LodLevel) == 3 * sizeof(uint32_t), "LodLevel must be tightly packed");
+
+
+// Level of detail generation of model imports.
+struct LodOptions {
+  uint32_t levelCount;      // 0 disables the generation
+  uint32_t minTriangles;    // smaller meshes are only drawn at full detail
+};
+
+// Process-wide, set before loading. Only read on the calling thread, asynchronous loads take a
+// copy when they are queued.
+inline LodOptions& importLodOptions() {
+  static LodOptions options = { 0, 2048 };
+  return options;
+}
+
+
+// Quadric error mesh simplification (Garland & Heckbert) by edge collapses onto existing
+// vertices. Simplified index buffers reference a subset of the original vertices, so all levels
+// share one vertex buffer. Vertices with equal positions (split at normal or texture seams) are
+// welded for the collapses; a collapsed corner takes the vertex at its new position whose normal
+// matches its own best. Boundary edges are kept in place by additional perpendicular planes,
+// collapses that would flip triangles or break the mesh topology are skipped.
+class MeshSimplifier {
+public:
+  MeshSimplifier(const Vertex *vertices, size_t vertexCount, const uint32_t *indices, size_t indexCount)
+    : vertices(vertices)
+    , indices(indices)
+    , triangleCount(indexCount / 3)
+    , liveTriangles(0)
+    , error(0) {
+    weld(vertexCount);
+    initialize(vertexCount);
+  }
+
+  MeshSimplifier & operator =(const MeshSimplifier &) = delete;
+  MeshSimplifier(const MeshSimplifier &) = delete;
+
+  // Collapses the cheapest edges until at most targetIndexCount indices remain or no valid
+  // collapse is left. Can be called repeatedly with decreasing targets.
+  void simplify(size_t targetIndexCount) {
+    while (liveTriangles * 3 > targetIndexCount && !heap.empty()) {
+      const Collapse c = heap.top();
+      heap.pop();
+      if (stamps[c.from] != c.stampFrom || stamps[c.to] != c.stampTo || !canCollapse(c.from, c.to)) {
+        continue;
+      }
+      collapse(c.from, c.to);
+      error = std::max(error, c.cost);
+    }
+  }
+
+  size_t getIndexCount() const {
+    return liveTriangles * 3;
+  }
+
+  // Largest error of the collapses so far.
+  float getError() const {
+    return error;
+  }
+
+  // Appends the indices of the remaining triangles.
+  void getIndices(std::vector<uint32_t> &output) const {
+    output.reserve(output.size() + liveTriangles * 3);
+    for (size_t t = 0; t < triangleCount; ++t) {
+      if (!alive[t]) {
+        continue;
+      }
+      for (size_t k = 0; k < 3; ++k) {
+        const uint32_t original = indices[t * 3 + k];
+        const uint32_t target = corners[t * 3 + k];
+        output.push_back(target == welded[original] ? original : closestMember(target, vertices[original].Normal));
+      }
+    }
+  }
+
+private:
+  // Symmetric 4x4 matrix of summed plane equations, with the summed plane weights.
+  struct Quadric {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2, weight;
+
+    void addPlane(const glm::dvec3 &n, double d, double w) {
+      a2 += w * n.x * n.x; ab += w * n.x * n.y; ac += w * n.x * n.z; ad += w * n.x * d;
+      b2 += w * n.y * n.y; bc += w * n.y * n.z; bd += w * n.y * d;
+      c2 += w * n.z * n.z; cd += w * n.z * d;
+      d2 += w * d * d;
+      weight += w;
+    }
+
+    void add(const Quadric &q) {
+      a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2; bc += q.bc; bd += q.bd;
+      c2 += q.c2; cd += q.cd; d2 += q.d2; weight += q.weight;
+    }
+
+    // Weighted RMS distance of p to the planes.
+    float distance(const glm::vec3 &v) const {
+      const double x = v.x, y = v.y, z = v.z;
+      const double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+        + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+        + c2 * z * z + 2 * cd * z + d2;
+      return weight > 0 ? (float)std::sqrt(std::max(0.0, e) / weight) : 0.0f;
+    }
+  };
+
+  struct Collapse {
+    float cost;
+    float length;       // squared, shorter edges first among equal costs (e.g. in flat regions)
+    uint32_t from, to;
+    uint32_t stampFrom, stampTo;
+
+    bool operator<(const Collapse &other) const {
+      // std::priority_queue pops the largest
+      return cost != other.cost ? cost > other.cost : length > other.length;
+    }
+  };
+
+  // Boundary planes are weighted like this many triangles with the edge length as side.
+  enum { BOUNDARY_WEIGHT = 10 };
+  static const uint32_t DEAD = 0xffffffff;
+
+  const Vertex *vertices;
+  const uint32_t *indices;
+  size_t triangleCount;
+  size_t liveTriangles;
+  float error;
+
+  std::vector<uint32_t> welded;               // vertex -> first vertex with the same position
+  std::vector<uint32_t> memberStart;          // vertices sharing a welded position, by welded vertex
+  std::vector<uint32_t> members;
+  std::vector<uint32_t> corners;              // welded corners of the triangles, updated by collapses
+  std::vector<bool> alive;
+  std::vector<std::vector<uint32_t> > vertexTriangles;
+  std::vector<Quadric> quadrics;
+  std::vector<uint32_t> stamps;               // changed with the quadric or position of a vertex, DEAD once collapsed
+  std::priority_queue<Collapse> heap;
+
+  const glm::vec3& position(uint32_t v) const {
+    return vertices[v].Position;
+  }
+
+  void weld(size_t vertexCount) {
+    struct Hash {
+      size_t operator()(const glm::vec3 &p) const {
+        const glm::vec3 q = p + glm::vec3(0.0f);   // -0 to +0, they compare equal
+        uint32_t h[3];
+        std::memcpy(h, &q, sizeof(h));
+        return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+      }
+    };
+    std::unordered_map<glm::vec3, uint32_t, Hash> first;
+    first.reserve(vertexCount);
+    welded.resize(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+      welded[v] = first.insert(std::make_pair(position(v), v)).first->second;
+    }
+
+    memberStart.assign(vertexCount + 1, 0);
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+      ++memberStart[welded[v] + 1];
+    }
+    for (size_t v = 0; v < vertexCount; ++v) {
+      memberStart[v + 1] += memberStart[v];
+    }
+    members.resize(vertexCount);
+    std::vector<uint32_t> fill(memberStart.begin(), memberStart.end() - 1);
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+      members[fill[welded[v]]++] = v;
+    }
+  }
+
+  uint32_t closestMember(uint32_t v, const glm::vec3 &normal) const {
+    uint32_t best = v;
+    float bestDot = -2;
+    for (uint32_t i = memberStart[v]; i < memberStart[v + 1]; ++i) {
+      const float d = glm::dot(vertices[members[i]].Normal, normal);
+      if (d > bestDot) {
+        bestDot = d;
+        best = members[i];
+      }
+    }
+    return best;
+  }
+
+  void initialize(size_t vertexCount) {
+    corners.resize(triangleCount * 3);
+    alive.assign(triangleCount, false);
+    vertexTriangles.resize(vertexCount);
+    quadrics.assign(vertexCount, Quadric());
+    stamps.assign(vertexCount, 0);
+
+    std::unordered_map<uint64_t, uint32_t> edgeUse;
+    edgeUse.reserve(triangleCount * 3);
+    for (size_t t = 0; t < triangleCount; ++t) {
+      for (size_t k = 0; k < 3; ++k) {
+        if (indices[t * 3 + k] >= vertexCount) {
+          throw XglException("Mesh index out of range.");
+        }
+        corners[t * 3 + k] = welded[indices[t * 3 + k]];
+      }
+      const uint32_t *c = &corners[t * 3];
+      if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0]) {
+        continue;     // degenerate, dropped from all levels
+      }
+
+      const glm::dvec3 p0(position(c[0])), p1(position(c[1])), p2(position(c[2]));
+      const glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+      const double area = glm::length(n) * 0.5;
+      if (area > 0) {
+        const glm::dvec3 unit = n / (2 * area);
+        for (size_t k = 0; k < 3; ++k) {
+          quadrics[c[k]].addPlane(unit, -glm::dot(unit, p0), area);
+        }
+      }
+
+      alive[t] = true;
+      ++liveTriangles;
+      for (size_t k = 0; k < 3; ++k) {
+        vertexTriangles[c[k]].push_back((uint32_t)t);
+        ++edgeUse[edgeKey(c[k], c[(k + 1) % 3])];
+      }
+    }
+
+    // planes through boundary edges, perpendicular to their triangle
+    for (size_t t = 0; t < triangleCount; ++t) {
+      if (!alive[t]) {
+        continue;
+      }
+      const uint32_t *c = &corners[t * 3];
+      const glm::dvec3 p0(position(c[0])), p1(position(c[1])), p2(position(c[2]));
+      const glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+      for (size_t k = 0; k < 3; ++k) {
+        const uint32_t a = c[k], b = c[(k + 1) % 3];
+        if (edgeUse[edgeKey(a, b)] != 1) {
+          continue;
+        }
+        const glm::dvec3 pa(position(a)), pb(position(b));
+        const glm::dvec3 perpendicular = glm::cross(pb - pa, n);
+        const double length = glm::length(perpendicular);
+        if (length > 0) {
+          const glm::dvec3 unit = perpendicular / length;
+          const double edgeLengthSquared = glm::dot(pb - pa, pb - pa);
+          quadrics[a].addPlane(unit, -glm::dot(unit, pa), edgeLengthSquared * BOUNDARY_WEIGHT);
+          quadrics[b].addPlane(unit, -glm::dot(unit, pa), edgeLengthSquared * BOUNDARY_WEIGHT);
+        }
+      }
+    }
+
+    for (const auto &e : edgeUse) {
+      pushEdge((uint32_t)(e.first >> 32), (uint32_t)e.first);
+    }
+  }
+
+  static uint64_t edgeKey(uint32_t a, uint32_t b) {
+    return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+  }
+
+  // Queues the collapses of an edge in both directions.
+  void pushEdge(uint32_t a, uint32_t b) {
+    Quadric q = quadrics[a];
+    q.add(quadrics[b]);
+    const glm::vec3 d = position(b) - position(a);
+    const float length = glm::dot(d, d);
+    heap.push(Collapse { q.distance(position(b)), length, a, b, stamps[a], stamps[b] });
+    heap.push(Collapse { q.distance(position(a)), length, b, a, stamps[b], stamps[a] });
+  }
+
+  void getNeighbors(uint32_t v, std::vector<uint32_t> &output) const {
+    output.clear();
+    for (uint32_t t : vertexTriangles[v]) {
+      if (alive[t]) {
+        for (size_t k = 0; k < 3; ++k) {
+          if (corners[t * 3 + k] != v) {
+            output.push_back(corners[t * 3 + k]);
+          }
+        }
+      }
+    }
+    std::sort(output.begin(), output.end());
+    output.erase(std::unique(output.begin(), output.end()), output.end());
+  }
+
+  bool canCollapse(uint32_t from, uint32_t to) {
+    // link condition: the only common neighbors are the opposite corners of the shared triangles
+    size_t sharedTriangles = 0;
+    for (uint32_t t : vertexTriangles[from]) {
+      if (alive[t] && (corners[t * 3] == to || corners[t * 3 + 1] == to || corners[t * 3 + 2] == to)) {
+        ++sharedTriangles;
+      }
+    }
+    if (sharedTriangles == 0) {
+      return false;
+    }
+    getNeighbors(from, neighborsFrom);
+    getNeighbors(to, neighborsTo);
+    std::vector<uint32_t> common;
+    std::set_intersection(neighborsFrom.begin(), neighborsFrom.end(), neighborsTo.begin(), neighborsTo.end(), std::back_inserter(common));
+    if (common.size() > sharedTriangles) {
+      return false;
+    }
+
+    // the remaining triangles must neither flip nor degenerate
+    const glm::vec3 &target = position(to);
+    for (uint32_t t : vertexTriangles[from]) {
+      const uint32_t *c = &corners[t * 3];
+      if (!alive[t] || c[0] == to || c[1] == to || c[2] == to) {
+        continue;
+      }
+      glm::vec3 p[3] = { position(c[0]), position(c[1]), position(c[2]) };
+      const glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+      for (size_t k = 0; k < 3; ++k) {
+        if (c[k] == from) {
+          p[k] = target;
+        }
+      }
+      const glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+      if (glm::dot(before, after) <= 0.2f * glm::length(before) * glm::length(after) || glm::dot(after, after) <= 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void collapse(uint32_t from, uint32_t to) {
+    std::vector<uint32_t> &toTriangles = vertexTriangles[to];
+    for (uint32_t t : vertexTriangles[from]) {
+      if (!alive[t]) {
+        continue;
+      }
+      uint32_t *c = &corners[t * 3];
+      if (c[0] == to || c[1] == to || c[2] == to) {
+        alive[t] = false;
+        --liveTriangles;
+      } else {
+        for (size_t k = 0; k < 3; ++k) {
+          if (c[k] == from) {
+            c[k] = to;
+          }
+        }
+        toTriangles.push_back(t);
+      }
+    }
+    std::vector<uint32_t>().swap(vertexTriangles[from]);
+    toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(), [this](uint32_t t) { return !alive[t]; }), toTriangles.end());
+
+    quadrics[to].add(quadrics[from]);
+    stamps[from] = DEAD;
+    ++stamps[to];
+
+    getNeighbors(to, neighborsTo);
+    for (uint32_t n : neighborsTo) {
+      pushEdge(to, n);
+    }
+  }
+
+  std::vector<uint32_t> neighborsFrom, neighborsTo;     // scratch
+};
+
+
+// Builds up to levelCount simplified index buffers, each with about a quarter of the triangles of
+// the previous one. Levels are appended to lodIndices, ordered for the vertex cache; generation
+// stops early when the mesh cannot be reduced much further.
+inline void buildLods(const Vertex *vertices, size_t vertexCount, const uint32_t *indices, size_t indexCount, uint32_t levelCount, std::vector<uint32_t> &lodIndices, std::vector<LodLevel> &lods) {
+  if (levelCount == 0 || indexCount < 3) {
+    return;
+  }
+
+  MeshSimplifier simplifier(vertices, vertexCount, indices, indexCount);
+  size_t previousCount = simplifier.getIndexCount();
+  for (uint32_t level = 1; level <= levelCount; ++level) {
+    const size_t target = (indexCount / 3 >> (2 * level)) * 3;
+    simplifier.simplify(target);
+    const size_t count = simplifier.getIndexCount();
+    if (count == 0 || count > previousCount * 3 / 4) {
+      break;
+    }
+
+    LodLevel lod;
+    lod.indexOffset = (uint32_t)lodIndices.size();
+    lod.indexCount = (uint32_t)count;
+    lod.error = simplifier.getError();
+    simplifier.getIndices(lodIndices);
+    optimizeVertexCache(&lodIndices[lod.indexOffset], count, vertexCount);
+    lods.push_back(lod);
+    previousCount = count;
+  }
+}
@@ -1,136 +1,286 @@
 #pragma once
 
-#include <SOIL/SOIL.h>
+#include <unordered_map>
+
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <glm/gtx/transform.hpp>
 
 #include "mesh.h"
+#include "mesh_cache.h"
 #include "material.h"
 #include "light.h"
 
 
-GLint loadTextureFromFile(const std::string &path, bool flipV = false);
-template<typename T> void flipVInplace(T *image, int width, int height, int channels);
-template<typename ... Args> std::string string_format(const std::string& format, Args ... args);
+// CPU side result of importing a model file: meshes (fresh from ASSIMP or mapped from the mesh
+// cache) and the decoded material textures. Produced without GL calls, so imports can run on
+// worker threads, see AsyncLoader.
+struct ModelImport {
+  std::string directory;
+  std::unique_ptr<MeshCacheFile> cacheFile;
+  std::vector<ImportedMesh> meshes;
+  std::unordered_map<std::string, DecodedImage> images;   // by path relative to directory, not yet in the texture cache
+
+  const std::vector<ImportedMesh>& getMeshes() const {
+    return cacheFile ? cacheFile->getMeshes() : meshes;
+  }
+};
+
+
+// Bounds of a mesh in world coordinates.
+struct WorldBounds {
+  BoundingBox box;
+  BoundingSphere sphere;
+};
 
 
 class Model {
 public:
   Model(const std::shared_ptr<Shader> &defaultShader)
     : defaultShader(defaultShader)
-    , pose(1.0f) {
+    , pose(1.0f)
+    , id(nextId())
+    , frustumCulling(true)
+    , clipSpace(false)
+    , lifetime(std::make_shared<int>(0)) {
   }
+
+  virtual ~Model() {}
   
   // Draws the model, and thus all its meshes
   void draw(const glm::mat4 &view, const glm::mat4 &projection, const Light& light, Material *overrideMaterial = nullptr) {
     for (size_t i = 0; i < meshes.size(); ++i) {
-      prepareShader(overrideMaterial != nullptr ? *overrideMaterial : *meshes[i]->getMaterial(), view, projection, light);
-      meshes[i]->draw(overrideMaterial);
+      drawMesh(i, view, projection, light, overrideMaterial);
     }
   }
-  
+
+  // Draws a single mesh, used by the render queue to interleave meshes of different models.
+  virtual void drawMesh(size_t index, const glm::mat4 &view, const glm::mat4 &projection, const Light& light, Material *overrideMaterial = nullptr, size_t lod = 0) {
+    Mesh *mesh = meshes[index].get();
+    prepareShader(overrideMaterial != nullptr ? *overrideMaterial : *mesh->getMaterial(), index, view, projection, light);
+    mesh->draw(overrideMaterial, lod);
+  }
+
+  // Shader that is used to draw the given material.
+  Shader *getEffectiveShader(const Material &material) const {
+    const std::shared_ptr<Shader> &shader = material.getShader();
+    return shader ? shader.get() : defaultShader.get();
+  }
+
   const glm::mat4& getPose() const { return pose; }
-  void setPose(const glm::mat4& value) { pose = value; }
+  void setPose(const glm::mat4& value) { pose = value; invalidateBounds(); touchScene(); }
+
+  // False if drawMesh ignores the level of detail.
+  virtual bool supportsLods() const { return true; }
+
+  // World transforms the meshes are drawn with, one per instance.
+  virtual void getInstancePoses(std::vector<glm::mat4> &output) const {
+    output.assign(1, pose);
+  }
+
+  bool getFrustumCulling() const { return frustumCulling; }
+  void setFrustumCulling(bool value) { frustumCulling = value; touchScene(); }
+
+  // Models drawn in clip space by shaders that ignore the pose and the camera (e.g. full-screen
+  // overlays) have no meaningful world bounds and are never culled.
+  bool getClipSpace() const { return clipSpace; }
+  void setClipSpace(bool value) { clipSpace = value; touchScene(); }
+
+  // Bounds of a mesh in world coordinates, cached until the pose or the mesh vertices change.
+  const WorldBounds& getWorldBounds(size_t index) {
+    if (worldBounds.size() < meshes.size()) {
+      worldBounds.resize(meshes.size());
+    }
+    CachedBounds &cached = worldBounds[index];
+    const Mesh &mesh = *meshes[index];
+    if (!cached.valid || cached.meshRevision != mesh.getBufferRevision()) {
+      cached.bounds = computeWorldBounds(mesh);
+      cached.meshRevision = mesh.getBufferRevision();
+      cached.valid = true;
+    }
+    return cached.bounds;
+  }
+
+  // Written with the mesh index to the id target of G-buffer renders, unique by default (0 is
+  // the background).
+  uint32_t getId() const { return id; }
+  void setId(uint32_t value) { id = value; }
     
   // Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+  // Imports are kept in the mesh cache, later loads of an unchanged file skip ASSIMP.
   void loadModel(const std::string &path) {
-    // Read file via ASSIMP
-    Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
-
-    // Check for errors
-    if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-      throw XglException(std::string("ERROR::ASSIMP:: ") + importer.GetErrorString());
+    std::unique_ptr<ModelImport> imported = importModel(path, importOptimizeOptions(), importLodOptions());
+    for (size_t i = 0; i < imported->getMeshes().size(); ++i) {
+      addImportedMesh(*imported, i);
     }
+  }
+
+  // Reads a model file, welds and reorders the meshes (see importOptimizeOptions), simplifies
+  // large meshes (see importLodOptions) and decodes the textures, does not use GL.
+  static std::unique_ptr<ModelImport> importModel(const std::string &path, const OptimizeOptions &optimizeOptions, const LodOptions &lodOptions) {
+    const uint32_t importFlags = aiProcess_Triangulate | aiProcess_FlipUVs;
 
+    std::unique_ptr<ModelImport> result(new ModelImport());
     // Retrieve the directory path of the filepath
-    this->directory = path.substr(0, path.find_last_of('/'));
+    result->directory = path.substr(0, path.find_last_of('/'));
+
+    result->cacheFile = meshCache().load(path, importFlags, optimizeOptions, lodOptions);
+    if (!result->cacheFile) {
+      // Read file via ASSIMP
+      Assimp::Importer importer;
+      const aiScene *scene = importer.ReadFile(path, importFlags);
+
+      // Check for errors
+      if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        throw XglException(std::string("ERROR::ASSIMP:: ") + importer.GetErrorString());
+      }
+
+      processNode(scene->mRootNode, scene, result->meshes);
+      for (ImportedMesh &mesh : result->meshes) {
+        if (optimizeOptions.enabled) {
+          importOptimizeCounters().add(optimizeMesh(mesh.vertexStorage, mesh.indexStorage, optimizeOptions.weldTolerance, optimizeOptions.weldNormalAngle));
+          mesh.attachStorage();
+        }
+        if (mesh.indexCount / 3 >= lodOptions.minTriangles) {
+          buildLods(mesh.vertices, mesh.vertexCount, mesh.indices, mesh.indexCount, lodOptions.levelCount, mesh.lodIndexStorage, mesh.lodStorage);
+          mesh.attachStorage();
+        }
+      }
+      meshCache().store(path, importFlags, optimizeOptions, lodOptions, result->meshes);
+    }
 
-    this->processNode(scene->mRootNode, scene);
+    for (const ImportedMesh &mesh : result->getMeshes()) {
+      for (const TextureRef &ref : mesh.textures) {
+        const std::string path = result->directory + "/" + ref.path;
+        if (result->images.count(ref.path) == 0 && !textureCache().contains(TextureCache::makeKey(path, false))) {
+          decodeImageFile(path, false, result->images[ref.path]);
+        }
+      }
+    }
+    return result;
+  }
+
+  // Creates the GL objects of one imported mesh and adds it to the model.
+  void addImportedMesh(const ModelImport &imported, size_t index) {
+    this->directory = imported.directory;
+    addMesh(createMesh(imported, imported.getMeshes()[index]));
+  }
+
+  // Expires when the model is deleted, lets deferred work (e.g. async loads) detect that.
+  std::weak_ptr<void> getLifetimeToken() const {
+    return lifetime;
   }
   
   void addMesh(const std::shared_ptr<Mesh>& mesh) {
     meshes.push_back(mesh);
+    touchScene();
   }
   
   size_t getMeshCount() const {
     return meshes.size();
   }
   
+  // Replaces the levels of detail of all meshes, see Mesh::generateLods.
+  void generateLods(uint32_t levelCount) {
+    for (const std::shared_ptr<Mesh> &mesh : meshes) {
+      mesh->generateLods(levelCount);
+    }
+  }
+
   std::shared_ptr<Mesh> getMeshAt(size_t index) {
     if (index > meshes.size())
       throw XglException("Index out of range.");
     return meshes[index];
   }
   
-private:
-  glm::mat4 pose;
-  std::vector<std::shared_ptr<Mesh> > meshes;
-  std::string directory;
-  std::vector<Texture> texturesLoaded;   // Stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
-  std::shared_ptr<Shader> defaultShader;
+protected:
+  virtual WorldBounds computeWorldBounds(const Mesh &mesh) const {
+    WorldBounds bounds;
+    bounds.box = mesh.getBounds().transform(pose);
+    bounds.sphere = mesh.getBoundingSphere().transform(pose);
+    return bounds;
+  }
+
+  void invalidateBounds() {
+    for (CachedBounds &b : worldBounds) {
+      b.valid = false;
+    }
+  }
 
-  void prepareShader(const Material &material, const glm::mat4 &view, const glm::mat4 &projection, const Light& light) {
+  void prepareShader(const Material &material, size_t meshIndex, const glm::mat4 &view, const glm::mat4 &projection, const Light& light) {
     std::shared_ptr<Shader> shader = material.getShader();
     if (!shader) {
       shader = defaultShader;
     }
 
     shader->use();
-    GLuint program = shader->getProgram();
-    
-    GLint modelLoc       = glGetUniformLocation(program, "model");
-    GLint viewLoc        = glGetUniformLocation(program, "view");
-    GLint projectionLoc  = glGetUniformLocation(program, "projection");
-
-    GLint lightColorLoc  = glGetUniformLocation(program, "lightColor");
-    GLint lightPosLoc    = glGetUniformLocation(program, "lightPos");
-    GLint viewPosLoc     = glGetUniformLocation(program, "viewPos");
+    const StandardUniforms &uniforms = shader->getStandardUniforms();
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(pose));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    uniforms.model.set(pose);
+    uniforms.view.set(view);
+    uniforms.projection.set(projection);
+    uniforms.objectId.set(glm::uvec2(id, (uint32_t)meshIndex + 1));
 
     // point light is currently the only supported light type
     if (light.getType() == LightType::Point) {
       const PointLight& pl = static_cast<const PointLight&>(light);
 
-      glUniform3fv(lightPosLoc, 1, glm::value_ptr(pl.getPosition()));
-      glUniform3fv(lightColorLoc, 1, glm::value_ptr(pl.getColor()));
+      uniforms.lightPos.set(pl.getPosition());
+      uniforms.lightColor.set(glm::vec3(pl.getColor()));
 
-      if (viewPosLoc >= 0) {
+      if (uniforms.viewPos.valid()) {
         auto pos = glm::vec3(glm::inverse(view)[3]);
-        glUniform3fv(viewPosLoc, 1, glm::value_ptr(pos));
+        uniforms.viewPos.set(pos);
       }
     }
   }
 
+private:
+  glm::mat4 pose;
+  std::vector<std::shared_ptr<Mesh> > meshes;
+  std::string directory;
+  std::shared_ptr<Shader> defaultShader;
+  uint32_t id;
+  bool frustumCulling;
+  bool clipSpace;
+  std::shared_ptr<int> lifetime;
+
+  struct CachedBounds {
+    WorldBounds bounds;
+    uint64_t meshRevision = 0;
+    bool valid = false;
+  };
+  std::vector<CachedBounds> worldBounds;    // by mesh index
+
+  static uint32_t nextId() {
+    static uint32_t counter = 0;
+    return ++counter;
+  }
+
   // Processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-  void processNode(aiNode *node, const aiScene *scene) {
+  static void processNode(aiNode *node, const aiScene *scene, std::vector<ImportedMesh> &imported) {
     // Process each mesh located at the current node
     //printf("nummeshes: %d\n", node->mNumMeshes);
     for (int i = 0; i < node->mNumMeshes; ++i) {
       // The node object only contains indices to index the actual objects in the scene.
       // The scene contains all the data, node is just to keep stuff organized (like relations between nodes).
       aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-      this->meshes.push_back(std::shared_ptr<Mesh>(this->processMesh(mesh, scene)));
+      imported.push_back(ImportedMesh());
+      processMesh(mesh, scene, imported.back());
     }
 
     // After we've processed all of the meshes (if any) we then recursively process each of the children nodes
     for (int i = 0; i < node->mNumChildren; ++i) {
-      this->processNode(node->mChildren[i], scene);
+      processNode(node->mChildren[i], scene, imported);
     }
   }
 
-  Mesh *processMesh(aiMesh *mesh, const aiScene *scene) {
+  static void processMesh(aiMesh *mesh, const aiScene *scene, ImportedMesh &output) {
     // Data to fill
-    std::vector<Vertex> vertices;
-    std::vector<GLuint> indices;
-    
-    auto material = std::make_shared<Material>();
-    material->setShader(defaultShader);
+    std::vector<Vertex> &vertices = output.vertexStorage;
+    std::vector<GLuint> &indices = output.indexStorage;
+    vertices.reserve(mesh->mNumVertices);
 
     // Walk through each of the mesh's vertices
     //printf("numvertices: %d, numfaces: %d, materialIndices: %d\n", mesh->mNumVertices, mesh->mNumFaces, mesh->mMaterialIndex);
@@ -149,10 +299,14 @@ private:
       vertex.Position = vector;
 
       // Normals
-      vector.x = mesh->mNormals[i].x;
-      vector.y = mesh->mNormals[i].y;
-      vector.z = mesh->mNormals[i].z;
-      vertex.Normal = vector;
+      if (mesh->mNormals) {
+        vector.x = mesh->mNormals[i].x;
+        vector.y = mesh->mNormals[i].y;
+        vector.z = mesh->mNormals[i].z;
+        vertex.Normal = vector;
+      } else {
+        vertex.Normal = glm::vec3(0.0f, 0.0f, 0.0f);
+      }
 
       // Texture Coordinates
       if (mesh->mTextureCoords[0]) { // Does the mesh contain texture coordinates
@@ -167,6 +321,7 @@ private:
         vertex.TexCoords = glm::vec2(0.0f, 0.0f);
       }
 
+      vertex.Color = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
       vertices.push_back(vertex);
     }
 
@@ -191,85 +346,48 @@ private:
       // Normal: texture_normalN
 
       // 1. Diffuse maps
-      std::vector<Texture> diffuseMaps = loadMaterialTextures(m, aiTextureType_DIFFUSE, "texture_diffuse");
-      material->addTextures(diffuseMaps.begin(), diffuseMaps.end());
+      getMaterialTextures(m, aiTextureType_DIFFUSE, TextureType::Diffuse, output.textures);
 
       // 2. Specular maps
-      std::vector<Texture> specularMaps = loadMaterialTextures(m, aiTextureType_SPECULAR, "texture_specular");
-      material->addTextures(specularMaps.begin(), specularMaps.end());
+      getMaterialTextures(m, aiTextureType_SPECULAR, TextureType::Specular, output.textures);
     }
 
-    // Return a mesh object created from the extracted mesh data
-    return new Mesh(vertices, indices, material);
+    output.attachStorage();
   }
 
-  // Checks all material textures of a given type and loads the textures if they're not loaded yet.
-  // The required info is returned as a Texture struct.
-  std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, const std::string &typeName)
-  {
-    std::vector<Texture> textures;
+  static void getMaterialTextures(aiMaterial *mat, aiTextureType type, TextureType typeName, std::vector<TextureRef> &output) {
     for (GLuint i = 0; i < mat->GetTextureCount(type); ++i) {
       aiString str;
       mat->GetTexture(type, i, &str);
-
-      // Check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-      bool skip = false;
-      for (GLuint j = 0; j < texturesLoaded.size(); ++j) {
-        if (texturesLoaded[j].path == str) {
-          textures.push_back(texturesLoaded[j]);
-          skip = true; // A texture with the same filepath has already been loaded, continue to next one. (optimization)
-          break;
-        }
-      }
-
-      if (!skip) {   // If texture hasn't been loaded already, load it
-        Texture texture;
-        std::string path = this->directory + std::string("/") + std::string(str.C_Str());
-        texture.id = loadTextureFromFile(path, false);
-        texture.type = typeName;
-        texture.path = str;
-        textures.push_back(texture);
-        this->texturesLoaded.push_back(texture);  // Store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-      }
+      TextureRef ref = { typeName, std::string(str.C_Str()) };
+      output.push_back(ref);
     }
-
-    return textures;
   }
-};
 
+  // Creates a mesh object from imported (or cached) mesh data, vertices are packed into the GPU
+  // buffer directly from the source.
+  std::shared_ptr<Mesh> createMesh(const ModelImport &imported, const ImportedMesh &mesh) {
+    auto material = std::make_shared<Material>();
+    material->setShader(defaultShader);
+    for (const TextureRef &ref : mesh.textures) {
+      material->addTexture(loadMaterialTexture(imported, ref));
+    }
 
-inline GLint loadTextureFromFile(const std::string &path, bool flipV) {
-   //Generate texture ID and load texture data
-  GLuint textureID;
-  glGenTextures(1, &textureID);
-
-  int width = 0, height = 0;
-  //SOIL_load_OGL_texture(path.c_str(), 3, textureID)
-  unsigned char *image = SOIL_load_image(path.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
-  if (image == nullptr) {
-    throw XglException(string_format("Texture loading faild (%s), error: %s!\n", path.c_str(), SOIL_last_result()));
-  }
-  
-  printf("loaded texture size: %dx%d\n", width, height);
-  
-  if (flipV) {
-    flipVInplace(image, width, height, 3);
+    VertexSource vertices(reinterpret_cast<const float *>(mesh.vertices), mesh.vertexCount, 12, 12);
+    auto result = std::make_shared<Mesh>(vertices, mesh.indices, mesh.indexCount, material);
+    result->setLods(mesh.lods, mesh.lodCount, mesh.lodIndices, mesh.lodIndexCount);
+    return result;
   }
 
-  // Assign texture to ID
-  glBindTexture(GL_TEXTURE_2D, textureID);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-
-  SOIL_free_image_data(image);
-
-  glGenerateMipmap(GL_TEXTURE_2D);
-
-  // Parameters
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glBindTexture(GL_TEXTURE_2D, 0);
-
-  return textureID;
-}
+  // Takes material textures from the texture cache, images decoded during the import are
+  // uploaded if the texture is not cached (anymore).
+  static Texture loadMaterialTexture(const ModelImport &imported, const TextureRef &ref) {
+    auto image = imported.images.find(ref.path);
+    Texture texture;
+    texture.object = textureCache().acquire(imported.directory + "/" + ref.path, false, image != imported.images.end() ? &image->second : nullptr);
+    texture.id = texture.object->getId();
+    texture.type = ref.type;
+    texture.path = ref.path;
+    return texture;
+  }
+};
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "gl_state.h"
+#include "render_queue.h"
+#include "shader.h"
+
+
+// Hardware occlusion culling of the opaque draws of a render queue, driven by the visibility of
+// the previous frame. Draws that were visible are rendered first and act as occluders. Draws that
+// were hidden follow, each one behind a GL_ANY_SAMPLES_PASSED query of its world bounds box and
+// drawn with conditional rendering on that query, so the GPU skips it if the box stays hidden and
+// the image is the same as without culling. Afterwards the boxes of the visible draws are queried
+// against the complete depth buffer to detect draws that became hidden. Results are only read
+// once GL reports them available, the CPU never waits for the GPU; draws with pending queries
+// keep their last visibility.
+class OcclusionCuller {
+public:
+  OcclusionCuller()
+    : frame(0)
+    , VAO(0), VBO(0), EBO(0)
+    , deferredCount(0)
+    , queryCount(0) {
+  }
+
+  ~OcclusionCuller() {
+    for (auto &e : entries) {
+      glDeleteQueries(1, &e.second.query);
+    }
+    if (VAO != 0) {
+      glState().forgetVertexArray(VAO);
+      glDeleteVertexArrays(1, &VAO);
+      glDeleteBuffers(1, &VBO);
+      glDeleteBuffers(1, &EBO);
+    }
+  }
+
+  OcclusionCuller & operator =(const OcclusionCuller &) = delete;
+  OcclusionCuller(const OcclusionCuller &) = delete;
+
+  // Collects the query results that arrived and returns which items of the queue are deferred
+  // (opaque and hidden in their last test). Clip-space draws, draws of models without frustum
+  // culling (their bounds may not match what they draw), draws without depth test and boxes
+  // reaching into the near plane (they would be clipped) are never tested.
+  const std::vector<bool>& begin(const RenderQueue &queue, const glm::mat4 &view, const glm::mat4 &projection) {
+    ++frame;
+    viewProjection = projection * view;
+    deferredCount = 0;
+    queryCount = 0;
+
+    const glm::mat4 inverseProjection = glm::inverse(projection);
+    float nearRadius = 0;
+    for (int i = 0; i < 4; ++i) {
+      const glm::vec4 corner = inverseProjection * glm::vec4(i & 1 ? 1 : -1, i & 2 ? 1 : -1, -1, 1);
+      nearRadius = std::max(nearRadius, glm::length(glm::vec3(corner) / corner.w));
+    }
+    const glm::vec3 eye = glm::vec3(glm::inverse(view)[3]);
+
+    const std::vector<DrawItem> &items = queue.getItems();
+    deferred.assign(items.size(), false);
+    tested.assign(items.size(), nullptr);
+    for (size_t i = 0; i < queue.getOpaqueCount(); ++i) {
+      const DrawItem &item = items[i];
+      if (item.model->getClipSpace() || !item.model->getFrustumCulling() || !item.material->getDepthTest()) {
+        continue;
+      }
+      const BoundingBox &box = item.model->getWorldBounds(item.meshIndex).box;
+      if (box.isEmpty() || reaches(box, eye, nearRadius)) {
+        continue;
+      }
+
+      Entry &entry = entries[std::make_pair(item.model, item.meshIndex)];
+      if (entry.query == 0) {
+        glGenQueries(1, &entry.query);
+      }
+      entry.frame = frame;
+      if (entry.pending) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(entry.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+          GLuint anySamples = 0;
+          glGetQueryObjectuiv(entry.query, GL_QUERY_RESULT, &anySamples);
+          entry.visible = anySamples != 0;
+          entry.pending = false;
+        }
+      }
+
+      tested[i] = &entry;
+      if (!entry.visible) {
+        deferred[i] = true;
+        ++deferredCount;
+      }
+    }
+
+    // draws that left the queue start visible again when they return
+    for (auto e = entries.begin(); e != entries.end();) {
+      if (e->second.frame != frame) {
+        glDeleteQueries(1, &e->second.query);
+        e = entries.erase(e);
+      } else {
+        ++e;
+      }
+    }
+
+    return deferred;
+  }
+
+  // Tests and conditionally draws the deferred items, draw(index) renders one item of the queue.
+  // A new query replaces a pending one, its result would be outdated anyway.
+  template<typename DrawFn>
+  void drawDeferred(const RenderQueue &queue, DrawFn draw) {
+    const std::vector<DrawItem> &items = queue.getItems();
+    for (size_t i = 0; i < deferred.size(); ++i) {
+      if (!deferred[i]) {
+        continue;
+      }
+      beginBoxes();
+      queryBox(*tested[i], items[i]);
+      endBoxes();
+
+      glBeginConditionalRender(tested[i]->query, GL_QUERY_WAIT);
+      draw(i);
+      glEndConditionalRender();
+    }
+  }
+
+  // Tests the boxes of the items drawn unconditionally, call after all opaque items are drawn.
+  void queryVisible(const RenderQueue &queue) {
+    const std::vector<DrawItem> &items = queue.getItems();
+    bool active = false;
+    for (size_t i = 0; i < tested.size(); ++i) {
+      if (tested[i] == nullptr || deferred[i] || tested[i]->pending) {
+        continue;
+      }
+      if (!active) {
+        beginBoxes();
+        active = true;
+      }
+      queryBox(*tested[i], items[i]);
+    }
+    if (active) {
+      endBoxes();
+    }
+  }
+
+  // Items of the last frame that were drawn conditionally.
+  size_t getDeferredCount() const { return deferredCount; }
+
+  // Queries issued in the last frame.
+  size_t getQueryCount() const { return queryCount; }
+
+private:
+  struct Entry {
+    GLuint query = 0;
+    bool pending = false;
+    bool visible = true;
+    uint64_t frame = 0;
+  };
+
+  std::map<std::pair<const Model*, size_t>, Entry> entries;
+  std::vector<bool> deferred;
+  std::vector<Entry*> tested;     // per queue item, null if it is not tested
+  uint64_t frame;
+  glm::mat4 viewProjection;
+
+  std::unique_ptr<Shader> shader;
+  Uniform transform;
+  GLuint VAO, VBO, EBO;           // unit cube centered at the origin
+
+  size_t deferredCount;
+  size_t queryCount;
+
+  // True if point is within distance of the box on every axis.
+  static bool reaches(const BoundingBox &box, const glm::vec3 &point, float distance) {
+    for (int k = 0; k < 3; ++k) {
+      if (point[k] < box.min[k] - distance || point[k] > box.max[k] + distance) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void beginBoxes() {
+    if (!shader) {
+      create();
+    }
+
+    GLStateCache &state = glState();
+    state.setDepthTest(true);
+    state.setDepthMask(false);
+    state.setBlending(false);
+    state.setFacetCulling(false);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    shader->use();
+    state.bindVertexArray(VAO);
+  }
+
+  void endBoxes() {
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  }
+
+  void queryBox(Entry &entry, const DrawItem &item) {
+    const BoundingBox &box = item.model->getWorldBounds(item.meshIndex).box;
+    // grown a little, faces that coincide with the mesh surface must not fail the depth test
+    const glm::vec3 size = box.max - box.min;
+    const glm::vec3 grown = size + glm::vec3(glm::length(size) * 0.01f + 1e-6f);
+    transform.set(viewProjection * glm::scale(glm::translate(glm::mat4(1.0f), box.getCenter()), grown));
+
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, entry.query);
+    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+    entry.pending = true;
+    ++queryCount;
+  }
+
+  void create() {
+    static const char *VERTEX_SHADER = R"(#version 330 core
+layout (location = 0) in vec3 position;
+uniform mat4 transform;
+void main() {
+  gl_Position = transform * vec4(position, 1.0);
+}
+)";
+
+    static const char *FRAGMENT_SHADER = R"(#version 330 core
+out vec4 color;
+void main() {
+  color = vec4(1.0);
+}
+)";
+
+    std::unique_ptr<Shader> s(new Shader());
+    s->create(VERTEX_SHADER, FRAGMENT_SHADER);
+    transform = s->getUniform("transform");
+    shader.swap(s);
+
+    static const GLfloat vertices[] = {
+      -0.5f, -0.5f, -0.5f,   0.5f, -0.5f, -0.5f,   -0.5f, 0.5f, -0.5f,   0.5f, 0.5f, -0.5f,
+      -0.5f, -0.5f,  0.5f,   0.5f, -0.5f,  0.5f,   -0.5f, 0.5f,  0.5f,   0.5f, 0.5f,  0.5f
+    };
+    static const GLubyte indices[] = {
+      0, 2, 1, 1, 2, 3,   4, 5, 6, 5, 7, 6,     // -z, +z
+      0, 1, 4, 1, 5, 4,   2, 6, 3, 3, 6, 7,     // -y, +y
+      0, 4, 2, 2, 4, 6,   1, 3, 5, 3, 7, 5      // -x, +x
+    };
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    glState().bindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+  }
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "camera.h"
+#include "shader.h"
+
+
+// Unprojects the float depth target of a camera on the GPU. A full-screen triangle writes one
+// point per pixel into the camera's RGBA32F point cloud target: xyz and, optionally, the color
+// of the last render() packed into w in the PCL rgba layout (0xAARRGGBB bit pattern). Pixels
+// with NaN depth produce NaN coordinates, like unorganized entries of a PCL cloud.
+class PointCloudPass {
+public:
+  PointCloudPass()
+    : VAO(0) {
+  }
+
+  PointCloudPass & operator =(const PointCloudPass &) = delete;
+  PointCloudPass(const PointCloudPass &) = delete;
+
+  void render(Camera &camera, PointCloudFrame frame, bool withColor) {
+    if (!shader) {
+      create();
+    }
+
+    const GLuint colorTexture = withColor ? camera.resolveColorTexture() : 0;
+    const GLuint depthTexture = camera.getDepthTextureId();
+
+    const glm::mat4 pose = camera.getPointTransform(frame);
+
+    const glm::vec2 f = camera.getFocalLength();
+    const glm::vec2 c = camera.getPrincipalPoint();
+
+    camera.activatePointCloudTarget();
+
+    GLStateCache &state = glState();
+    state.setDepthTest(false);
+    state.setBlending(false);
+    state.setFacetCulling(false);
+
+    shader->use();
+    intrinsics.set(glm::vec4(f.x, f.y, c.x, c.y));
+    transform.set(pose);
+    colored.set((GLint)withColor);
+    depthImage.set(0);
+    colorImage.set(1);
+    state.bindTexture(0, depthTexture);
+    state.bindTexture(1, colorTexture);
+
+    state.bindVertexArray(VAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+  }
+
+private:
+  std::unique_ptr<Shader> shader;
+  Uniform intrinsics;
+  Uniform transform;
+  Uniform colored;
+  Uniform depthImage;
+  Uniform colorImage;
+  GLuint VAO;     // empty, the vertex shader derives positions from gl_VertexID
+
+  void create() {
+    static const char *VERTEX_SHADER = R"(#version 330 core
+void main() {
+  vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+    static const char *FRAGMENT_SHADER = R"(#version 330 core
+uniform sampler2D depthImage;
+uniform sampler2D colorImage;
+uniform vec4 intrinsics;    // fx, fy, cx, cy
+uniform mat4 transform;     // camera frame to output frame
+uniform bool colored;
+out vec4 point;
+void main() {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  float z = texelFetch(depthImage, pixel, 0).r;
+
+  float rgba = 0.0;
+  if (colored) {
+    uvec3 c = uvec3(round(texelFetch(colorImage, pixel, 0).rgb * 255.0));
+    rgba = uintBitsToFloat(0xff000000u | (c.r << 16) | (c.g << 8) | c.b);
+  }
+
+  if (isnan(z)) {
+    point = vec4(vec3(uintBitsToFloat(0x7fc00000u)), rgba);
+    return;
+  }
+
+  vec3 p = vec3((gl_FragCoord.x - intrinsics.z) * z / intrinsics.x, (intrinsics.w - gl_FragCoord.y) * z / intrinsics.y, z);
+  point = vec4((transform * vec4(p, 1.0)).xyz, rgba);
+}
+)";
+
+    std::unique_ptr<Shader> s(new Shader());
+    s->create(VERTEX_SHADER, FRAGMENT_SHADER);
+    intrinsics = s->getUniform("intrinsics");
+    transform = s->getUniform("transform");
+    colored = s->getUniform("colored");
+    depthImage = s->getUniform("depthImage");
+    colorImage = s->getUniform("colorImage");
+    shader.swap(s);
+
+    glGenVertexArrays(1, &VAO);
+  }
+};
+
+
+inline PointCloudPass& pointCloudPass() {
+  static PointCloudPass pass;
+  return pass;
+}
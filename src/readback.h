@@ -0,0 +1,217 @@
+#pragma once
+
+#include <vector>
+
+
+enum class ReadbackFormat : int {
+  RGB8 = 0,
+  F32 = 1
+};
+
+
+// Ring of pixel pack buffers for asynchronous glReadPixels. A readback copies the current read
+// framebuffer into a PBO and places a fence behind it, the CPU only blocks when the pixels are
+// collected before the GPU has finished. Readbacks are identified by increasing ticket numbers.
+class PixelPackRing {
+public:
+  PixelPackRing(size_t size = 3)
+    : slots(size)
+    , nextTicket(1) {
+  }
+
+  ~PixelPackRing() {
+    for (auto &s : slots) {
+      s.release();
+    }
+  }
+
+  PixelPackRing & operator =(const PixelPackRing &) = delete;
+  PixelPackRing(const PixelPackRing &) = delete;
+
+  size_t getSize() const {
+    return slots.size();
+  }
+
+  void setSize(size_t size) {
+    if (size < 1) {
+      throw XglException("Readback ring needs at least one slot.");
+    }
+    for (size_t i = size; i < slots.size(); ++i) {
+      if (slots[i].ticket != 0) {
+        throw XglException("Cannot shrink readback ring while readbacks are pending.");
+      }
+      slots[i].release();
+    }
+    slots.resize(size);
+  }
+
+  int begin(int width, int height, ReadbackFormat format) {
+    Slot *slot = nullptr;
+    for (auto &s : slots) {
+      if (s.ticket == 0) {
+        slot = &s;
+        break;
+      }
+    }
+    if (slot == nullptr) {
+      throw XglException("All readback slots are pending, collect a readback first.");
+    }
+
+    const size_t rowSize = (size_t)width * getPixelSize(format);
+    const size_t byteSize = rowSize * height;
+
+    if (slot->pbo == 0) {
+      glGenBuffers(1, &slot->pbo);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    if (slot->capacity < byteSize) {
+      glBufferData(GL_PIXEL_PACK_BUFFER, byteSize, nullptr, GL_STREAM_READ);
+      slot->capacity = byteSize;
+    }
+
+    GLint packAlignment = 4;
+    glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    if (format == ReadbackFormat::RGB8) {
+      glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    } else {
+      glReadPixels(0, 0, width, height, GL_RED, GL_FLOAT, nullptr);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();    // make sure the fence gets signaled even if nobody waits on it
+
+    slot->ticket = nextTicket++;
+    slot->width = width;
+    slot->height = height;
+    slot->format = format;
+    return slot->ticket;
+  }
+
+  bool isReady(int ticket) {
+    Slot &slot = find(ticket);
+    return slot.poll(0);
+  }
+
+  bool wait(int ticket, double timeoutSeconds) {
+    Slot &slot = find(ticket);
+    GLuint64 timeout = timeoutSeconds < 0 ? GL_TIMEOUT_IGNORED : (GLuint64)(timeoutSeconds * 1e9);
+    return slot.poll(timeout);
+  }
+
+  ReadbackFormat getFormat(int ticket) {
+    return find(ticket).format;
+  }
+
+  glm::ivec2 getImageSize(int ticket) {
+    const Slot &slot = find(ticket);
+    return glm::ivec2(slot.width, slot.height);
+  }
+
+  // Blocks until the readback has completed, copies the pixels to dst (rows bottom-up like
+  // glReadPixels unless vflip is set) and frees the slot.
+  void collect(int ticket, void *dst, bool vflip) {
+    Slot &slot = find(ticket);
+    slot.poll(GL_TIMEOUT_IGNORED);
+
+    const size_t rowSize = (size_t)slot.width * getPixelSize(slot.format);
+    const size_t byteSize = rowSize * slot.height;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    const uint8_t *src = static_cast<const uint8_t *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, byteSize, GL_MAP_READ_BIT));
+    if (src == nullptr) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      slot.ticket = 0;
+      throw XglException("Mapping pixel pack buffer failed.");
+    }
+
+    uint8_t *out = static_cast<uint8_t *>(dst);
+    if (vflip) {
+      for (int y = 0; y < slot.height; ++y) {
+        memcpy(out + (slot.height - y - 1) * rowSize, src + y * rowSize, rowSize);
+      }
+    } else {
+      memcpy(out, src, byteSize);
+    }
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.ticket = 0;
+  }
+
+  void cancel(int ticket) {
+    Slot &slot = find(ticket);
+    slot.clearFence();
+    slot.ticket = 0;
+  }
+
+  static size_t getPixelSize(ReadbackFormat format) {
+    return format == ReadbackFormat::RGB8 ? 3 : sizeof(float);
+  }
+
+private:
+  struct Slot {
+    GLuint pbo;
+    GLsync fence;
+    size_t capacity;
+    int ticket;
+    int width;
+    int height;
+    ReadbackFormat format;
+
+    Slot()
+      : pbo(0), fence(0), capacity(0), ticket(0), width(0), height(0), format(ReadbackFormat::RGB8) {
+    }
+
+    bool poll(GLuint64 timeout) {
+      if (fence == 0) {
+        return true;
+      }
+
+      GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout == GL_TIMEOUT_IGNORED ? 0 : timeout);
+      while (timeout == GL_TIMEOUT_IGNORED && result == GL_TIMEOUT_EXPIRED) {
+        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+      }
+      if (result == GL_WAIT_FAILED) {
+        throw XglException("Waiting for readback fence failed.");
+      }
+      if (result == GL_TIMEOUT_EXPIRED) {
+        return false;
+      }
+
+      clearFence();
+      return true;
+    }
+
+    void clearFence() {
+      if (fence != 0) {
+        glDeleteSync(fence);
+        fence = 0;
+      }
+    }
+
+    void release() {
+      clearFence();
+      if (pbo != 0) {
+        glDeleteBuffers(1, &pbo);
+        pbo = 0;
+      }
+      capacity = 0;
+      ticket = 0;
+    }
+  };
+
+  std::vector<Slot> slots;
+  int nextTicket;
+
+  Slot &find(int ticket) {
+    for (auto &s : slots) {
+      if (ticket != 0 && s.ticket == ticket) {
+        return s;
+      }
+    }
+    throw XglException("Unknown or already collected readback ticket.");
+  }
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "model.h"
+
+
+// One mesh draw, with the sort keys precomputed when the queue is built.
+struct DrawItem {
+  Model *model;
+  size_t meshIndex;
+  GLuint program;
+  GLuint texture;
+  const Material *material;
+  float depth;            // view space distance of the bounds center along the viewing direction
+  size_t lod;             // level of detail of the mesh
+};
+
+
+// Level of detail selection, see Mesh::getLodCount.
+struct LodSettings {
+  float pixelScale;       // focal length in pixels, projects model space errors into the image
+  float threshold;        // largest accepted RMS error in pixels, 0 draws full detail
+  int forcedLevel;        // level of all meshes if not negative (clamped to the available levels)
+
+  bool operator==(const LodSettings &other) const {
+    return pixelScale == other.pixelScale && threshold == other.threshold && forcedLevel == other.forcedLevel;
+  }
+};
+
+
+// Per-frame list of mesh draws of a scene. Meshes outside the view frustum are culled when the
+// queue is built, so they cost neither state changes nor uniform updates. Opaque draws are
+// grouped by shader, texture and material and drawn front-to-back inside each group (fewer binds,
+// early-Z rejection), blended draws follow back-to-front. Each mesh is drawn at the coarsest
+// level of detail whose error stays below the LOD threshold in the image. The sorted order is
+// reused as long as neither the scene revision, the model list, the view, the projection, the
+// override material nor the LOD settings change.
+class RenderQueue {
+public:
+  RenderQueue()
+    : revision(0)
+    , overrideMaterial(nullptr)
+    , culling(true)
+    , lod()
+    , opaqueCount(0)
+    , culledCount(0)
+    , reducedCount(0) {
+  }
+
+  // Rebuilds the queue if necessary, returns true if the cached order was reused.
+  bool update(const std::vector<Model*> &models, const glm::mat4 &view, const glm::mat4 &projection, Material *overrideMaterial, bool culling, const LodSettings &lod) {
+    if (revision == sceneRevision() && this->models == models && this->view == view && this->projection == projection && this->overrideMaterial == overrideMaterial && this->culling == culling && this->lod == lod) {
+      return true;
+    }
+
+    revision = sceneRevision();
+    this->models = models;
+    this->view = view;
+    this->projection = projection;
+    this->overrideMaterial = overrideMaterial;
+    this->culling = culling;
+    this->lod = lod;
+    build();
+    return false;
+  }
+
+  void invalidate() {
+    revision = 0;
+  }
+
+  void draw(const glm::mat4 &projection, const Light &light) const {
+    draw(projection, light, 0, items.size());
+  }
+
+  // Draws the items in [begin, end) except those marked in skip.
+  void draw(const glm::mat4 &projection, const Light &light, size_t begin, size_t end, const std::vector<bool> *skip = nullptr) const {
+    for (size_t i = begin; i < end; ++i) {
+      if (skip == nullptr || !(*skip)[i]) {
+        drawItem(i, projection, light);
+      }
+    }
+  }
+
+  void drawItem(size_t index, const glm::mat4 &projection, const Light &light) const {
+    const DrawItem &item = items[index];
+    item.model->drawMesh(item.meshIndex, view, projection, light, overrideMaterial, item.lod);
+  }
+
+  const std::vector<DrawItem>& getItems() const { return items; }
+  size_t getOpaqueCount() const { return opaqueCount; }
+
+  // Number of meshes outside the view frustum.
+  size_t getCulledCount() const { return culledCount; }
+
+  // Number of meshes drawn at a reduced level of detail.
+  size_t getReducedCount() const { return reducedCount; }
+
+private:
+  uint64_t revision;
+  std::vector<Model*> models;
+  glm::mat4 view;
+  glm::mat4 projection;
+  Material *overrideMaterial;
+  bool culling;
+  LodSettings lod;
+
+  std::vector<DrawItem> items;
+  size_t opaqueCount;
+  size_t culledCount;
+  size_t reducedCount;
+
+  // Coarsest level whose error, scaled by the pose, projects to at most lod.threshold pixels at
+  // the nearest depth of the world bounds.
+  size_t selectLod(const Model &model, const Mesh &mesh, const WorldBounds &bounds) const {
+    if (mesh.getLodCount() == 0 || !model.supportsLods()) {
+      return 0;
+    }
+    if (lod.forcedLevel >= 0) {
+      return std::min((size_t)lod.forcedLevel, mesh.getLodCount());
+    }
+    if (!(lod.threshold > 0) || model.getClipSpace() || bounds.box.isEmpty()) {
+      return 0;
+    }
+
+    float depth = std::numeric_limits<float>::max();
+    for (int i = 0; i < 8; ++i) {
+      const glm::vec3 corner(i & 1 ? bounds.box.max.x : bounds.box.min.x, i & 2 ? bounds.box.max.y : bounds.box.min.y, i & 4 ? bounds.box.max.z : bounds.box.min.z);
+      depth = std::min(depth, -(view * glm::vec4(corner, 1.0f)).z);
+    }
+    if (!(depth > 0)) {
+      return 0;
+    }
+
+    const float radius = mesh.getBoundingSphere().radius;
+    const float scale = radius > 0 ? bounds.sphere.radius / radius : 1.0f;
+    const float pixelsPerUnit = lod.pixelScale * scale / depth;
+    size_t level = 0;
+    while (level < mesh.getLodCount() && mesh.getLodError(level + 1) * pixelsPerUnit <= lod.threshold) {
+      ++level;
+    }
+    return level;
+  }
+
+  void build() {
+    items.clear();
+    culledCount = 0;
+    reducedCount = 0;
+
+    const Frustum frustum(projection * view);
+    for (Model *m : models) {
+      const bool cullModel = culling && m->getFrustumCulling() && !m->getClipSpace();
+      for (size_t i = 0; i < m->getMeshCount(); ++i) {
+        const std::shared_ptr<Mesh> &mesh = m->getMeshAt(i);
+        const Material *material = overrideMaterial != nullptr ? overrideMaterial : mesh->getMaterial().get();
+        if (material == nullptr) {
+          continue;   // nothing to bind, the mesh cannot be drawn
+        }
+
+        const WorldBounds &bounds = m->getWorldBounds(i);
+        if (cullModel && !bounds.box.isEmpty() && (!frustum.intersects(bounds.sphere) || !frustum.intersects(bounds.box))) {
+          ++culledCount;
+          continue;
+        }
+
+        DrawItem item;
+        item.model = m;
+        item.meshIndex = i;
+        item.program = m->getEffectiveShader(*material)->getProgram();
+        item.texture = material->getPrimaryTextureId();
+        item.material = material;
+        item.depth = -(view * glm::vec4(bounds.box.getCenter(), 1.0f)).z;
+        item.lod = selectLod(*m, *mesh, bounds);
+        if (item.lod > 0) {
+          ++reducedCount;
+        }
+        items.push_back(item);
+      }
+    }
+
+    auto transparentBegin = std::stable_partition(items.begin(), items.end(), [](const DrawItem &item) {
+      return !item.material->isTransparent();
+    });
+    opaqueCount = transparentBegin - items.begin();
+
+    std::sort(items.begin(), transparentBegin, [](const DrawItem &a, const DrawItem &b) {
+      if (a.program != b.program) return a.program < b.program;
+      if (a.texture != b.texture) return a.texture < b.texture;
+      if (a.material != b.material) return a.material < b.material;
+      return a.depth < b.depth;
+    });
+
+    std::stable_sort(transparentBegin, items.end(), [](const DrawItem &a, const DrawItem &b) {
+      return a.depth > b.depth;
+    });
+  }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <list>
+#include <memory>
+
+
+enum class SurfaceType {
+  Texture,          // GL_TEXTURE_2D, sampled or read back
+  Renderbuffer      // multi-sampled or depth storage that is only rendered to
+};
+
+struct SurfaceDesc {
+  SurfaceType type;
+  GLenum internalFormat;
+  int width;
+  int height;
+  int samples;      // renderbuffers only, 0 for single-sampled storage
+
+  bool operator ==(const SurfaceDesc &other) const {
+    return type == other.type && internalFormat == other.internalFormat && width == other.width && height == other.height && samples == other.samples;
+  }
+};
+
+
+// Texture or renderbuffer storage of a render target attachment.
+class Surface {
+public:
+  explicit Surface(const SurfaceDesc &desc)
+    : desc(desc)
+    , id(0) {
+    if (desc.type == SurfaceType::Texture) {
+      glGenTextures(1, &id);
+      glState().bindTextureForUpdate(id);
+      glTexImage2D(GL_TEXTURE_2D, 0, desc.internalFormat, desc.width, desc.height, 0, getTransferFormat(desc.internalFormat), getTransferType(desc.internalFormat), nullptr);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);    // no mipmaps, complete for texelFetch
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    } else {
+      glGenRenderbuffers(1, &id);
+      glBindRenderbuffer(GL_RENDERBUFFER, id);
+      if (desc.samples > 0) {
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, desc.samples, desc.internalFormat, desc.width, desc.height);
+      } else {
+        glRenderbufferStorage(GL_RENDERBUFFER, desc.internalFormat, desc.width, desc.height);
+      }
+      glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    }
+  }
+
+  ~Surface() {
+    if (desc.type == SurfaceType::Texture) {
+      glState().forgetTexture(id);
+      glDeleteTextures(1, &id);
+    } else {
+      glDeleteRenderbuffers(1, &id);
+    }
+  }
+
+  Surface & operator =(const Surface &) = delete;
+  Surface(const Surface &) = delete;
+
+  GLuint getId() const { return id; }
+  const SurfaceDesc& getDesc() const { return desc; }
+
+  // Attaches the surface to the framebuffer bound to GL_FRAMEBUFFER.
+  void attach(GLenum attachment) const {
+    if (desc.type == SurfaceType::Texture) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, id, 0);
+    } else {
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, id);
+    }
+  }
+
+  // Estimated size of the storage in bytes (drivers store RGB8 as 4 bytes per pixel).
+  size_t getByteSize() const {
+    return (size_t)desc.width * desc.height * std::max(desc.samples, 1) * getPixelSize(desc.internalFormat);
+  }
+
+private:
+  SurfaceDesc desc;
+  GLuint id;
+
+  static size_t getPixelSize(GLenum internalFormat) {
+    switch (internalFormat) {
+      case GL_R32F: return 4;
+      case GL_RGBA16F: return 8;
+      case GL_RG32UI: return 8;
+      case GL_RGBA32F: return 16;
+      default: return 4;      // RGB8, RGBA8, DEPTH24_STENCIL8
+    }
+  }
+
+  static GLenum getTransferFormat(GLenum internalFormat) {
+    switch (internalFormat) {
+      case GL_R32F: return GL_RED;
+      case GL_RG32UI: return GL_RG_INTEGER;
+      case GL_DEPTH24_STENCIL8: return GL_DEPTH_STENCIL;
+      default: return GL_RGBA;
+    }
+  }
+
+  static GLenum getTransferType(GLenum internalFormat) {
+    switch (internalFormat) {
+      case GL_R32F: case GL_RGBA16F: case GL_RGBA32F: return GL_FLOAT;
+      case GL_RG32UI: return GL_UNSIGNED_INT;
+      case GL_DEPTH24_STENCIL8: return GL_UNSIGNED_INT_24_8;
+      default: return GL_UNSIGNED_BYTE;
+    }
+  }
+};
+
+
+// Process-wide pool of render target surfaces. Cameras acquire surfaces for the target types
+// they actually render and return them when resized or destroyed, so cameras of the same size
+// (or a camera switching back to a previous size) reuse existing storage. Returned surfaces are
+// kept up to a byte budget, least recently returned ones are deleted first.
+class RenderTargetPool {
+public:
+  RenderTargetPool()
+    : freeBytes(0)
+    , budget(256 * 1024 * 1024) {
+    glState();      // surfaces forget their textures in the state cache, it has to outlive the pool
+  }
+
+  RenderTargetPool & operator =(const RenderTargetPool &) = delete;
+  RenderTargetPool(const RenderTargetPool &) = delete;
+
+  std::unique_ptr<Surface> acquire(const SurfaceDesc &desc) {
+    for (auto i = available.begin(); i != available.end(); ++i) {
+      if ((*i)->getDesc() == desc) {
+        std::unique_ptr<Surface> surface(std::move(*i));
+        available.erase(i);
+        freeBytes -= surface->getByteSize();
+        return surface;
+      }
+    }
+    return std::unique_ptr<Surface>(new Surface(desc));
+  }
+
+  void release(std::unique_ptr<Surface> &surface) {
+    if (!surface) {
+      return;
+    }
+    freeBytes += surface->getByteSize();
+    available.push_front(std::move(surface));
+    trim(budget);
+  }
+
+  // Deletes returned surfaces until at most maxBytes are kept.
+  void trim(size_t maxBytes = 0) {
+    while (freeBytes > maxBytes && !available.empty()) {
+      freeBytes -= available.back()->getByteSize();
+      available.pop_back();
+    }
+  }
+
+  size_t getFreeBytes() const {
+    return freeBytes;
+  }
+
+  size_t getBudget() const {
+    return budget;
+  }
+
+  void setBudget(size_t bytes) {
+    budget = bytes;
+    trim(budget);
+  }
+
+private:
+  std::list<std::unique_ptr<Surface> > available;   // most recently returned first
+  size_t freeBytes;
+  size_t budget;
+};
+
+
+inline RenderTargetPool& renderTargetPool() {
+  static RenderTargetPool pool;
+  return pool;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+
+// Global counter of scene changes that affect the draw order (poses, meshes, shaders, textures,
+// opacity). Render queues compare it to decide whether their cached sort order is still valid.
+inline uint64_t& sceneRevision() {
+  static uint64_t revision = 1;
+  return revision;
+}
+
+inline void touchScene() {
+  ++sceneRevision();
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <limits>
+#include <vector>
+
+#include "bvh.h"
+#include "model.h"
+#include "thread_pool.h"
+
+
+// Closest intersection of a ray with the scene.
+struct RayHit {
+  float distance;           // in multiples of the ray direction length, infinity without hit
+  Model *model;             // nullptr without hit
+  size_t meshIndex;
+  int triangle;             // index of the triangle in the mesh, -1 without hit
+  glm::vec2 barycentrics;   // weights of the second and third triangle vertex
+};
+
+
+// Two-level BVH for CPU ray casts: a tree over the world bounds of all mesh instances of a scene,
+// each leaf refers to the triangle BVH of its mesh (see Mesh::getBVH), rays are transformed into
+// model coordinates there. Like the render queue it is rebuilt only when the scene revision or
+// the model list changes. Meshes without material and clip-space models (they are not drawn at
+// their world pose) are ignored.
+class SceneBVH {
+public:
+  SceneBVH()
+    : revision(0) {
+  }
+
+  // Rebuilds the tree and the mesh BVHs if necessary, has to be called on the GL thread.
+  void update(const std::vector<Model*> &models) {
+    if (revision == sceneRevision() && this->models == models) {
+      return;
+    }
+    revision = sceneRevision();
+    this->models = models;
+
+    std::vector<Instance> unordered;
+    std::vector<BoundingBox> boxes;
+    std::vector<glm::mat4> poses;
+    for (Model *m : models) {
+      if (m->getClipSpace()) {
+        continue;
+      }
+      m->getInstancePoses(poses);
+      for (size_t i = 0; i < m->getMeshCount(); ++i) {
+        const std::shared_ptr<Mesh> &mesh = m->getMeshAt(i);
+        if (!mesh->getMaterial() || mesh->getBounds().isEmpty()) {
+          continue;
+        }
+        const MeshBVH *bvh = &mesh->getBVH();
+        for (const glm::mat4 &pose : poses) {
+          Instance instance;
+          instance.model = m;
+          instance.meshIndex = i;
+          instance.bvh = bvh;
+          instance.toModel = glm::inverse(pose);
+          unordered.push_back(instance);
+          boxes.push_back(mesh->getBounds().transform(pose));
+        }
+      }
+    }
+
+    tree.build(boxes);
+    instances.resize(unordered.size());
+    for (size_t i = 0; i < unordered.size(); ++i) {
+      instances[i] = unordered[tree.getItems()[i]];
+    }
+  }
+
+  RayHit intersect(const Ray &ray, float maxDistance) const {
+    RayHit hit;
+    hit.distance = std::numeric_limits<float>::infinity();
+    hit.model = nullptr;
+    hit.meshIndex = 0;
+    hit.triangle = -1;
+    hit.barycentrics = glm::vec2(0, 0);
+
+    float tMax = maxDistance;
+    tree.traverse(ray, tMax, [&](uint32_t begin, uint32_t end, float &t) {
+      for (uint32_t i = begin; i < end; ++i) {
+        const Instance &instance = instances[i];
+        // affine transform, distances along the ray do not change
+        Ray local;
+        local.origin = glm::vec3(instance.toModel * glm::vec4(ray.origin, 1.0f));
+        local.direction = glm::vec3(instance.toModel * glm::vec4(ray.direction, 0.0f));
+        if (instance.bvh->intersect(local, t, hit.triangle, hit.barycentrics)) {
+          hit.distance = t;
+          hit.model = instance.model;
+          hit.meshIndex = instance.meshIndex;
+        }
+      }
+    });
+    return hit;
+  }
+
+  // Casts rays in bands on the thread pool.
+  void intersect(const Ray *rays, size_t count, float maxDistance, RayHit *hits) const {
+    threadPool().parallelFor(count, 64, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        hits[i] = intersect(rays[i], maxDistance);
+      }
+    });
+  }
+
+private:
+  struct Instance {
+    Model *model;
+    size_t meshIndex;
+    const MeshBVH *bvh;
+    glm::mat4 toModel;
+  };
+
+  uint64_t revision;
+  std::vector<Model*> models;
+  BVHTree tree;
+  std::vector<Instance> instances;    // in leaf order of the tree
+};
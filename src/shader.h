@@ -1,5 +1,96 @@
 #pragma once
 
+#include <unordered_map>
+
+
+// Typed handle for a uniform location. Setting a uniform that the program does not use (location -1)
+// is a no-op, so callers do not need to check for optional uniforms.
+class Uniform {
+public:
+  Uniform()
+    : location(-1) {
+  }
+
+  explicit Uniform(GLint location)
+    : location(location) {
+  }
+
+  bool valid() const { return location >= 0; }
+  GLint getLocation() const { return location; }
+
+  void set(GLint value) const {
+    if (location >= 0) {
+      glUniform1i(location, value);
+    }
+  }
+
+  void set(GLfloat value) const {
+    if (location >= 0) {
+      glUniform1f(location, value);
+    }
+  }
+
+  void set(const glm::vec2 &value) const {
+    if (location >= 0) {
+      glUniform2fv(location, 1, glm::value_ptr(value));
+    }
+  }
+
+  void set(const glm::uvec2 &value) const {
+    if (location >= 0) {
+      glUniform2ui(location, value.x, value.y);
+    }
+  }
+
+  void set(const glm::vec3 &value) const {
+    if (location >= 0) {
+      glUniform3fv(location, 1, glm::value_ptr(value));
+    }
+  }
+
+  void set(const glm::vec4 &value) const {
+    if (location >= 0) {
+      glUniform4fv(location, 1, glm::value_ptr(value));
+    }
+  }
+
+  void set(const glm::mat4 &value) const {
+    if (location >= 0) {
+      glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+  }
+
+private:
+  GLint location;
+};
+
+
+// Uniforms of the xgl render path, resolved once after linking.
+struct StandardUniforms {
+  Uniform model;
+  Uniform view;
+  Uniform projection;
+
+  Uniform lightColor;
+  Uniform lightPos;
+  Uniform viewPos;
+
+  Uniform materialDiffuse;
+  Uniform materialShininess;
+  Uniform materialOpacity;
+
+  Uniform objectId;     // model id, mesh index + 1 (G-buffer id target)
+  Uniform flipTextureV;     // first texture of the material is stored top-down
+
+  std::vector<Uniform> diffuseSamplers;     // texture_diffuse1 .. texture_diffuseN
+  std::vector<Uniform> specularSamplers;    // texture_specular1 .. texture_specularN
+
+  static const Uniform& at(const std::vector<Uniform> &samplers, size_t index) {
+    static const Uniform none;
+    return index < samplers.size() ? samplers[index] : none;
+  }
+};
+
 
 class Shader
 {
@@ -69,6 +160,7 @@ private:
     }
 
     ~GLProgram() {
+      glState().forgetProgram(program);
       glDeleteProgram(program);
       program = 0;
     }
@@ -78,7 +170,7 @@ private:
     }
 
     void use() const {
-      glUseProgram(program);
+      glState().useProgram(program);
     }
 
     void attachShader(GLuint shader) {
@@ -128,6 +220,7 @@ public:
     program->link();
 
     this->program.swap(program);
+    introspectUniforms();
   }
 
   void load(const std::string& vertexPath, const std::string& fragmentPath) {
@@ -165,6 +258,91 @@ public:
     return program ? program->get() : 0;
   }
 
+  // Returns the cached handle of an active uniform (invalid handle if the program does not use it).
+  Uniform getUniform(const std::string &name) const {
+    auto i = uniformLocations.find(name);
+    return i != uniformLocations.end() ? Uniform(i->second) : Uniform();
+  }
+
+  const StandardUniforms& getStandardUniforms() const {
+    return standardUniforms;
+  }
+
 private:
   std::unique_ptr<GLProgram> program;
+  std::unordered_map<std::string, GLint> uniformLocations;
+  StandardUniforms standardUniforms;
+
+  static void addSampler(std::vector<Uniform> &samplers, const std::string &name, const std::string &prefix, GLint location) {
+    if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0) {
+      return;
+    }
+
+    const int number = atoi(name.c_str() + prefix.size());    // samplers are numbered starting with 1
+    if (number < 1) {
+      return;
+    }
+
+    if (samplers.size() < (size_t)number) {
+      samplers.resize(number);
+    }
+    samplers[number - 1] = Uniform(location);
+  }
+
+  // Queries all active uniforms once after linking, the render path only uses the resolved handles.
+  void introspectUniforms() {
+    uniformLocations.clear();
+    standardUniforms = StandardUniforms();
+
+    const GLuint id = program->get();
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+    std::vector<GLchar> buffer(std::max(maxLength, 1));
+    for (GLint i = 0; i < count; ++i) {
+      GLsizei length = 0;
+      GLint size = 0;
+      GLenum type = 0;
+      glGetActiveUniform(id, i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+
+      std::string name(buffer.data(), length);
+      if (name.compare(0, 3, "gl_") == 0) {
+        continue;
+      }
+
+      // arrays are reported as 'name[0]', register the plain name and every element
+      const size_t bracket = name.find('[');
+      if (bracket != std::string::npos && size > 1) {
+        const std::string base = name.substr(0, bracket);
+        for (GLint j = 0; j < size; ++j) {
+          const std::string element = base + "[" + std::to_string(j) + "]";
+          uniformLocations[element] = glGetUniformLocation(id, element.c_str());
+        }
+        name = base;
+      } else if (bracket != std::string::npos) {
+        name = name.substr(0, bracket);
+      }
+
+      uniformLocations[name] = glGetUniformLocation(id, name.c_str());
+    }
+
+    StandardUniforms &u = standardUniforms;
+    u.model = getUniform("model");
+    u.view = getUniform("view");
+    u.projection = getUniform("projection");
+    u.lightColor = getUniform("lightColor");
+    u.lightPos = getUniform("lightPos");
+    u.viewPos = getUniform("viewPos");
+    u.materialDiffuse = getUniform("material.diffuse");
+    u.materialShininess = getUniform("material.shininess");
+    u.materialOpacity = getUniform("material.opacity");
+    u.objectId = getUniform("objectId");
+    u.flipTextureV = getUniform("flipTextureV");
+
+    for (const auto &entry : uniformLocations) {
+      addSampler(u.diffuseSamplers, entry.first, "texture_diffuse", entry.second);
+      addSampler(u.specularSamplers, entry.first, "texture_specular", entry.second);
+    }
+  }
 };
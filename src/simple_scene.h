@@ -1,42 +1,150 @@
 #pragma once
 
+#include "async_loader.h"
 #include "camera.h"
 #include "light.h"
+#include "occlusion_culler.h"
+#include "render_queue.h"
+#include "scene_bvh.h"
 
 
 class SimpleScene {
 public:
   SimpleScene()
     : camera(nullptr)
-    , clearColor(0, 0, 0, 1) {
+    , clearColor(0, 0, 0, 1)
+    , frustumCulling(true)
+    , occlusionCulling(false)
+    , lodThreshold(0)
+    , forcedLod(-1)
+    , stats() {
   }
 
   void render(RenderTargetType renderTarget = RenderTargetType::MultiSampling) {
+    // meshes of models loading in the background appear over the next frames
+    AsyncLoader &loader = asyncLoader();
+    loader.processUploads(loader.getUploadBudget());
 
     camera->activateRenderTarget(renderTarget);
 
+    // state may have been changed outside of xgl (e.g. by other libraries sharing the context)
+    GLStateCache &state = glState();
+    state.invalidate();
+    state.resetStats();
+
     glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LEQUAL);   // set less or equal depth function for multi-pass rendering
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    state.setDepthTest(true);
+    state.setDepthMask(true);   // glClear respects the depth mask of the last drawn material
+    state.setDepthFunc(GL_LEQUAL);   // set less or equal depth function for multi-pass rendering
+    if (renderTarget == RenderTargetType::GBuffer) {
+      camera->clearGBuffer(clearColor);   // glClear is undefined for the integer id attachment
+    } else {
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
 
     glm::mat4 view = camera->getViewMatrix();
     glm::mat4 projection = camera->getProjectionMatrix();
 
-    if (lights.empty()) {
-      // render with default light
-      PointLight defaultLight(glm::vec3(3, -5, -2), glm::vec4(1, 1, 1, 1));
-      for (auto m : models) {
-        m->draw(view, projection, defaultLight, overrideMaterial.get());
-      }
+    LodSettings lod;
+    const glm::vec2 focalLength = camera->getFocalLength();
+    lod.pixelScale = std::max(focalLength.x, focalLength.y);
+    // depth and G-buffer renders stay exact (like castRays) unless a level is forced
+    lod.threshold = renderTarget == RenderTargetType::Depth || renderTarget == RenderTargetType::GBuffer ? 0 : lodThreshold;
+    lod.forcedLevel = forcedLod;
+    queue.update(models, view, projection, overrideMaterial.get(), frustumCulling, lod);
+
+    // render with default light if there are no lights
+    PointLight defaultLight(glm::vec3(3, -5, -2), glm::vec4(1, 1, 1, 1));
+    std::vector<Light*> passLights = lights;
+    if (passLights.empty()) {
+      passLights.push_back(&defaultLight);
     }
-    else {
-      for (auto l : lights) {
-        for (auto m : models) {
-          m->draw(view, projection, *l, overrideMaterial.get());
+
+    if (occlusionCulling) {
+      const size_t opaqueCount = queue.getOpaqueCount();
+      const std::vector<bool> &deferred = occlusion.begin(queue, view, projection);
+      for (Light *l : passLights) {
+        queue.draw(projection, *l, 0, opaqueCount, &deferred);
+      }
+      occlusion.drawDeferred(queue, [&](size_t index) {
+        for (Light *l : passLights) {
+          queue.drawItem(index, projection, *l);
         }
-      }    
+      });
+      occlusion.queryVisible(queue);
+      for (Light *l : passLights) {
+        queue.draw(projection, *l, opaqueCount, queue.getItems().size());
+      }
+    } else {
+      for (Light *l : passLights) {
+        queue.draw(projection, *l);
+      }
+    }
+
+    stats = state.getStats();
+    stats.culledMeshes = (int)queue.getCulledCount();
+    stats.reducedMeshes = (int)queue.getReducedCount();
+    if (occlusionCulling) {
+      stats.occludedMeshes = (int)occlusion.getDeferredCount();
+      stats.occlusionQueries = (int)occlusion.getQueryCount();
+    }
+  }
+
+  // Statistics of the last render() call.
+  const RenderStats& getRenderStats() const {
+    return stats;
+  }
+
+  // Renders one variant per pose of model into the layers of the camera's batch target. All
+  // variants are submitted without intermediate readback, see Camera::copyBatchResult.
+  void renderPoses(Model *model, const std::vector<glm::mat4> &poses, RenderTargetType renderTarget = RenderTargetType::MultiSampling) {
+    const glm::mat4 originalPose = model->getPose();
+    camera->beginBatch((int)poses.size(), renderTarget);
+    try {
+      for (size_t i = 0; i < poses.size(); ++i) {
+        model->setPose(poses[i]);
+        render(renderTarget);
+        camera->resolveToBatchLayer((int)i);
+      }
+    }
+    catch (...) {
+      model->setPose(originalPose);
+      throw;
+    }
+    model->setPose(originalPose);
+  }
+
+  // Renders the scene once per camera view matrix into the layers of the camera's batch target.
+  void renderViews(const std::vector<glm::mat4> &views, RenderTargetType renderTarget = RenderTargetType::MultiSampling) {
+    const glm::mat4 originalView = camera->getViewMatrix();
+    camera->beginBatch((int)views.size(), renderTarget);
+    try {
+      for (size_t i = 0; i < views.size(); ++i) {
+        camera->setViewMatrix(views[i]);
+        render(renderTarget);
+        camera->resolveToBatchLayer((int)i);
+      }
+    }
+    catch (...) {
+      camera->setViewMatrix(originalView);
+      throw;
     }
+    camera->setViewMatrix(originalView);
+  }
+
+  // Finds the closest mesh hit of each ray (world coordinates) on the CPU, see SceneBVH.
+  void castRays(const Ray *rays, size_t count, float maxDistance, RayHit *hits) {
+    bvh.update(models);
+    bvh.intersect(rays, count, maxDistance, hits);
+  }
+
+  // Casts the camera rays through pixel positions, see Camera::getPixelRay.
+  void castPixelRays(const glm::vec2 *pixels, size_t count, bool vflip, float maxDistance, RayHit *hits) {
+    std::vector<Ray> rays(count);
+    for (size_t i = 0; i < count; ++i) {
+      rays[i] = camera->getPixelRay(pixels[i], vflip);
+    }
+    castRays(rays.data(), count, maxDistance, hits);
   }
 
   void setCamera(Camera *camera) {
@@ -67,6 +175,45 @@ public:
     clearColor = rgba;
   }
 
+  // Skips meshes whose bounds are outside the camera frustum (enabled by default).
+  bool getFrustumCulling() const {
+    return frustumCulling;
+  }
+
+  void setFrustumCulling(bool value) {
+    frustumCulling = value;
+  }
+
+  // Skips opaque meshes hidden behind others using GPU occlusion queries of their bounds (disabled
+  // by default), see OcclusionCuller. Pays off for scenes with large occluders.
+  bool getOcclusionCulling() const {
+    return occlusionCulling;
+  }
+
+  void setOcclusionCulling(bool value) {
+    occlusionCulling = value;
+  }
+
+  // Largest simplification error in pixels accepted when choosing mesh levels of detail for color
+  // renders. The error is an RMS estimate, not a bound. 0 (the default) draws full detail.
+  float getLodThreshold() const {
+    return lodThreshold;
+  }
+
+  void setLodThreshold(float pixels) {
+    lodThreshold = pixels;
+  }
+
+  // Level of detail used for all meshes in every render target. -1 (the default) selects levels
+  // by the threshold.
+  int getForcedLod() const {
+    return forcedLod;
+  }
+
+  void setForcedLod(int level) {
+    forcedLod = level;
+  }
+
   std::shared_ptr<Material> getOverrideMaterial() const {
     return overrideMaterial;
   }
@@ -80,5 +227,13 @@ private:
   std::vector<Model*> models;
   std::vector<Light*> lights;
   glm::vec4 clearColor;
+  bool frustumCulling;
+  bool occlusionCulling;
+  float lodThreshold;
+  int forcedLod;
   std::shared_ptr<Material> overrideMaterial;
+  RenderStats stats;
+  RenderQueue queue;
+  OcclusionCuller occlusion;
+  SceneBVH bvh;
 };
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+
+#include "texture_cache.h"
+
+
+enum class PixelFormat : int {
+  Gray = 0,
+  RGB = 1,
+  BGR = 2,
+  RGBA = 3,
+  BGRA = 4
+};
+
+
+// Texture for images that change every frame (e.g. camera images shown as overlay). Storage is
+// allocated once per image size and format (immutable if the driver supports it), updates only
+// copy the pixels into a pixel unpack buffer and let the GPU transfer them with glTexSubImage2D.
+// BGR(A) and gray images are uploaded as they are, channel order and gray expansion are handled
+// by the texture format and swizzle, so no CPU conversion is needed.
+class StreamingTexture {
+public:
+  StreamingTexture()
+    : width(0), height(0)
+    , format(PixelFormat::RGB)
+    , mipmapped(false)
+    , pbo(0) {
+  }
+
+  ~StreamingTexture() {
+    if (pbo != 0) {
+      glDeleteBuffers(1, &pbo);
+    }
+  }
+
+  StreamingTexture & operator =(const StreamingTexture &) = delete;
+  StreamingTexture(const StreamingTexture &) = delete;
+
+  // 0 until the first update, changes when the image size, format or mipmapping changes.
+  GLuint getId() const { return texture ? texture->getId() : 0; }
+
+  static int getChannelCount(PixelFormat format) {
+    switch (format) {
+      case PixelFormat::Gray: return 1;
+      case PixelFormat::RGB: case PixelFormat::BGR: return 3;
+      case PixelFormat::RGBA: case PixelFormat::BGRA: return 4;
+      default: throw XglException("Invalid pixel format.");
+    }
+  }
+
+  // Uploads tightly packed 8 bit pixels, rows in memory order.
+  void update(int width, int height, PixelFormat format, const uint8_t *data, bool generateMipmap) {
+    if (width <= 0 || height <= 0) {
+      throw XglException("Invalid image size.");
+    }
+    if (!texture || width != this->width || height != this->height || format != this->format || generateMipmap != mipmapped) {
+      allocate(width, height, format, generateMipmap);
+    }
+
+    const size_t byteSize = (size_t)width * height * getChannelCount(format);
+    if (pbo == 0) {
+      glGenBuffers(1, &pbo);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+
+    // orphan the store of the previous frame, the GPU may still be reading from it
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, byteSize, nullptr, GL_STREAM_DRAW);
+    void *ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, byteSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (ptr == nullptr) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      throw XglException("Mapping pixel unpack buffer failed.");
+    }
+    std::memcpy(ptr, data, byteSize);
+    const bool intact = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+
+    if (intact) {
+      glState().bindTextureForUpdate(texture->getId());
+      GLint unpackAlignment = 4;
+      glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);    // rows of width * channels bytes
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, getTransferFormat(format), GL_UNSIGNED_BYTE, nullptr);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!intact) {
+      throw XglException("Pixel unpack buffer got corrupted during upload.");
+    }
+
+    if (mipmapped) {
+      glGenerateMipmap(GL_TEXTURE_2D);
+    }
+  }
+
+private:
+  std::unique_ptr<TextureObject> texture;
+  int width;
+  int height;
+  PixelFormat format;
+  bool mipmapped;
+  GLuint pbo;
+
+  void allocate(int width, int height, PixelFormat format, bool generateMipmap) {
+    std::unique_ptr<TextureObject> t(new TextureObject());
+    glState().bindTextureForUpdate(t->getId());
+
+    GLsizei levels = 1;
+    if (generateMipmap) {
+      for (int size = std::max(width, height); size > 1; size >>= 1) {
+        ++levels;
+      }
+    }
+
+    const GLenum internalFormat = format == PixelFormat::Gray ? GL_R8 : (getChannelCount(format) == 4 ? GL_RGBA8 : GL_RGB8);
+    if (GLEW_VERSION_4_2 || GLEW_ARB_texture_storage) {
+      glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, width, height);
+    } else {
+      for (GLsizei level = 0, w = width, h = height; level < levels; ++level, w = std::max(w / 2, 1), h = std::max(h / 2, 1)) {
+        glTexImage2D(GL_TEXTURE_2D, level, internalFormat, w, h, 0, getTransferFormat(format), GL_UNSIGNED_BYTE, nullptr);
+      }
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, generateMipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    if (format == PixelFormat::Gray) {
+      const GLint swizzle[] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+      glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+
+    texture.swap(t);
+    this->width = width;
+    this->height = height;
+    this->format = format;
+    this->mipmapped = generateMipmap;
+  }
+
+  static GLenum getTransferFormat(PixelFormat format) {
+    switch (format) {
+      case PixelFormat::Gray: return GL_RED;
+      case PixelFormat::BGR: return GL_BGR;
+      case PixelFormat::RGBA: return GL_RGBA;
+      case PixelFormat::BGRA: return GL_BGRA;
+      default: return GL_RGB;
+    }
+  }
+};
@@ -107,13 +107,41 @@ inline glm::mat3 Tensor2mat3(THDoubleTensor *tensor) {
   return Tensor2mat<glm::mat3, 3, 3>(tensor);
 }
 
-void IntTensorToIndices(THIntTensor *tensor, std::vector<GLuint>& indices) {
-  tensor = THIntTensor_newContiguous(tensor);
-  int *data = THIntTensor_data(tensor);
-  const int n = THIntTensor_nElement(tensor);
-  indices.resize(n);
+// Accepts a single 4x4 matrix or a stack of N 4x4 matrices (Nx4x4).
+inline void Tensor2mat4Array(THDoubleTensor *tensor, std::vector<glm::mat4>& output) {
+  if (tensor == NULL || tensor->nDimension < 2 || tensor->nDimension > 3
+    || tensor->size[tensor->nDimension - 2] != 4 || tensor->size[tensor->nDimension - 1] != 4)
+    throw XglException("Invalid tensor size, 4x4 or Nx4x4 expected");
 
-  std::copy(data, data + n, indices.begin());
+  const int count = tensor->nDimension == 3 ? tensor->size[0] : 1;
+  output.resize(count);
 
-  THIntTensor_free(tensor);
+  tensor = THDoubleTensor_newContiguous(tensor);
+  double *data = THDoubleTensor_data(tensor);
+  for (int i = 0; i < count; ++i) {
+    glm::mat4 &m = output[i];
+    for (int r = 0; r < 4; ++r) {
+      for (int c = 0; c < 4; ++c) {
+        m[c][r] = *data++;
+      }
+    }
+  }
+  THDoubleTensor_free(tensor);
 }
+
+// Accepts a single color (4) or one color per row (Nx4).
+inline void Tensor2vec4Array(THFloatTensor *tensor, std::vector<glm::vec4>& output) {
+  if (tensor == NULL || tensor->nDimension < 1 || tensor->nDimension > 2 || tensor->size[tensor->nDimension - 1] != 4)
+    throw XglException("Invalid tensor size, 4 or Nx4 expected");
+
+  const int count = tensor->nDimension == 2 ? tensor->size[0] : 1;
+  output.resize(count);
+
+  tensor = THFloatTensor_newContiguous(tensor);
+  float *data = THFloatTensor_data(tensor);
+  for (int i = 0; i < count; ++i, data += 4) {
+    output[i] = glm::vec4(data[0], data[1], data[2], data[3]);
+  }
+  THFloatTensor_free(tensor);
+}
+
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include <SOIL/SOIL.h>
+
+#include "utils.h"
+
+
+// RGB8 pixels of an image file, decoded without GL so it can happen on any thread.
+struct DecodedImage {
+  int width;
+  int height;
+  std::vector<uint8_t> pixels;
+};
+
+inline void decodeImageFile(const std::string &path, bool flipV, DecodedImage &output) {
+  int width = 0, height = 0;
+  unsigned char *image = SOIL_load_image(path.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
+  if (image == nullptr) {
+    throw XglException(string_format("Texture loading faild (%s), error: %s!\n", path.c_str(), SOIL_last_result()));
+  }
+
+  if (flipV) {
+    flipVInplace(image, width, height, 3);
+  }
+
+  output.width = width;
+  output.height = height;
+  output.pixels.assign(image, image + (size_t)width * height * 3);
+  SOIL_free_image_data(image);
+}
+
+
+// Owns a GL texture, deleted with the last reference.
+class TextureObject {
+public:
+  TextureObject()
+    : id(0), byteSize(0) {
+    glGenTextures(1, &id);
+  }
+
+  // Uploads an RGB8 image with mipmaps.
+  explicit TextureObject(const DecodedImage &image)
+    : TextureObject() {
+    setImage(image.width, image.height, image.pixels.data(), true);
+  }
+
+  ~TextureObject() {
+    glState().forgetTexture(id);
+    glDeleteTextures(1, &id);
+  }
+
+  TextureObject & operator =(const TextureObject &) = delete;
+  TextureObject(const TextureObject &) = delete;
+
+  GLuint getId() const { return id; }
+
+  // Estimated GPU memory (RGB8 is stored with 4 bytes per pixel).
+  size_t getByteSize() const { return byteSize; }
+
+  void setImage(int width, int height, const uint8_t *data, bool generateMipmap) {
+    glState().bindTextureForUpdate(id);
+    GLint unpackAlignment = 4;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);    // rows of width * 3 bytes
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+    if (generateMipmap) {
+      glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    // Parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, generateMipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    byteSize = (size_t)width * height * 4;
+    if (generateMipmap) {
+      byteSize += byteSize / 3;
+    }
+  }
+
+private:
+  GLuint id;
+  size_t byteSize;
+};
+
+
+struct TextureCacheStats {
+  double hits;
+  double misses;
+  double evictions;
+  double textureCount;
+  double byteSize;        // all cached textures, used or not
+  double budget;
+};
+
+
+// Process-wide cache of file textures keyed by canonical path and load parameters. Materials hold
+// shared references, so a texture used by several models is uploaded once. Textures no material
+// uses anymore stay cached for reuse until the cached total exceeds the memory budget, then the
+// least recently used of them are deleted.
+class TextureCache {
+public:
+  TextureCache()
+    : hits(0), misses(0), evictions(0)
+    , byteSize(0)
+    , budget(512 * 1024 * 1024) {
+    glState();      // textures forget themselves in the state cache, it has to outlive the cache
+  }
+
+  TextureCache & operator =(const TextureCache &) = delete;
+  TextureCache(const TextureCache &) = delete;
+
+  static std::string makeKey(const std::string &path, bool flipV) {
+    char resolved[PATH_MAX];
+    std::string key = realpath(path.c_str(), resolved) != nullptr ? std::string(resolved) : path;
+    return flipV ? key + "|flipV" : key;
+  }
+
+  // True if the texture is cached, may be called from any thread (e.g. to skip decoding).
+  bool contains(const std::string &key) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.count(key) != 0;
+  }
+
+  // Returns the cached texture of path or loads it. image is uploaded on a miss if not null,
+  // otherwise the file is decoded.
+  std::shared_ptr<TextureObject> acquire(const std::string &path, bool flipV, const DecodedImage *image = nullptr) {
+    const std::string key = makeKey(path, flipV);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto i = entries.find(key);
+      if (i != entries.end()) {
+        ++hits;
+        lru.splice(lru.begin(), lru, i->second.position);
+        return i->second.texture;
+      }
+      ++misses;
+    }
+
+    std::shared_ptr<TextureObject> texture;
+    if (image != nullptr) {
+      texture = std::make_shared<TextureObject>(*image);
+    } else {
+      DecodedImage decoded;
+      decodeImageFile(path, flipV, decoded);
+      texture = std::make_shared<TextureObject>(decoded);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.count(key) != 0) {
+      return entries[key].texture;     // loaded by another thread meanwhile
+    }
+    lru.push_front(key);
+    Entry &entry = entries[key];
+    entry.texture = texture;
+    entry.position = lru.begin();
+    byteSize += texture->getByteSize();
+    evict(budget);
+    return texture;
+  }
+
+  // Deletes unused textures, least recently used first, until at most maxBytes are cached.
+  void trim(size_t maxBytes = 0) {
+    std::lock_guard<std::mutex> lock(mutex);
+    evict(maxBytes);
+  }
+
+  void setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = bytes;
+    evict(budget);
+  }
+
+  TextureCacheStats getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    TextureCacheStats stats;
+    stats.hits = (double)hits;
+    stats.misses = (double)misses;
+    stats.evictions = (double)evictions;
+    stats.textureCount = (double)entries.size();
+    stats.byteSize = (double)byteSize;
+    stats.budget = (double)budget;
+    return stats;
+  }
+
+  void resetCounters() {
+    std::lock_guard<std::mutex> lock(mutex);
+    hits = misses = evictions = 0;
+  }
+
+private:
+  struct Entry {
+    std::shared_ptr<TextureObject> texture;
+    std::list<std::string>::iterator position;
+  };
+
+  mutable std::mutex mutex;
+  std::unordered_map<std::string, Entry> entries;
+  std::list<std::string> lru;       // most recently used first
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  size_t byteSize;
+  size_t budget;
+
+  void evict(size_t maxBytes) {
+    auto i = lru.end();
+    while (byteSize > maxBytes && i != lru.begin()) {
+      --i;
+      auto entry = entries.find(*i);
+      if (entry->second.texture.use_count() > 1) {
+        continue;     // still used by a material
+      }
+      byteSize -= entry->second.texture->getByteSize();
+      entries.erase(entry);
+      i = lru.erase(i);
+      ++evictions;
+    }
+  }
+};
+
+
+inline TextureCache& textureCache() {
+  static TextureCache cache;
+  return cache;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of worker threads for data-parallel CPU work (e.g. depth unprojection). parallelFor()
+// splits an index range into bands, runs them on the workers and the calling thread and returns
+// when all bands are done. Calls are serialized, the pool runs one job at a time.
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency())
+    : job(nullptr)
+    , jobCount(0)
+    , nextBand(0)
+    , bandCount(0)
+    , pendingBands(0)
+    , generation(0)
+    , stopping(false) {
+    // the calling thread works too
+    const size_t workerCount = threadCount > 1 ? threadCount - 1 : 0;
+    for (size_t i = 0; i < workerCount; ++i) {
+      workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &t : workers) {
+      t.join();
+    }
+  }
+
+  ThreadPool & operator =(const ThreadPool &) = delete;
+  ThreadPool(const ThreadPool &) = delete;
+
+  size_t getThreadCount() const {
+    return workers.size() + 1;
+  }
+
+  // Calls fn(begin, end) for consecutive bands covering [0, count), at least minBandSize indices
+  // per band. Exceptions thrown by fn are rethrown on the calling thread.
+  void parallelFor(size_t count, size_t minBandSize, const std::function<void(size_t, size_t)> &fn) {
+    if (count == 0) {
+      return;
+    }
+
+    const size_t maxBands = (count + std::max<size_t>(minBandSize, 1) - 1) / std::max<size_t>(minBandSize, 1);
+    const size_t bands = std::min(maxBands, getThreadCount() * 4);
+    if (bands <= 1 || workers.empty()) {
+      fn(0, count);
+      return;
+    }
+
+    std::lock_guard<std::mutex> serialize(jobMutex);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = &fn;
+      jobCount = count;
+      nextBand = 0;
+      bandCount = bands;
+      pendingBands = bands;
+      error = nullptr;
+      ++generation;
+    }
+    wake.notify_all();
+
+    runBands();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pendingBands == 0; });
+    job = nullptr;
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex jobMutex;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+
+  const std::function<void(size_t, size_t)> *job;
+  size_t jobCount;
+  size_t nextBand;
+  size_t bandCount;
+  size_t pendingBands;
+  uint64_t generation;
+  std::exception_ptr error;
+  bool stopping;
+
+  // Takes bands of the current job until none are left.
+  void runBands() {
+    for (;;) {
+      size_t band, count, bands;
+      const std::function<void(size_t, size_t)> *fn;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (job == nullptr || nextBand >= bandCount) {
+          return;
+        }
+        band = nextBand++;
+        count = jobCount;
+        bands = bandCount;
+        fn = job;
+      }
+
+      try {
+        (*fn)(band * count / bands, (band + 1) * count / bands);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--pendingBands == 0) {
+        done.notify_all();
+      }
+    }
+  }
+
+  void workerLoop() {
+    uint64_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) {
+          return;
+        }
+        seen = generation;
+      }
+      runBands();
+    }
+  }
+};
+
+
+inline ThreadPool& threadPool() {
+  static ThreadPool pool;
+  return pool;
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define XGL_UNPROJECT_AVX2 1
+#endif
+
+#include "thread_pool.h"
+
+
+enum class PointCloudFrame : int {
+  Camera = 0,     // x right, y down, z forward
+  World = 1
+};
+
+
+// Output location of unprojected points: xyz of pixel (row, col) is written to
+// data + row * rowStride + col * pointStride (strides in floats), so points can be stored
+// interleaved with other fields, e.g. directly into the points of a PCL cloud.
+struct PointOutput {
+  float *data;
+  size_t pointStride;
+  size_t rowStride;
+};
+
+
+// CPU unprojection of depth images (e.g. of real sensors) with per-column/per-row ray tables.
+// Rows are processed in bands on the thread pool, each row by an AVX2, SSE2 or scalar kernel.
+// Depth values outside (minDepth, maxDepth) and NaNs produce NaN points. Points are given in the
+// camera frame (x right, y down, z forward) or, with a transform, e.g. in the world frame.
+class DepthUnprojector {
+public:
+  DepthUnprojector()
+    : width(0), height(0)
+    , fx(0), fy(0), cx(0), cy(0) {
+  }
+
+  // Rebuilds the ray tables when intrinsics or image size changed. Rays follow the GL pixel
+  // grid of the camera: row 0 is the bottom row of the rendered image.
+  void setIntrinsics(float fx, float fy, float cx, float cy, int width, int height) {
+    if (fx == this->fx && fy == this->fy && cx == this->cx && cy == this->cy && width == this->width && height == this->height) {
+      return;
+    }
+
+    this->fx = fx; this->fy = fy;
+    this->cx = cx; this->cy = cy;
+    this->width = width; this->height = height;
+
+    rayX.resize(width);
+    for (int x = 0; x < width; ++x) {
+      rayX[x] = (x + 0.5f - cx) / fx;
+    }
+    rayY.resize(height);
+    for (int y = 0; y < height; ++y) {
+      rayY[y] = (cy - (y + 0.5f)) / fy;
+    }
+  }
+
+  // depthRowStride in floats. transform is applied to camera frame points if not null.
+  void unproject(const float *depth, size_t depthRowStride, const PointOutput &output, const glm::mat4 *transform, float minDepth, float maxDepth) const {
+    Params p;
+    p.rayX = rayX.data();
+    p.width = width;
+    p.minDepth = minDepth;
+    p.maxDepth = maxDepth;
+    p.transformed = transform != nullptr;
+    if (transform != nullptr) {
+      for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 4; ++c) {
+          p.m[r * 4 + c] = (*transform)[c][r];
+        }
+      }
+    }
+
+    const RowKernel kernel = selectKernel();
+    const size_t minBandRows = std::max<size_t>(1, 16384 / std::max(width, 1));
+    threadPool().parallelFor(height, minBandRows, [&](size_t begin, size_t end) {
+      for (size_t y = begin; y < end; ++y) {
+        kernel(depth + y * depthRowStride, rayY[y], output.data + y * output.rowStride, output.pointStride, p);
+      }
+    });
+  }
+
+private:
+  struct Params {
+    const float *rayX;
+    int width;
+    float minDepth;
+    float maxDepth;
+    bool transformed;
+    float m[12];    // row-major 3x4
+  };
+
+  typedef void (*RowKernel)(const float *depth, float rayY, float *out, size_t pointStride, const Params &p);
+
+  int width, height;
+  float fx, fy, cx, cy;
+  std::vector<float> rayX;
+  std::vector<float> rayY;
+
+  static RowKernel selectKernel() {
+#if defined(XGL_UNPROJECT_AVX2)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+      return unprojectRowAVX2;
+    }
+#endif
+#if defined(__SSE2__)
+    return unprojectRowSSE2;
+#else
+    return unprojectRowScalar;
+#endif
+  }
+
+  static void storePoint(float *out, float x, float y, float z) {
+    out[0] = x;
+    out[1] = y;
+    out[2] = z;
+  }
+
+  // Handles columns [begin, width), also the tail of the SIMD kernels.
+  static void unprojectRowScalar(const float *depth, float rayY, float *out, size_t pointStride, const Params &p, int begin) {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float *m = p.m;
+    for (int i = begin; i < p.width; ++i) {
+      float *o = out + i * pointStride;
+      const float z = depth[i];
+      if (!(z > p.minDepth && z < p.maxDepth)) {
+        storePoint(o, nan, nan, nan);
+        continue;
+      }
+
+      const float x = z * p.rayX[i];
+      const float y = z * rayY;
+      if (p.transformed) {
+        storePoint(o,
+          m[0] * x + m[1] * y + m[2] * z + m[3],
+          m[4] * x + m[5] * y + m[6] * z + m[7],
+          m[8] * x + m[9] * y + m[10] * z + m[11]);
+      } else {
+        storePoint(o, x, y, z);
+      }
+    }
+  }
+
+  static void unprojectRowScalar(const float *depth, float rayY, float *out, size_t pointStride, const Params &p) {
+    unprojectRowScalar(depth, rayY, out, pointStride, p, 0);
+  }
+
+#if defined(__SSE2__)
+  static void unprojectRowSSE2(const float *depth, float rayY, float *out, size_t pointStride, const Params &p) {
+    const __m128 nan = _mm_set1_ps(std::numeric_limits<float>::quiet_NaN());
+    const __m128 lo = _mm_set1_ps(p.minDepth);
+    const __m128 hi = _mm_set1_ps(p.maxDepth);
+    const __m128 ry = _mm_set1_ps(rayY);
+    const float *m = p.m;
+
+    alignas(16) float px[4], py[4], pz[4];
+    int i = 0;
+    for (; i + 4 <= p.width; i += 4) {
+      __m128 z = _mm_loadu_ps(depth + i);
+      const __m128 valid = _mm_and_ps(_mm_cmpgt_ps(z, lo), _mm_cmplt_ps(z, hi));   // false for NaN
+      __m128 x = _mm_mul_ps(z, _mm_loadu_ps(p.rayX + i));
+      __m128 y = _mm_mul_ps(z, ry);
+
+      if (p.transformed) {
+        const __m128 tx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0]), x), _mm_mul_ps(_mm_set1_ps(m[1]), y)), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2]), z), _mm_set1_ps(m[3])));
+        const __m128 ty = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[4]), x), _mm_mul_ps(_mm_set1_ps(m[5]), y)), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[6]), z), _mm_set1_ps(m[7])));
+        const __m128 tz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[8]), x), _mm_mul_ps(_mm_set1_ps(m[9]), y)), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[10]), z), _mm_set1_ps(m[11])));
+        x = tx; y = ty; z = tz;
+      }
+
+      _mm_store_ps(px, _mm_or_ps(_mm_and_ps(valid, x), _mm_andnot_ps(valid, nan)));
+      _mm_store_ps(py, _mm_or_ps(_mm_and_ps(valid, y), _mm_andnot_ps(valid, nan)));
+      _mm_store_ps(pz, _mm_or_ps(_mm_and_ps(valid, z), _mm_andnot_ps(valid, nan)));
+      for (int k = 0; k < 4; ++k) {
+        storePoint(out + (i + k) * pointStride, px[k], py[k], pz[k]);
+      }
+    }
+    unprojectRowScalar(depth, rayY, out, pointStride, p, i);
+  }
+#endif
+
+#if defined(XGL_UNPROJECT_AVX2)
+  __attribute__((target("avx2")))
+  static void unprojectRowAVX2(const float *depth, float rayY, float *out, size_t pointStride, const Params &p) {
+    const __m256 nan = _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN());
+    const __m256 lo = _mm256_set1_ps(p.minDepth);
+    const __m256 hi = _mm256_set1_ps(p.maxDepth);
+    const __m256 ry = _mm256_set1_ps(rayY);
+    const float *m = p.m;
+
+    alignas(32) float px[8], py[8], pz[8];
+    int i = 0;
+    for (; i + 8 <= p.width; i += 8) {
+      __m256 z = _mm256_loadu_ps(depth + i);
+      const __m256 valid = _mm256_and_ps(_mm256_cmp_ps(z, lo, _CMP_GT_OQ), _mm256_cmp_ps(z, hi, _CMP_LT_OQ));
+      __m256 x = _mm256_mul_ps(z, _mm256_loadu_ps(p.rayX + i));
+      __m256 y = _mm256_mul_ps(z, ry);
+
+      if (p.transformed) {
+        const __m256 tx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0]), x), _mm256_mul_ps(_mm256_set1_ps(m[1]), y)), _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[2]), z), _mm256_set1_ps(m[3])));
+        const __m256 ty = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[4]), x), _mm256_mul_ps(_mm256_set1_ps(m[5]), y)), _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[6]), z), _mm256_set1_ps(m[7])));
+        const __m256 tz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[8]), x), _mm256_mul_ps(_mm256_set1_ps(m[9]), y)), _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[10]), z), _mm256_set1_ps(m[11])));
+        x = tx; y = ty; z = tz;
+      }
+
+      _mm256_store_ps(px, _mm256_blendv_ps(nan, x, valid));
+      _mm256_store_ps(py, _mm256_blendv_ps(nan, y, valid));
+      _mm256_store_ps(pz, _mm256_blendv_ps(nan, z, valid));
+      for (int k = 0; k < 8; ++k) {
+        storePoint(out + (i + k) * pointStride, px[k], py[k], pz[k]);
+      }
+    }
+    unprojectRowScalar(depth, rayY, out, pointStride, p, i);
+  }
+#endif
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+
+template<typename T>
+void flipVInplace(T *image, int width, int height, int channels) {
+    // flip vertical axis
+  const int line_size = width * channels;
+  T tmp[line_size];
+  for (int y=0; y<height/2; ++y) {
+    T *src = image + (y * line_size);
+    T *dst = image + ((height-y-1) * line_size);
+    memcpy(tmp, src, line_size * sizeof(T));
+    memcpy(src, dst, line_size * sizeof(T));
+    memcpy(dst, tmp, line_size * sizeof(T));
+  }
+}
+
+
+template<typename ... Args>
+std::string string_format(const std::string& format, Args ... args) {
+  size_t size = snprintf(nullptr, 0, format.c_str(), args ...) + 1; // Extra space for '\0'
+  std::unique_ptr<char[]> buf(new char[size]);
+  std::snprintf(buf.get(), size, format.c_str(), args ...);
+  return std::string(buf.get(), buf.get() + size - 1); // We don't want the '\0' inside
+}
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+
+struct Vertex {
+  glm::vec3 Position;
+  glm::vec3 Normal;
+  glm::vec2 TexCoords;
+  glm::vec4 Color;
+};
+
+static_assert(sizeof(Vertex) == 12 * sizeof(float), "Vertex must be tightly packed");
+
+
+// Read-only view of vertex rows in the tensor format: position (3), normal (3), texture
+// coordinates (2) and color (4) floats. Rows may have fewer columns (3, 6 or 8) and may be
+// strided, e.g. a column-narrowed tensor.
+struct VertexSource {
+  const float *data;
+  size_t count;
+  size_t columns;
+  size_t rowStride;     // in floats
+
+  VertexSource(const float *data, size_t count, size_t columns, size_t rowStride)
+    : data(data), count(count), columns(columns), rowStride(rowStride) {
+  }
+
+  explicit VertexSource(const std::vector<Vertex> &vertices)
+    : data(reinterpret_cast<const float *>(vertices.data())), count(vertices.size()), columns(12), rowStride(12) {
+  }
+
+  const float *row(size_t i) const { return data + i * rowStride; }
+
+  bool hasNormal() const { return columns >= 6; }
+  bool hasTexCoords() const { return columns >= 8; }
+  bool hasColor() const { return columns >= 12; }
+
+  Vertex get(size_t i) const {
+    const float *r = row(i);
+    Vertex v;
+    v.Position = glm::vec3(r[0], r[1], r[2]);
+    v.Normal = hasNormal() ? glm::vec3(r[3], r[4], r[5]) : glm::vec3(0, 0, 0);
+    v.TexCoords = hasTexCoords() ? glm::vec2(r[6], r[7]) : glm::vec2(0, 0);
+    v.Color = hasColor() ? glm::vec4(r[8], r[9], r[10], r[11]) : glm::vec4(0, 0, 0, 0);
+    return v;
+  }
+};
+
+
+// GPU storage of an optional vertex attribute. Packed encodings are decoded by the vertex fetch
+// hardware, shaders see the same vec3/vec2/vec4 inputs:
+//   normal:    GL_INT_2_10_10_10_REV (signed normalized, 4 bytes)
+//   texCoords: GL_HALF_FLOAT (4 bytes)
+//   color:     GL_UNSIGNED_BYTE RGBA (normalized, 4 bytes)
+enum class AttributeEncoding : uint8_t {
+  None,
+  Float,
+  Packed
+};
+
+
+enum class VertexPrecision {
+  Compact,      // packed encodings for normals, texture coordinates and colors
+  Full          // 32 bit floats for all attributes
+};
+
+
+// Interleaved vertex buffer layout. Positions are always stored as 3 floats, absent attributes
+// are not stored at all and read their generic default value (see setDefaultAttributeValues()).
+class VertexLayout {
+public:
+  VertexLayout(
+    AttributeEncoding normal = AttributeEncoding::Float,
+    AttributeEncoding texCoords = AttributeEncoding::Float,
+    AttributeEncoding color = AttributeEncoding::Float
+  )
+    : normal(normal)
+    , texCoords(texCoords)
+    , color(color) {
+  }
+
+  // Compact layouts store only the attributes that are non-zero for at least one vertex, full
+  // layouts store all attributes present in the source so that it can be uploaded unchanged.
+  static VertexLayout detect(const VertexSource &source, VertexPrecision precision) {
+    if (precision == VertexPrecision::Full) {
+      return VertexLayout(
+        source.hasNormal() ? AttributeEncoding::Float : AttributeEncoding::None,
+        source.hasTexCoords() ? AttributeEncoding::Float : AttributeEncoding::None,
+        source.hasColor() ? AttributeEncoding::Float : AttributeEncoding::None
+      );
+    }
+
+    bool hasNormal = false, hasTexCoords = false, hasColor = false;
+    for (size_t i = 0; i < source.count && !(hasNormal && hasTexCoords && hasColor); ++i) {
+      const float *r = source.row(i);
+      hasNormal = hasNormal || (source.hasNormal() && (r[3] != 0 || r[4] != 0 || r[5] != 0));
+      hasTexCoords = hasTexCoords || (source.hasTexCoords() && (r[6] != 0 || r[7] != 0));
+      hasColor = hasColor || (source.hasColor() && (r[8] != 0 || r[9] != 0 || r[10] != 0 || r[11] != 0));
+    }
+
+    return VertexLayout(
+      hasNormal ? AttributeEncoding::Packed : AttributeEncoding::None,
+      hasTexCoords ? AttributeEncoding::Packed : AttributeEncoding::None,
+      hasColor ? AttributeEncoding::Packed : AttributeEncoding::None
+    );
+  }
+
+  // True if the source rows are byte-identical to the buffer representation of this layout.
+  bool matches(const VertexSource &source) const {
+    const bool floatsOnly = normal != AttributeEncoding::Packed && texCoords != AttributeEncoding::Packed && color != AttributeEncoding::Packed;
+    return floatsOnly && source.rowStride == source.columns && (size_t)getStride() == source.columns * sizeof(float)
+      && (normal != AttributeEncoding::None) == source.hasNormal()
+      && (texCoords != AttributeEncoding::None) == source.hasTexCoords()
+      && (color != AttributeEncoding::None) == source.hasColor();
+  }
+
+  AttributeEncoding getNormalEncoding() const { return normal; }
+  AttributeEncoding getTexCoordsEncoding() const { return texCoords; }
+  AttributeEncoding getColorEncoding() const { return color; }
+
+  GLsizei getStride() const {
+    return getColorOffset() + attributeSize(color, 4);
+  }
+
+  // Writes the interleaved buffer representation of source to dst (count * stride bytes).
+  void pack(const VertexSource &source, uint8_t *dst) const {
+    const size_t stride = getStride();
+    for (size_t i = 0; i < source.count; ++i, dst += stride) {
+      const Vertex v = source.get(i);
+      memcpy(dst, &v.Position, sizeof(glm::vec3));
+      writeNormal(dst + getNormalOffset(), v.Normal);
+      writeTexCoords(dst + getTexCoordsOffset(), v.TexCoords);
+      writeColor(dst + getColorOffset(), v.Color);
+    }
+  }
+
+  // Decodes count vertices from their buffer representation, absent attributes are zero.
+  void unpack(const uint8_t *src, size_t count, std::vector<Vertex> &output) const {
+    const size_t stride = getStride();
+    output.resize(count);
+    for (size_t i = 0; i < count; ++i, src += stride) {
+      Vertex &v = output[i];
+      memcpy(&v.Position, src, sizeof(glm::vec3));
+      v.Normal = readNormal(src + getNormalOffset());
+      v.TexCoords = readTexCoords(src + getTexCoordsOffset());
+      v.Color = readColor(src + getColorOffset());
+    }
+  }
+
+  // Declares the vertex attributes 0-3 for the buffer currently bound to GL_ARRAY_BUFFER.
+  void setupAttributes() const {
+    const GLsizei stride = getStride();
+
+    // Vertex Positions
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)nullptr);
+
+    // Vertex Normals
+    setupAttribute(1, normal, 3, GL_FLOAT, GL_INT_2_10_10_10_REV, stride, getNormalOffset());
+
+    // Vertex Texture Coords
+    setupAttribute(2, texCoords, 2, GL_FLOAT, GL_HALF_FLOAT, stride, getTexCoordsOffset());
+
+    // Vertex Color
+    setupAttribute(3, color, 4, GL_FLOAT, GL_UNSIGNED_BYTE, stride, getColorOffset());
+  }
+
+  // Bit mask of the attribute locations setupAttributes enables an array for.
+  uint32_t getArrayAttributes() const {
+    return 1u
+      | (normal != AttributeEncoding::None ? 1u << 1 : 0)
+      | (texCoords != AttributeEncoding::None ? 1u << 2 : 0)
+      | (color != AttributeEncoding::None ? 1u << 3 : 0);
+  }
+
+  // Generic values of absent attributes, the state cache restores them before draws that read
+  // them. A transparent color lets the default shader use the material color.
+  static void setDefaultAttributeValues() {
+    glState().setDefaultAttribute(1, 0, 0, 1, 0);
+    glState().setDefaultAttribute(2, 0, 0, 0, 0);
+    glState().setDefaultAttribute(3, 0, 0, 0, 0);
+  }
+
+  static uint16_t floatToHalf(float value) {
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+
+    const uint32_t sign = (f >> 16) & 0x8000;
+    const int32_t exponent = (int32_t)((f >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = f & 0x7fffff;
+
+    if (((f >> 23) & 0xff) == 0xff) {       // inf or nan
+      return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+    }
+    if (exponent >= 31) {                     // overflow, clamp to inf
+      return sign | 0x7c00;
+    }
+    if (exponent <= 0) {                      // denormal or zero
+      if (exponent < -10) {
+        return sign;
+      }
+      mantissa |= 0x800000;
+      const uint32_t shift = 14 - exponent;
+      uint32_t half = mantissa >> shift;
+      if ((mantissa >> (shift - 1)) & 1) {    // round half up
+        ++half;
+      }
+      return sign | half;
+    }
+
+    uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000) {                  // round half up, may carry into the exponent
+      ++half;
+    }
+    return half;
+  }
+
+  static float halfToFloat(uint16_t half) {
+    const float sign = (half & 0x8000) ? -1.0f : 1.0f;
+    const int exponent = (half >> 10) & 0x1f;
+    const int mantissa = half & 0x3ff;
+
+    if (exponent == 0) {
+      return sign * std::ldexp((float)mantissa, -24);
+    }
+    if (exponent == 31) {
+      return mantissa != 0 ? NAN : sign * INFINITY;
+    }
+    return sign * std::ldexp((float)(mantissa | 0x400), exponent - 25);
+  }
+
+private:
+  AttributeEncoding normal;
+  AttributeEncoding texCoords;
+  AttributeEncoding color;
+
+  static GLsizei attributeSize(AttributeEncoding encoding, int components) {
+    switch (encoding) {
+      case AttributeEncoding::Float: return components * sizeof(float);
+      case AttributeEncoding::Packed: return 4;
+      default: return 0;
+    }
+  }
+
+  GLsizei getNormalOffset() const { return sizeof(glm::vec3); }
+  GLsizei getTexCoordsOffset() const { return getNormalOffset() + attributeSize(normal, 3); }
+  GLsizei getColorOffset() const { return getTexCoordsOffset() + attributeSize(texCoords, 2); }
+
+  static void setupAttribute(GLuint location, AttributeEncoding encoding, GLint components, GLenum floatType, GLenum packedType, GLsizei stride, GLsizei offset) {
+    if (encoding == AttributeEncoding::None) {
+      glDisableVertexAttribArray(location);
+      return;
+    }
+
+    glEnableVertexAttribArray(location);
+    if (encoding == AttributeEncoding::Float) {
+      glVertexAttribPointer(location, components, floatType, GL_FALSE, stride, (GLvoid*)(size_t)offset);
+    } else if (packedType == GL_HALF_FLOAT) {
+      glVertexAttribPointer(location, components, packedType, GL_FALSE, stride, (GLvoid*)(size_t)offset);
+    } else {
+      glVertexAttribPointer(location, 4, packedType, GL_TRUE, stride, (GLvoid*)(size_t)offset);
+    }
+  }
+
+  static int32_t snorm10(float value) {
+    value = std::max(-1.0f, std::min(1.0f, value));
+    return (int32_t)std::round(value * 511.0f) & 0x3ff;
+  }
+
+  static float fromSnorm10(uint32_t bits) {
+    int32_t value = (int32_t)(bits << 22) >> 22;    // sign extend
+    return std::max(-1.0f, value / 511.0f);
+  }
+
+  static uint8_t unorm8(float value) {
+    value = std::max(0.0f, std::min(1.0f, value));
+    return (uint8_t)std::round(value * 255.0f);
+  }
+
+  void writeNormal(uint8_t *dst, const glm::vec3 &n) const {
+    if (normal == AttributeEncoding::Float) {
+      memcpy(dst, &n, sizeof(glm::vec3));
+    } else if (normal == AttributeEncoding::Packed) {
+      const uint32_t packed = snorm10(n.x) | (snorm10(n.y) << 10) | (snorm10(n.z) << 20);
+      memcpy(dst, &packed, sizeof(packed));
+    }
+  }
+
+  void writeTexCoords(uint8_t *dst, const glm::vec2 &uv) const {
+    if (texCoords == AttributeEncoding::Float) {
+      memcpy(dst, &uv, sizeof(glm::vec2));
+    } else if (texCoords == AttributeEncoding::Packed) {
+      const uint16_t packed[2] = { floatToHalf(uv.x), floatToHalf(uv.y) };
+      memcpy(dst, packed, sizeof(packed));
+    }
+  }
+
+  void writeColor(uint8_t *dst, const glm::vec4 &c) const {
+    if (color == AttributeEncoding::Float) {
+      memcpy(dst, &c, sizeof(glm::vec4));
+    } else if (color == AttributeEncoding::Packed) {
+      const uint8_t packed[4] = { unorm8(c.x), unorm8(c.y), unorm8(c.z), unorm8(c.w) };
+      memcpy(dst, packed, sizeof(packed));
+    }
+  }
+
+  glm::vec3 readNormal(const uint8_t *src) const {
+    glm::vec3 n(0, 0, 0);
+    if (normal == AttributeEncoding::Float) {
+      memcpy(&n, src, sizeof(glm::vec3));
+    } else if (normal == AttributeEncoding::Packed) {
+      uint32_t packed;
+      memcpy(&packed, src, sizeof(packed));
+      n = glm::vec3(fromSnorm10(packed), fromSnorm10(packed >> 10), fromSnorm10(packed >> 20));
+    }
+    return n;
+  }
+
+  glm::vec2 readTexCoords(const uint8_t *src) const {
+    glm::vec2 uv(0, 0);
+    if (texCoords == AttributeEncoding::Float) {
+      memcpy(&uv, src, sizeof(glm::vec2));
+    } else if (texCoords == AttributeEncoding::Packed) {
+      uint16_t packed[2];
+      memcpy(packed, src, sizeof(packed));
+      uv = glm::vec2(halfToFloat(packed[0]), halfToFloat(packed[1]));
+    }
+    return uv;
+  }
+
+  glm::vec4 readColor(const uint8_t *src) const {
+    glm::vec4 c(0, 0, 0, 0);
+    if (color == AttributeEncoding::Float) {
+      memcpy(&c, src, sizeof(glm::vec4));
+    } else if (color == AttributeEncoding::Packed) {
+      c = glm::vec4(src[0], src[1], src[2], src[3]) / 255.0f;
+    }
+    return c;
+  }
+};
@@ -1,6 +1,3 @@
-// TODO:
-// - Check if EGL allows simple off-screen rendering without window, e.g. see https://devblogs.nvidia.com/parallelforall/egl-eye-opengl-visualization-without-x-server/
-
 #include "xamla-gl.h"
 
 #include <memory>
@@ -22,10 +19,17 @@
 // GLFW
 #include <GLFW/glfw3.h>
 
+#include "utils.h"
+#include "context.h"
+#include "gl_state.h"
+#include "revision.h"
 #include "tensor_conversion.h"
 #include "camera.h"
 #include "shader.h"
 #include "model.h"
+#include "instanced_model.h"
+#include "point_cloud.h"
+#include "async_loader.h"
 //#include "axis.h"
 
 #include "simple_scene.h"
@@ -34,58 +38,29 @@
 typedef std::shared_ptr<Material> MaterialHandle;
 typedef std::shared_ptr<Mesh> MeshHandle;
 typedef std::shared_ptr<Shader> ShaderHandle;
+typedef std::shared_ptr<ModelLoad> ModelLoadHandle;
 
 
-GLFWwindow *xgl_window = nullptr;
-bool xgl_window_visible = false;
-
-
-template<typename T>
-void flipVInplace(T *image, int width, int height, int channels) {
-    // flip vertical axis
-  const int line_size = width * channels;
-  T tmp[line_size];
-  for (int y=0; y<height/2; ++y) {
-    T *src = image + (y * line_size);
-    T *dst = image + ((height-y-1) * line_size);
-    memcpy(tmp, src, line_size * sizeof(T));
-    memcpy(src, dst, line_size * sizeof(T));
-    memcpy(dst, tmp, line_size * sizeof(T));
-  }
-}
-
-
-template<typename ... Args>
-std::string string_format(const std::string& format, Args ... args) {
-  size_t size = snprintf(nullptr, 0, format.c_str(), args ...) + 1; // Extra space for '\0'
-  std::unique_ptr<char[]> buf(new char[size]);
-  std::snprintf(buf.get(), size, format.c_str(), args ...);
-  return std::string(buf.get(), buf.get() + size - 1); // We don't want the '\0' inside
-}
+std::unique_ptr<RenderContext> xgl_context;
 
 
-XGLIMP(void, _, init)(bool show_window, int window_width, int window_height) {
-  glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-  if (!show_window) {
-    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
-  }
-  xgl_window_visible = show_window;
-  glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-
+XGLIMP(void, _, init)(bool show_window, int window_width, int window_height, const char *backend) {
   if (window_width <= 0) {
     window_width = 1;
   }
   if (window_height <= 0) {
-    window_width = 1;
+    window_height = 1;
   }
-  xgl_window = glfwCreateWindow(window_width, window_height, "xgl_dummy_window", nullptr, nullptr);
-  glfwMakeContextCurrent(xgl_window);
+
+  xgl_context = createRenderContext(backend != nullptr ? backend : "auto", show_window, window_width, window_height);
+  printf("Context backend: %s\n", xgl_context->getName());
 
   glewExperimental = GL_TRUE;
-  glewInit();
+  GLenum glewStatus = glewInit();
+  if (glewStatus != GLEW_OK && glewStatus != GLEW_ERROR_NO_GLX_DISPLAY) {   // GLX is not needed for EGL contexts
+    throw XglException(string_format("GLEW initialization failed: %s", (const char *)glewGetErrorString(glewStatus)));
+  }
+  glGetError();   // clear error flag potentially left by glewInit
 
   // dump extension list
   /*printf("Extensions:");
@@ -102,19 +77,123 @@ XGLIMP(void, _, init)(bool show_window, int window_width, int window_height) {
   GLint samples = 0;
   glGetIntegerv(GL_MAX_SAMPLES_EXT, &samples);    //We need to find out what the maximum supported samples is
   printf("Supported multi-sampling: %d\n", samples);
+
+  VertexLayout::setDefaultAttributeValues();
+  InstancedModel::setDefaultInstanceAttributes();
 }
 
 XGLIMP(void, _, terminate)() {
-  glfwDestroyWindow(xgl_window);
-  glfwTerminate();
+  renderTargetPool().trim(0);
+  textureCache().trim(0);
+  xgl_context.reset();
+}
+
+// Bytes held by render target surfaces that are currently not used by any camera.
+XGLIMP(double, _, getRenderTargetPoolSize)() {
+  return (double)renderTargetPool().getFreeBytes();
+}
+
+// Deletes unused render target surfaces until at most maxBytes are kept.
+XGLIMP(void, _, trimRenderTargetPool)(double maxBytes) {
+  if (maxBytes < 0) {
+    throw XglException("Pool size must not be negative.");
+  }
+  renderTargetPool().trim((size_t)maxBytes);
+}
+
+XGLIMP(void, _, setRenderTargetPoolBudget)(double bytes) {
+  if (bytes < 0) {
+    throw XglException("Pool budget must not be negative.");
+  }
+  renderTargetPool().setBudget((size_t)bytes);
+}
+
+XGLIMP(void, _, getTextureCacheStats)(TextureCacheStats *stats) {
+  *stats = textureCache().getStats();
+}
+
+XGLIMP(void, _, resetTextureCacheCounters)() {
+  textureCache().resetCounters();
+}
+
+// Deletes textures no material uses anymore until at most maxBytes are cached.
+XGLIMP(void, _, trimTextureCache)(double maxBytes) {
+  if (maxBytes < 0) {
+    throw XglException("Cache size must not be negative.");
+  }
+  textureCache().trim((size_t)maxBytes);
+}
+
+XGLIMP(void, _, setTextureCacheBudget)(double bytes) {
+  if (bytes < 0) {
+    throw XglException("Cache budget must not be negative.");
+  }
+  textureCache().setBudget((size_t)bytes);
+}
+
+// Directory of the mesh cache used by Model::loadModel, an empty path disables the cache.
+XGLIMP(void, _, setMeshCacheDirectory)(const char *path) {
+  meshCache().setDirectory(path != nullptr ? path : "");
+}
+
+XGLIMP(const char *, _, getMeshCacheDirectory)() {
+  return meshCache().getDirectory().c_str();
+}
+
+// Levels of detail generated by Model::loadModel for meshes with at least minTriangles triangles.
+XGLIMP(void, _, setImportLodOptions)(int levelCount, int minTriangles) {
+  if (levelCount < 0 || minTriangles < 0) {
+    throw XglException("Invalid level of detail options.");
+  }
+  importLodOptions().levelCount = (uint32_t)levelCount;
+  importLodOptions().minTriangles = (uint32_t)minTriangles;
+}
+
+XGLIMP(void, _, getImportLodOptions)(int *levelCount, int *minTriangles) {
+  *levelCount = (int)importLodOptions().levelCount;
+  *minTriangles = (int)importLodOptions().minTriangles;
+}
+
+// Welding and reordering of the meshes imported by Model::loadModel, positions within
+// weldTolerance and normals at most weldNormalAngle degrees apart are merged.
+XGLIMP(void, _, setImportOptimization)(bool enabled, float weldTolerance, float weldNormalAngle = 0) {
+  if (!(weldTolerance >= 0) || std::isinf(weldTolerance)) {
+    throw XglException("Weld tolerance must be finite and not negative.");
+  }
+  if (!(weldNormalAngle >= 0 && weldNormalAngle <= 180)) {
+    throw XglException("Weld normal angle must be between 0 and 180 degrees.");
+  }
+  importOptimizeOptions().enabled = enabled ? 1 : 0;
+  importOptimizeOptions().weldTolerance = weldTolerance;
+  importOptimizeOptions().weldNormalAngle = weldNormalAngle;
+}
+
+XGLIMP(void, _, getImportOptimization)(bool *enabled, float *weldTolerance, float *weldNormalAngle) {
+  *enabled = importOptimizeOptions().enabled != 0;
+  *weldTolerance = importOptimizeOptions().weldTolerance;
+  *weldNormalAngle = importOptimizeOptions().weldNormalAngle;
+}
+
+XGLIMP(void, _, getImportOptimizeStats)(ImportOptimizeStats *stats) {
+  *stats = importOptimizeCounters().getStats();
+}
+
+XGLIMP(void, _, resetImportOptimizeStats)() {
+  importOptimizeCounters().reset();
+}
+
+XGLIMP(const char *, _, getBackend)() {
+  return xgl_context ? xgl_context->getName() : "";
 }
 
 XGLIMP(void, _, pollEvents)() {
-  glfwPollEvents();
+  if (xgl_context) {
+    xgl_context->pollEvents();
+  }
 }
 
 XGLIMP(bool, _, windowShouldClose)() {
-  return glfwWindowShouldClose(xgl_window) != 0;
+  return xgl_context && xgl_context->windowShouldClose();
 }
 
 
@@ -134,6 +213,34 @@ XGLIMP(void, Camera, setImageSize)(Camera *camera, int width, int height) {
   camera->setImageSize(width, height);
 }
 
+XGLIMP(void, Camera, setMultiSampleCount)(Camera *camera, int samples) {
+  camera->setMultiSampleCount(samples);
+}
+
+XGLIMP(int, Camera, getMultiSampleCount)(Camera *camera) {
+  return camera->getMultiSampleCount();
+}
+
+XGLIMP(void, Camera, setFxaaEnabled)(Camera *camera, bool enabled) {
+  camera->setFxaaEnabled(enabled);
+}
+
+XGLIMP(bool, Camera, isFxaaEnabled)(Camera *camera) {
+  return camera->isFxaaEnabled();
+}
+
+XGLIMP(void, Camera, createRenderTarget)(Camera *camera) {
+  camera->createRenderTarget();
+}
+
+XGLIMP(void, Camera, releaseRenderTargets)(Camera *camera) {
+  camera->releaseRenderTargets();
+}
+
+XGLIMP(double, Camera, getGpuMemorySize)(Camera *camera) {
+  return (double)camera->getGpuMemorySize();
+}
+
 XGLIMP(void, Camera, getClipNearFar)(Camera *camera, THDoubleTensor *output) {
   vec2ToTensor(camera->getClipNearFar(), output);
 }
@@ -164,7 +271,9 @@ XGLIMP(void, Camera, copyRenderResult)(Camera *camera, bool vflip, THByteTensor
   THByteTensor* output_ = THByteTensor_newContiguous(output);
   camera->copyToNormalFrameBuffer();
   uint8_t *data = THByteTensor_data(output_);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);    // tightly packed rows, width * 3 is not necessarily a multiple of 4
   glReadPixels(0, 0, sz[0], sz[1], GL_RGB, GL_UNSIGNED_BYTE, data);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
   if (vflip) {
     flipVInplace(data, sz[0], sz[1], 3);
   }
@@ -183,6 +292,57 @@ XGLIMP(void, Camera, copyRenderResultF32)(Camera *camera, bool vflip, THFloatTen
   THFloatTensor_freeCopyTo(output_, output);
 }
 
+XGLIMP(int, Camera, beginReadback)(Camera *camera, int format) {
+  return camera->beginReadback(static_cast<ReadbackFormat>(format));
+}
+
+XGLIMP(bool, Camera, isReadbackReady)(Camera *camera, int ticket) {
+  return camera->getReadbackRing().isReady(ticket);
+}
+
+XGLIMP(bool, Camera, waitReadback)(Camera *camera, int ticket, double timeout) {
+  return camera->getReadbackRing().wait(ticket, timeout);
+}
+
+XGLIMP(int, Camera, getReadbackFormat)(Camera *camera, int ticket) {
+  return static_cast<int>(camera->getReadbackRing().getFormat(ticket));
+}
+
+XGLIMP(void, Camera, collectReadback)(Camera *camera, int ticket, bool vflip, THByteTensor *output) {
+  PixelPackRing &ring = camera->getReadbackRing();
+  if (ring.getFormat(ticket) != ReadbackFormat::RGB8) {
+    throw XglException("Readback format mismatch, RGB8 readback expected.");
+  }
+  auto sz = ring.getImageSize(ticket);
+  THByteTensor_resize3d(output, sz[1], sz[0], 3);
+  THByteTensor* output_ = THByteTensor_newContiguous(output);
+  ring.collect(ticket, THByteTensor_data(output_), vflip);
+  THByteTensor_freeCopyTo(output_, output);
+}
+
+XGLIMP(void, Camera, collectReadbackF32)(Camera *camera, int ticket, bool vflip, THFloatTensor *output) {
+  PixelPackRing &ring = camera->getReadbackRing();
+  if (ring.getFormat(ticket) != ReadbackFormat::F32) {
+    throw XglException("Readback format mismatch, F32 readback expected.");
+  }
+  auto sz = ring.getImageSize(ticket);
+  THFloatTensor_resize2d(output, sz[1], sz[0]);
+  THFloatTensor* output_ = THFloatTensor_newContiguous(output);
+  ring.collect(ticket, THFloatTensor_data(output_), vflip);
+  THFloatTensor_freeCopyTo(output_, output);
+}
+
+XGLIMP(void, Camera, cancelReadback)(Camera *camera, int ticket) {
+  camera->getReadbackRing().cancel(ticket);
+}
+
+XGLIMP(void, Camera, setReadbackRingSize)(Camera *camera, int size) {
+  if (size < 0) {
+    throw XglException("Readback ring size must not be negative.");
+  }
+  camera->getReadbackRing().setSize((size_t)size);
+}
+
 XGLIMP(void, Camera, unprojectDepthImage)(Camera *camera, THFloatTensor *depthInput, THFloatTensor *xyzOutput, int outputStride) {
   THFloatTensor* input_ = THFloatTensor_newContiguous(depthInput);
   THFloatTensor* output_ = THFloatTensor_newContiguous(xyzOutput);
@@ -192,14 +352,144 @@ XGLIMP(void, Camera, unprojectDepthImage)(Camera *camera, THFloatTensor *depthIn
   THFloatTensor_freeCopyTo(output_, xyzOutput);
 }
 
+// Unprojects a HxW depth image into xyz (HxWxC tensor with C >= 3, resized to HxWx3 if it does
+// not fit). Points are written through the output strides, so xyz may be a view into the fields
+// of a larger point structure.
+XGLIMP(void, Camera, unprojectDepthImageStrided)(Camera *camera, THFloatTensor *depth, THFloatTensor *xyz, int frame, float minDepth, float maxDepth) {
+  auto sz = camera->getImageSize();
+  if (depth == NULL || depth->nDimension != 2 || depth->size[0] != sz[1] || depth->size[1] != sz[0]) {
+    throw XglException("Depth image size does not match the camera image size.");
+  }
+  if (xyz->nDimension != 3 || xyz->size[0] != sz[1] || xyz->size[1] != sz[0] || xyz->size[2] < 3 || xyz->stride[2] != 1) {
+    THFloatTensor_resize3d(xyz, sz[1], sz[0], 3);
+  }
+
+  THFloatTensor *depthCopy = depth->stride[1] == 1 ? nullptr : THFloatTensor_newContiguous(depth);
+  if (depthCopy != nullptr) {
+    depth = depthCopy;
+  }
+
+  PointOutput output = { THFloatTensor_data(xyz), (size_t)xyz->stride[1], (size_t)xyz->stride[0] };
+  try {
+    camera->unprojectDepthImage(THFloatTensor_data(depth), depth->stride[0], output, static_cast<PointCloudFrame>(frame), minDepth, maxDepth);
+  }
+  catch (...) {
+    if (depthCopy != nullptr) {
+      THFloatTensor_free(depthCopy);
+    }
+    throw;
+  }
+
+  if (depthCopy != nullptr) {
+    THFloatTensor_free(depthCopy);
+  }
+}
+
+// Rays (Nx6: origin, unit direction in world coordinates) through pixel positions (Nx2).
+XGLIMP(void, Camera, getPixelRays)(Camera *camera, THFloatTensor *pixels, bool vflip, THFloatTensor *rays) {
+  if (pixels == NULL || pixels->nDimension != 2 || pixels->size[1] != 2) {
+    throw XglException("Pixel positions must be a Nx2 tensor.");
+  }
+  THFloatTensor *pixels_ = THFloatTensor_newContiguous(pixels);
+  const long count = pixels_->size[0];
+  THFloatTensor_resize2d(rays, count, 6);
+  THFloatTensor *rays_ = THFloatTensor_newContiguous(rays);
+  const float *p = THFloatTensor_data(pixels_);
+  float *r = THFloatTensor_data(rays_);
+  for (long i = 0; i < count; ++i) {
+    const Ray ray = camera->getPixelRay(glm::vec2(p[i * 2], p[i * 2 + 1]), vflip);
+    std::copy(glm::value_ptr(ray.origin), glm::value_ptr(ray.origin) + 3, r + i * 6);
+    std::copy(glm::value_ptr(ray.direction), glm::value_ptr(ray.direction) + 3, r + i * 6 + 3);
+  }
+  THFloatTensor_free(pixels_);
+  THFloatTensor_freeCopyTo(rays_, rays);
+}
+
+XGLIMP(void, Camera, copyGBuffer)(Camera *camera, bool vflip, THByteTensor *output) {
+  auto sz = camera->getImageSize();
+  THByteTensor_resize3d(output, sz[1], sz[0], 3);
+  THByteTensor* output_ = THByteTensor_newContiguous(output);
+  camera->copyGBuffer(GBufferComponent::Color, THByteTensor_data(output_), vflip);
+  THByteTensor_freeCopyTo(output_, output);
+}
+
+// component: GBufferComponent::Depth (HxW) or Normal (HxWx3)
+XGLIMP(void, Camera, copyGBufferF32)(Camera *camera, int component, bool vflip, THFloatTensor *output) {
+  auto sz = camera->getImageSize();
+  const GBufferComponent c = static_cast<GBufferComponent>(component);
+  if (c == GBufferComponent::Depth) {
+    THFloatTensor_resize2d(output, sz[1], sz[0]);
+  } else if (c == GBufferComponent::Normal) {
+    THFloatTensor_resize3d(output, sz[1], sz[0], 3);
+  } else {
+    throw XglException("G-buffer component is not a float image.");
+  }
+  THFloatTensor* output_ = THFloatTensor_newContiguous(output);
+  camera->copyGBuffer(c, THFloatTensor_data(output_), vflip);
+  THFloatTensor_freeCopyTo(output_, output);
+}
+
+// HxWx2: model id and mesh index + 1, 0 where nothing was drawn.
+XGLIMP(void, Camera, copyGBufferIds)(Camera *camera, bool vflip, THIntTensor *output) {
+  auto sz = camera->getImageSize();
+  THIntTensor_resize3d(output, sz[1], sz[0], 2);
+  THIntTensor* output_ = THIntTensor_newContiguous(output);
+  camera->copyGBuffer(GBufferComponent::Id, THIntTensor_data(output_), vflip);
+  THIntTensor_freeCopyTo(output_, output);
+}
+
+// Unprojects the last depth render on the GPU, output receives HxWx3 (xyz) or HxWx4 (xyz + PCL rgba).
+XGLIMP(void, Camera, copyPointCloud)(Camera *camera, int frame, bool withColor, bool vflip, THFloatTensor *output) {
+  pointCloudPass().render(*camera, static_cast<PointCloudFrame>(frame), withColor);
+
+  auto sz = camera->getImageSize();
+  const int channels = withColor ? 4 : 3;
+  THFloatTensor_resize3d(output, sz[1], sz[0], channels);
+  THFloatTensor* output_ = THFloatTensor_newContiguous(output);
+  float *data = THFloatTensor_data(output_);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, sz[0], sz[1], withColor ? GL_RGBA : GL_RGB, GL_FLOAT, data);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  if (vflip) {
+    flipVInplace(data, sz[0], sz[1], channels);
+  }
+  THFloatTensor_freeCopyTo(output_, output);
+}
+
+XGLIMP(void, Camera, copyBatchResult)(Camera *camera, bool vflip, THByteTensor *output) {
+  if (camera->getBatchType() == RenderTargetType::Depth) {
+    throw XglException("Last batch contains depth images, use copyBatchResultF32.");
+  }
+  auto sz = camera->getImageSize();
+  THByteTensor_resize4d(output, camera->getBatchLayerCount(), sz[1], sz[0], 3);
+  THByteTensor* output_ = THByteTensor_newContiguous(output);
+  camera->copyBatchResult(THByteTensor_data(output_), vflip);
+  THByteTensor_freeCopyTo(output_, output);
+}
+
+XGLIMP(void, Camera, copyBatchResultF32)(Camera *camera, bool vflip, THFloatTensor *output) {
+  if (camera->getBatchType() != RenderTargetType::Depth) {
+    throw XglException("Last batch contains color images, use copyBatchResult.");
+  }
+  auto sz = camera->getImageSize();
+  THFloatTensor_resize3d(output, camera->getBatchLayerCount(), sz[1], sz[0]);
+  THFloatTensor* output_ = THFloatTensor_newContiguous(output);
+  camera->copyBatchResult(THFloatTensor_data(output_), vflip);
+  THFloatTensor_freeCopyTo(output_, output);
+}
+
 XGLIMP(void, Camera, swapBuffers)(Camera *camera) {
+  if (!xgl_context || !xgl_context->hasWindow()) {
+    return;   // nothing to present in headless mode
+  }
+
   auto sz = camera->getImageSize();
   camera->copyToNormalFrameBuffer();
   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
   int width = 0, height = 0;
-  glfwGetWindowSize(xgl_window, &width, &height);
+  xgl_context->getWindowSize(width, height);
   glBlitFramebuffer(0, 0, sz[0], sz[1], 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-  glfwSwapBuffers(xgl_window);
+  xgl_context->swapBuffers();
 }
 
 XGLIMP(void, Camera, lookAt)(Camera *camera, THDoubleTensor *eye, THDoubleTensor *at, THDoubleTensor *up) {
@@ -289,112 +579,146 @@ XGLIMP(void, Model, loadModel)(Model *model, const char *filePath) {
   model->loadModel(filePath);
 }
 
-XGLIMP(void, Model, getPose)(Model *model, THDoubleTensor *output) {
-  copyMatrix<glm::mat4, 4, 4>(model->getPose(), output);
+// Starts loading filePath into model on the loader threads, see AsyncLoader.
+XGLIMP(ModelLoadHandle *, ModelLoad, new)(Model *model, const char *filePath) {
+  return new ModelLoadHandle(asyncLoader().loadModel(model, filePath));
 }
 
-XGLIMP(void, Model, setPose)(Model *model, THDoubleTensor *input) {
-  model->setPose(Tensor2mat4(input));
+XGLIMP(void, ModelLoad, delete)(ModelLoadHandle *load) {
+  delete load;
 }
 
-void FloatTensorToVertices(THFloatTensor *tensor, std::vector<Vertex> &vertices) {
-  if (tensor == NULL || tensor->nDimension != 2 || tensor->size[1] < 3) {
-    throw XglException("Invalid tensor size");
-  }
+XGLIMP(int, ModelLoad, getState)(ModelLoadHandle *load) {
+  return (int)(*load)->getState();
+}
 
-  tensor = THFloatTensor_newContiguous(tensor);
-  float *data = THFloatTensor_data(tensor);
+XGLIMP(bool, ModelLoad, isDone)(ModelLoadHandle *load) {
+  return (*load)->isDone();
+}
 
-  const int rows = tensor->size[0];
-  const int cols = tensor->size[1];
-  vertices.resize(rows);
+XGLIMP(const char *, ModelLoad, getError)(ModelLoadHandle *load) {
+  return (*load)->getError().c_str();
+}
 
-  for (int i = 0; i < rows; ++i) {
-    Vertex &v = vertices[i];
+XGLIMP(bool, ModelLoad, wait)(ModelLoadHandle *load, double timeout) {
+  return asyncLoader().wait(*load, timeout);
+}
 
-    v.Position[0] = data[0];
-    v.Position[1] = data[1];
-    v.Position[2] = data[2];
+XGLIMP(void, ModelLoad, cancel)(ModelLoadHandle *load) {
+  asyncLoader().cancel(*load);
+}
 
-    if (cols >= 6) {
-      v.Normal = glm::vec3(data[3], data[4], data[5]);
-    }
+XGLIMP(int, _, processUploads)(double maxMilliseconds) {
+  return (int)asyncLoader().processUploads(maxMilliseconds);
+}
 
-    if (cols >= 8) {
-      v.TexCoords = glm::vec2(data[6], data[7]);
-    }
+XGLIMP(void, _, setUploadBudget)(double milliseconds) {
+  asyncLoader().setUploadBudget(milliseconds);
+}
 
-    if (cols >= 12) {
-      v.Color = glm::vec4(data[8], data[9], data[10], data[11]);
-    }
+XGLIMP(void, Model, getPose)(Model *model, THDoubleTensor *output) {
+  copyMatrix<glm::mat4, 4, 4>(model->getPose(), output);
+}
 
-    data += tensor->stride[0];
-  }
+XGLIMP(void, Model, setPose)(Model *model, THDoubleTensor *input) {
+  model->setPose(Tensor2mat4(input));
+}
 
-  THFloatTensor_free(tensor);
+XGLIMP(int, Model, getId)(Model *model) {
+  return (int)model->getId();
 }
 
-void VerticesToFloatTensor(THFloatTensor *verticesToWrite,const std::vector<Vertex> *verticesFromMesh) {
-  int numberOfVertices = verticesFromMesh->size();
-  bool hasNormal = false;
-  bool hasTexCoords = false;
-  bool hasColor = false;
-  int numRows = 3;
+XGLIMP(void, Model, setId)(Model *model, int id) {
+  model->setId((uint32_t)id);
+}
 
-  if (numberOfVertices > 0) {
-    if ((*verticesFromMesh)[0].Normal[0]) {
-      hasNormal = true;
-      numRows += 3;
-    }
+XGLIMP(bool, Model, getFrustumCulling)(Model *model) {
+  return model->getFrustumCulling();
+}
 
-    if ((*verticesFromMesh)[0].TexCoords[0]) {
-      hasTexCoords = true;
-      numRows += 2;
-    }
+XGLIMP(void, Model, setFrustumCulling)(Model *model, bool value) {
+  model->setFrustumCulling(value);
+}
 
-    if ((*verticesFromMesh)[0].Color[0]) {
-      hasColor = true;
-      numRows += 4;
-    }
+XGLIMP(bool, Model, getClipSpace)(Model *model) {
+  return model->getClipSpace();
+}
 
-    //resize tensor to #numVertices x 3 for the three position arguments
-    THFloatTensor_resize2d(verticesToWrite, numberOfVertices, numRows);
+XGLIMP(void, Model, setClipSpace)(Model *model, bool value) {
+  model->setClipSpace(value);
+}
 
-    //get pointer to data
-    float *data = THFloatTensor_data(verticesToWrite);
-    for (int i = 0; i < verticesFromMesh->size(); ++i) {
+XGLIMP(void, Model, generateLods)(Model *model, int levelCount) {
+  if (levelCount < 0) {
+    throw XglException("Invalid level count.");
+  }
+  model->generateLods((uint32_t)levelCount);
+}
 
-      data[0] = (*verticesFromMesh)[i].Position[0];
-      data[1] = (*verticesFromMesh)[i].Position[1];
-      data[2] = (*verticesFromMesh)[i].Position[2];
+// Creates a mesh directly from tensor storage. Only the columns of the vertex tensor have to be
+// dense, rows may be strided; other tensors are made contiguous first.
+std::shared_ptr<Mesh> TensorsToMesh(THFloatTensor *vertices, THIntTensor *indices, const MaterialHandle &material, VertexPrecision precision, bool keepData) {
+  if (vertices == NULL || vertices->nDimension != 2 || vertices->size[1] < 3) {
+    throw XglException("Invalid tensor size");
+  }
+  if (indices == NULL) {
+    throw XglException("Index tensor expected");
+  }
 
-      if (hasNormal) {
-        data[3] = (*verticesFromMesh)[i].Normal[0];
-        data[4] = (*verticesFromMesh)[i].Normal[1];
-        data[5] = (*verticesFromMesh)[i].Normal[2];
-      }
+  THFloatTensor *verticesCopy = vertices->stride[1] == 1 ? nullptr : THFloatTensor_newContiguous(vertices);
+  if (verticesCopy != nullptr) {
+    vertices = verticesCopy;
+  }
+  indices = THIntTensor_newContiguous(indices);
 
-      if (hasTexCoords) {
-        data[6] = (*verticesFromMesh)[i].TexCoords[0];
-        data[7] = (*verticesFromMesh)[i].TexCoords[1];
-      }
+  std::shared_ptr<Mesh> mesh;
+  try {
+    VertexSource source(THFloatTensor_data(vertices), vertices->size[0], vertices->size[1], vertices->stride[0]);
+    const uint32_t *indexData = reinterpret_cast<const uint32_t *>(THIntTensor_data(indices));
+    mesh.reset(new Mesh(source, indexData, THIntTensor_nElement(indices), material, precision, keepData));
+  }
+  catch (...) {
+    if (verticesCopy != nullptr) {
+      THFloatTensor_free(verticesCopy);
+    }
+    THIntTensor_free(indices);
+    throw;
+  }
 
-      if (hasColor) {
-        data[8] = (*verticesFromMesh)[i].Color[0];
-        data[9] = (*verticesFromMesh)[i].Color[1];
-        data[10] = (*verticesFromMesh)[i].Color[2];
-        data[11] = (*verticesFromMesh)[i].Color[3];
-      }
+  if (verticesCopy != nullptr) {
+    THFloatTensor_free(verticesCopy);
+  }
+  THIntTensor_free(indices);
+  return mesh;
+}
+
+// Writes vertices in the tensor format, columns are cut after the last attribute stored in layout
+// (3: position, 6: + normal, 8: + uv, 12: + color).
+void VerticesToFloatTensor(THFloatTensor *verticesToWrite, const std::vector<Vertex> &verticesFromMesh, const VertexLayout &layout) {
+  int numCols = 3;
+  if (layout.getColorEncoding() != AttributeEncoding::None) {
+    numCols = 12;
+  } else if (layout.getTexCoordsEncoding() != AttributeEncoding::None) {
+    numCols = 8;
+  } else if (layout.getNormalEncoding() != AttributeEncoding::None) {
+    numCols = 6;
+  }
 
-      data += verticesToWrite->stride[0];
-    }
+  THFloatTensor_resize2d(verticesToWrite, verticesFromMesh.size(), numCols);
+  THFloatTensor *output = THFloatTensor_newContiguous(verticesToWrite);
+  float *data = THFloatTensor_data(output);
+  for (const Vertex &v : verticesFromMesh) {
+    memcpy(data, &v, numCols * sizeof(float));    // Vertex has the same member order as the tensor rows
+    data += numCols;
   }
+  THFloatTensor_freeCopyTo(output, verticesToWrite);
 }
 
 XGLIMP(void, Mesh, getVertices)(MeshHandle *mesh, THFloatTensor *verticesToWrite) {
-  std::vector<Vertex> *verticesFromMesh = (*mesh)->getVertices();
+  std::vector<Vertex> verticesFromMesh;
+  (*mesh)->getVertices(verticesFromMesh);
 
-  VerticesToFloatTensor(verticesToWrite, verticesFromMesh);
+  VerticesToFloatTensor(verticesToWrite, verticesFromMesh, (*mesh)->getLayout());
 }
 
 XGLIMP(void, Model, addMesh_Tensor)(Model *model, THFloatTensor *vertices, THIntTensor *indices, ShaderHandle *shader, THFloatTensor *color) {
@@ -404,14 +728,7 @@ XGLIMP(void, Model, addMesh_Tensor)(Model *model, THFloatTensor *vertices, THInt
   }
   material->setDiffuseColor(Tensor2vec4(color));
 
-  std::vector<Vertex> vertices_;
-  FloatTensorToVertices(vertices, vertices_);
-
-  std::vector<GLuint> indices_;
-  IntTensorToIndices(indices, indices_);
-
-  std::shared_ptr<Mesh> mesh(new Mesh(vertices_, indices_, material));
-  model->addMesh(mesh);
+  model->addMesh(TensorsToMesh(vertices, indices, material, VertexPrecision::Compact, false));
 }
 
 XGLIMP(void, Model, addMesh)(Model *model, MeshHandle *mesh) {
@@ -514,6 +831,25 @@ XGLIMP(void, Material, updateTextureRGB8)(MaterialHandle *material, int index, i
   THByteTensor_free(image_);
 }
 
+// Uploads an 8 bit image (height x width for gray, height x width x channels otherwise) to a
+// streaming texture, the pixels are not copied or converted on the CPU.
+XGLIMP(void, Material, updateStreamingTexture)(MaterialHandle *material, int index, THByteTensor *image, int format, bool flipV = true, bool generateMipmap = false) {
+  const PixelFormat format_ = static_cast<PixelFormat>(format);
+  const int channels = StreamingTexture::getChannelCount(format_);
+  if (image == NULL || (!(image->nDimension == 2 && channels == 1) && !(image->nDimension == 3 && image->size[2] == channels))) {
+    throw XglException("Image dimensions do not match the pixel format.");
+  }
+
+  THByteTensor *image_ = THByteTensor_newContiguous(image);
+  try {
+    (*material)->updateStreamingTexture(index, image_->size[1], image_->size[0], format_, THByteTensor_data(image_), flipV, generateMipmap);
+  } catch (...) {
+    THByteTensor_free(image_);
+    throw;
+  }
+  THByteTensor_free(image_);
+}
+
 
 XGLIMP(MeshHandle *, Mesh, new)() {
   return new MeshHandle();
@@ -523,14 +859,78 @@ XGLIMP(void, Mesh, delete)(MeshHandle *mesh) {
   delete mesh;
 }
 
-XGLIMP(void, Mesh, create)(MeshHandle *mesh, THFloatTensor *vertices, THIntTensor *indices, MaterialHandle *material) {
-  std::vector<Vertex> vertices_;
-  FloatTensorToVertices(vertices, vertices_);
+XGLIMP(void, Mesh, create)(MeshHandle *mesh, THFloatTensor *vertices, THIntTensor *indices, MaterialHandle *material, int precision, bool keepData) {
+  *mesh = TensorsToMesh(vertices, indices, material != nullptr ? *material : MaterialHandle(), static_cast<VertexPrecision>(precision), keepData);
+}
+
+XGLIMP(bool, Mesh, hasData)(MeshHandle *mesh) {
+  return (*mesh)->hasData();
+}
+
+XGLIMP(double, Mesh, getGpuMemorySize)(MeshHandle *mesh) {
+  return (double)(*mesh)->getGpuMemorySize();
+}
+
+// offset < 0 replaces all vertices, otherwise rows are written starting at vertex offset.
+XGLIMP(void, Mesh, updateVertices)(MeshHandle *mesh, THFloatTensor *vertices, int offset) {
+  if (vertices == NULL || vertices->nDimension != 2 || vertices->size[1] < 3) {
+    throw XglException("Invalid tensor size");
+  }
+
+  THFloatTensor *verticesCopy = vertices->stride[1] == 1 ? nullptr : THFloatTensor_newContiguous(vertices);
+  if (verticesCopy != nullptr) {
+    vertices = verticesCopy;
+  }
+
+  try {
+    VertexSource source(THFloatTensor_data(vertices), vertices->size[0], vertices->size[1], vertices->stride[0]);
+    if (offset < 0) {
+      (*mesh)->setVertices(source);
+    } else {
+      (*mesh)->updateVertices(source, offset);
+    }
+  }
+  catch (...) {
+    if (verticesCopy != nullptr) {
+      THFloatTensor_free(verticesCopy);
+    }
+    throw;
+  }
+
+  if (verticesCopy != nullptr) {
+    THFloatTensor_free(verticesCopy);
+  }
+}
+
+// offset < 0 replaces all indices, otherwise indices are written starting at offset.
+XGLIMP(void, Mesh, updateIndices)(MeshHandle *mesh, THIntTensor *indices, int offset) {
+  if (indices == NULL) {
+    throw XglException("Index tensor expected");
+  }
+
+  indices = THIntTensor_newContiguous(indices);
+  try {
+    const uint32_t *indexData = reinterpret_cast<const uint32_t *>(THIntTensor_data(indices));
+    const size_t count = THIntTensor_nElement(indices);
+    if (offset < 0) {
+      (*mesh)->setIndices(indexData, count);
+    } else {
+      (*mesh)->updateIndices(indexData, count, offset);
+    }
+  }
+  catch (...) {
+    THIntTensor_free(indices);
+    throw;
+  }
+  THIntTensor_free(indices);
+}
 
-  std::vector<GLuint> indices_;
-  IntTensorToIndices(indices, indices_);
+XGLIMP(int, Mesh, getVertexCount)(MeshHandle *mesh) {
+  return (int)(*mesh)->getVertexCount();
+}
 
-  mesh->reset(new Mesh(vertices_, indices_, material != nullptr ? *material : MaterialHandle()));
+XGLIMP(int, Mesh, getIndexCount)(MeshHandle *mesh) {
+  return (int)(*mesh)->getIndexCount();
 }
 
 XGLIMP(void, Mesh, release)(MeshHandle *mesh) {
@@ -550,6 +950,40 @@ XGLIMP(void, Mesh, setMaterial)(MeshHandle *mesh, MaterialHandle *input) {
 }
 
 
+XGLIMP(Model *, InstancedModel, new)(MeshHandle *mesh, ShaderHandle *defaultShader) {
+  return new InstancedModel(mesh != nullptr ? *mesh : MeshHandle(), defaultShader != nullptr ? *defaultShader : ShaderHandle());
+}
+
+XGLIMP(void, InstancedModel, delete)(Model *model) {
+  delete model;
+}
+
+InstancedModel *asInstancedModel(Model *model) {
+  InstancedModel *instanced = dynamic_cast<InstancedModel *>(model);
+  if (instanced == nullptr) {
+    throw XglException("Model is not an instanced model.");
+  }
+  return instanced;
+}
+
+XGLIMP(void, InstancedModel, setInstances)(Model *model, THDoubleTensor *transforms, THFloatTensor *colors) {
+  std::vector<glm::mat4> transforms_;
+  if (transforms != nullptr && THDoubleTensor_nElement(transforms) > 0) {
+    Tensor2mat4Array(transforms, transforms_);
+  }
+
+  std::vector<glm::vec4> colors_;
+  if (colors != nullptr && THFloatTensor_nElement(colors) > 0) {
+    Tensor2vec4Array(colors, colors_);
+  }
+
+  asInstancedModel(model)->setInstances(transforms_, colors_);
+}
+
+XGLIMP(int, InstancedModel, getInstanceCount)(Model *model) {
+  return (int)asInstancedModel(model)->getInstanceCount();
+}
+
 XGLIMP(SimpleScene *, SimpleScene, new)() {
   return new SimpleScene();
 }
@@ -566,6 +1000,85 @@ XGLIMP(void, SimpleScene, renderDepth)(SimpleScene *scene) {
   scene->render(RenderTargetType::Depth);
 }
 
+// Renders color, linear depth, normals and ids in one pass, see Camera::copyGBuffer.
+XGLIMP(void, SimpleScene, renderGBuffer)(SimpleScene *scene) {
+  scene->render(RenderTargetType::GBuffer);
+}
+
+XGLIMP(void, SimpleScene, renderPoses)(SimpleScene *scene, Model *model, THDoubleTensor *poses, bool depth) {
+  std::vector<glm::mat4> poses_;
+  Tensor2mat4Array(poses, poses_);
+  scene->renderPoses(model, poses_, depth ? RenderTargetType::Depth : RenderTargetType::MultiSampling);
+}
+
+XGLIMP(void, SimpleScene, renderViews)(SimpleScene *scene, THDoubleTensor *views, bool depth) {
+  std::vector<glm::mat4> views_;
+  Tensor2mat4Array(views, views_);
+  scene->renderViews(views_, depth ? RenderTargetType::Depth : RenderTargetType::MultiSampling);
+}
+
+// Writes ray hits to distances (N, NaN without hit), ids (Nx3: model id, mesh index + 1 and
+// triangle index + 1 like the G-buffer id image, 0 without hit) and barycentrics (Nx2).
+static void copyRayHits(const std::vector<RayHit> &hits, THFloatTensor *distances, THIntTensor *ids, THFloatTensor *barycentrics) {
+  const long count = (long)hits.size();
+  THFloatTensor_resize1d(distances, count);
+  THIntTensor_resize2d(ids, count, 3);
+  THFloatTensor_resize2d(barycentrics, count, 2);
+  THFloatTensor *distances_ = THFloatTensor_newContiguous(distances);
+  THIntTensor *ids_ = THIntTensor_newContiguous(ids);
+  THFloatTensor *barycentrics_ = THFloatTensor_newContiguous(barycentrics);
+  float *d = THFloatTensor_data(distances_);
+  int *id = THIntTensor_data(ids_);
+  float *b = THFloatTensor_data(barycentrics_);
+  for (long i = 0; i < count; ++i) {
+    const RayHit &hit = hits[i];
+    const bool found = hit.model != nullptr;
+    d[i] = found ? hit.distance : std::numeric_limits<float>::quiet_NaN();
+    id[i * 3] = found ? (int)hit.model->getId() : 0;
+    id[i * 3 + 1] = found ? (int)hit.meshIndex + 1 : 0;
+    id[i * 3 + 2] = hit.triangle + 1;
+    b[i * 2] = hit.barycentrics.x;
+    b[i * 2 + 1] = hit.barycentrics.y;
+  }
+  THFloatTensor_freeCopyTo(distances_, distances);
+  THIntTensor_freeCopyTo(ids_, ids);
+  THFloatTensor_freeCopyTo(barycentrics_, barycentrics);
+}
+
+// Casts rays (Nx6: origin, direction in world coordinates) against the scene meshes on the CPU.
+XGLIMP(void, SimpleScene, castRays)(SimpleScene *scene, THFloatTensor *rays, float maxDistance, THFloatTensor *distances, THIntTensor *ids, THFloatTensor *barycentrics) {
+  if (rays == NULL || rays->nDimension != 2 || rays->size[1] != 6) {
+    throw XglException("Rays must be a Nx6 tensor.");
+  }
+  THFloatTensor *rays_ = THFloatTensor_newContiguous(rays);
+  std::vector<Ray> rays__(rays_->size[0]);
+  std::copy(THFloatTensor_data(rays_), THFloatTensor_data(rays_) + rays__.size() * 6, reinterpret_cast<float *>(rays__.data()));
+  THFloatTensor_free(rays_);
+
+  std::vector<RayHit> hits(rays__.size());
+  scene->castRays(rays__.data(), rays__.size(), maxDistance, hits.data());
+  copyRayHits(hits, distances, ids, barycentrics);
+}
+
+// Casts camera rays through pixel positions (Nx2), see Camera::getPixelRay.
+XGLIMP(void, SimpleScene, castPixelRays)(SimpleScene *scene, THFloatTensor *pixels, bool vflip, float maxDistance, THFloatTensor *distances, THIntTensor *ids, THFloatTensor *barycentrics) {
+  if (pixels == NULL || pixels->nDimension != 2 || pixels->size[1] != 2) {
+    throw XglException("Pixel positions must be a Nx2 tensor.");
+  }
+  THFloatTensor *pixels_ = THFloatTensor_newContiguous(pixels);
+  std::vector<glm::vec2> pixels__(pixels_->size[0]);
+  std::copy(THFloatTensor_data(pixels_), THFloatTensor_data(pixels_) + pixels__.size() * 2, reinterpret_cast<float *>(pixels__.data()));
+  THFloatTensor_free(pixels_);
+
+  std::vector<RayHit> hits(pixels__.size());
+  scene->castPixelRays(pixels__.data(), pixels__.size(), vflip, maxDistance, hits.data());
+  copyRayHits(hits, distances, ids, barycentrics);
+}
+
+XGLIMP(void, SimpleScene, getRenderStats)(SimpleScene *scene, RenderStats *stats) {
+  *stats = scene->getRenderStats();
+}
+
 XGLIMP(void, SimpleScene, setClearColor)(SimpleScene *scene, float r, float g, float b, float a) {
   scene->setClearColor(r, g, b, a);
 }
@@ -578,6 +1091,38 @@ XGLIMP(void, SimpleScene, setOverrideMaterial)(SimpleScene *scene, MaterialHandl
   scene->setOverrideMaterial(input != nullptr ? *input : MaterialHandle());
 }
 
+XGLIMP(bool, SimpleScene, getFrustumCulling)(SimpleScene *scene) {
+  return scene->getFrustumCulling();
+}
+
+XGLIMP(void, SimpleScene, setFrustumCulling)(SimpleScene *scene, bool value) {
+  scene->setFrustumCulling(value);
+}
+
+XGLIMP(bool, SimpleScene, getOcclusionCulling)(SimpleScene *scene) {
+  return scene->getOcclusionCulling();
+}
+
+XGLIMP(void, SimpleScene, setOcclusionCulling)(SimpleScene *scene, bool value) {
+  scene->setOcclusionCulling(value);
+}
+
+XGLIMP(float, SimpleScene, getLodThreshold)(SimpleScene *scene) {
+  return scene->getLodThreshold();
+}
+
+XGLIMP(void, SimpleScene, setLodThreshold)(SimpleScene *scene, float pixels) {
+  scene->setLodThreshold(pixels);
+}
+
+XGLIMP(int, SimpleScene, getForcedLod)(SimpleScene *scene) {
+  return scene->getForcedLod();
+}
+
+XGLIMP(void, SimpleScene, setForcedLod)(SimpleScene *scene, int level) {
+  scene->setForcedLod(level);
+}
+
 XGLIMP(void, SimpleScene, setCamera)(SimpleScene *scene, Camera *camera) {
   scene->setCamera(camera);
 }
@@ -610,9 +1155,10 @@ XGLIMP(void, SimpleScene, addQuad)(
 
   if (textureFilename != nullptr) {
     Texture texture;
-    texture.id = loadTextureFromFile(textureFilename, true);
+    texture.object = textureCache().acquire(textureFilename, true);
+    texture.id = texture.object->getId();
     printf("texture id: %d (%s)\n", texture.id, textureFilename);
-    texture.type = "texture_diffuse";
+    texture.type = TextureType::Diffuse;
     texture.path = textureFilename;
 
     quadMaterial->addTexture(texture);
@@ -621,6 +1167,10 @@ XGLIMP(void, SimpleScene, addQuad)(
   quadMesh->setMaterial(quadMaterial);
   model->addMesh(quadMesh);
 
+  // quads drawn by shaders without a projection (e.g. FullScreen) cover the viewport
+  Shader *quadShader = model->getEffectiveShader(*quadMaterial);
+  model->setClipSpace(quadShader != nullptr && !quadShader->getStandardUniforms().projection.valid());
+
   scene->addModel(model);
 }
 
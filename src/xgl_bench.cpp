@@ -0,0 +1,500 @@
+// Render and readback benchmark. Renders generated scenes (N models with M sphere meshes each) at
+// several resolutions through SimpleScene and times the stages of every frame: color render,
+// RGB readback, depth render, depth readback and CPU unprojection. Results are written as JSON,
+// e.g. to track the effect of changes between commits:
+//
+//   xgl_bench --models 1,16 --meshes 1,16 --resolutions 640x480,1920x1080 --output bench.json
+//
+// Runs window-less on EGL by default; with Mesa, LIBGL_ALWAYS_SOFTWARE=1 selects the software
+// rasterizer. Scenes, camera and frame counts are fixed by the options, so runs are repeatable.
+
+#include "xamla-gl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+// GLM Mathemtics
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// GLEW
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+// GLFW
+#include <GLFW/glfw3.h>
+
+#include "utils.h"
+#include "context.h"
+#include "gl_state.h"
+#include "revision.h"
+#include "camera.h"
+#include "shader.h"
+#include "model.h"
+#include "instanced_model.h"
+#include "async_loader.h"
+
+#include "simple_scene.h"
+
+
+static const char *COLOR_VERTEX_SHADER = R"(#version 330 core
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+out vec3 FragPos;
+out vec3 Normal;
+void main() {
+  gl_Position = projection * view * model * vec4(position, 1.0f);
+  FragPos = vec3(model * vec4(position, 1.0f));
+  Normal = mat3(transpose(inverse(model))) * normal;
+}
+)";
+
+static const char *COLOR_FRAGMENT_SHADER = R"(#version 330 core
+struct Material {
+  vec3 diffuse;
+  float shininess;
+  float opacity;
+};
+uniform Material material;
+uniform vec3 lightPos;
+uniform vec3 lightColor;
+uniform vec3 viewPos;
+in vec3 FragPos;
+in vec3 Normal;
+out vec4 color;
+void main() {
+  vec3 norm = normalize(Normal);
+  vec3 lightDir = normalize(lightPos - FragPos);
+  vec3 reflectDir = reflect(-lightDir, norm);
+  float diffuse = max(dot(norm, lightDir), 0.0);
+  float specular = 0.5 * pow(max(dot(normalize(viewPos - FragPos), reflectDir), 0.0), 32);
+  color = vec4((0.2 + diffuse + specular) * lightColor * material.diffuse, material.opacity);
+}
+)";
+
+// same as the default depth shader of the Lua package, linear depth in the red channel
+static const char *DEPTH_VERTEX_SHADER = R"(#version 330 core
+layout (location = 0) in vec3 position;
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+void main() {
+  gl_Position = projection * view * model * vec4(position, 1.0f);
+}
+)";
+
+static const char *DEPTH_FRAGMENT_SHADER = R"(#version 330 core
+out float color;
+void main() {
+  color = 1.0 / gl_FragCoord.w;
+}
+)";
+
+
+struct Scenario {
+  int models;
+  int meshes;
+  int width;
+  int height;
+};
+
+
+// Durations of one stage over the measured frames.
+struct Stage {
+  const char *name;
+  double bytesPerFrame;       // data produced by the stage, 0 if it only renders
+  std::vector<double> milliseconds;
+};
+
+
+struct Options {
+  std::string backend;
+  std::vector<int> models;
+  std::vector<int> meshes;
+  std::vector<glm::ivec2> resolutions;
+  int segments;
+  int samples;
+  int warmup;
+  int frames;
+  std::string output;
+};
+
+
+static std::vector<std::string> split(const std::string &list, char separator) {
+  std::vector<std::string> parts;
+  std::stringstream stream(list);
+  std::string part;
+  while (std::getline(stream, part, separator)) {
+    parts.push_back(part);
+  }
+  return parts;
+}
+
+static int parsePositive(const std::string &text, const char *what) {
+  char *end = nullptr;
+  const long value = std::strtol(text.c_str(), &end, 10);
+  if (text.empty() || *end != 0 || value <= 0 || value > std::numeric_limits<int>::max()) {
+    throw XglException(string_format("Invalid %s '%s'.", what, text.c_str()));
+  }
+  return (int)value;
+}
+
+static std::vector<int> parseCounts(const std::string &list, const char *what) {
+  std::vector<int> counts;
+  for (const std::string &part : split(list, ',')) {
+    counts.push_back(parsePositive(part, what));
+  }
+  return counts;
+}
+
+static std::vector<glm::ivec2> parseResolutions(const std::string &list) {
+  std::vector<glm::ivec2> resolutions;
+  for (const std::string &part : split(list, ',')) {
+    const std::vector<std::string> size = split(part, 'x');
+    if (size.size() != 2) {
+      throw XglException(string_format("Invalid resolution '%s', expected WIDTHxHEIGHT.", part.c_str()));
+    }
+    resolutions.push_back(glm::ivec2(parsePositive(size[0], "width"), parsePositive(size[1], "height")));
+  }
+  return resolutions;
+}
+
+
+// UV sphere, the poles are closed by single triangles.
+static void createSphere(const glm::vec3 &center, float radius, int segments, std::vector<Vertex> &vertices, std::vector<GLuint> &indices) {
+  const int rings = std::max(2, segments / 2);
+  const float pi = 3.14159265358979f;
+  for (int r = 0; r <= rings; ++r) {
+    for (int s = 0; s <= segments; ++s) {
+      const float theta = pi * r / rings, phi = 2 * pi * s / segments;
+      Vertex v;
+      v.Normal = glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+      v.Position = center + v.Normal * radius;
+      v.TexCoords = glm::vec2((float)s / segments, (float)r / rings);
+      v.Color = glm::vec4(0, 0, 0, 0);
+      vertices.push_back(v);
+    }
+  }
+  for (int r = 0; r < rings; ++r) {
+    for (int s = 0; s < segments; ++s) {
+      const GLuint a = r * (segments + 1) + s, b = a + segments + 1;
+      if (r != 0) {
+        indices.insert(indices.end(), { a, a + 1, b });
+      }
+      if (r != rings - 1) {
+        indices.insert(indices.end(), { a + 1, b + 1, b });
+      }
+    }
+  }
+}
+
+
+class Benchmark {
+public:
+  explicit Benchmark(const Options &options)
+    : options(options) {
+    colorShader = std::make_shared<Shader>();
+    colorShader->create(COLOR_VERTEX_SHADER, COLOR_FRAGMENT_SHADER);
+    std::shared_ptr<Shader> depthShader = std::make_shared<Shader>();
+    depthShader->create(DEPTH_VERTEX_SHADER, DEPTH_FRAGMENT_SHADER);
+    depthMaterial = std::make_shared<Material>();
+    depthMaterial->setShader(depthShader);
+  }
+
+  void run(const Scenario &scenario, std::ostream &json) {
+    // models on a square grid in the z = 0 plane, the meshes of a model on a circle around its origin
+    std::vector<std::unique_ptr<Model> > models;
+    const int columns = (int)std::ceil(std::sqrt((double)scenario.models));
+    const float pi = 3.14159265358979f;
+    const float radius = scenario.meshes == 1 ? 0.3f : std::min(0.15f, 0.3f * std::sin(pi / scenario.meshes));
+    size_t triangles = 0;
+    for (int i = 0; i < scenario.models; ++i) {
+      std::unique_ptr<Model> model(new Model(colorShader));
+      model->setPose(glm::translate(glm::mat4(1.0f), glm::vec3(i % columns, i / columns, 0)));
+      for (int j = 0; j < scenario.meshes; ++j) {
+        const float angle = 2 * pi * j / scenario.meshes;
+        const glm::vec3 center = scenario.meshes == 1 ? glm::vec3(0, 0, 0) : glm::vec3(std::cos(angle), std::sin(angle), 0) * 0.3f;
+        std::vector<Vertex> vertices;
+        std::vector<GLuint> indices;
+        createSphere(center, radius, options.segments, vertices, indices);
+        triangles += indices.size() / 3;
+
+        auto material = std::make_shared<Material>();
+        material->setShader(colorShader);
+        material->setDiffuseColor(glm::vec4(0.3f + 0.7f * (j % 3 == 0), 0.3f + 0.7f * (j % 3 == 1), 0.3f + 0.7f * (j % 3 == 2), 1));
+        model->addMesh(std::make_shared<Mesh>(vertices, indices, material));
+      }
+      models.push_back(std::move(model));
+    }
+
+    // the whole grid in view
+    Camera camera;
+    const int w = scenario.width, h = scenario.height;
+    const float focalLength = 0.9f * w;
+    camera.setImageSize(w, h);
+    camera.setIntrinsics(focalLength, focalLength, w * 0.5f, h * 0.5f);
+    camera.setClipNearFar(0.1f, 1000.0f);
+    camera.setMultiSampleCount(options.samples);
+    const glm::vec3 center((columns - 1) * 0.5f, ((scenario.models - 1) / columns) * 0.5f, 0);
+    const float distance = 1.05f * columns * 0.5f * focalLength / (std::min(w, h) * 0.5f);
+    camera.lookAt(center + glm::vec3(0, 0, distance), center, glm::vec3(0, 1, 0));
+
+    SimpleScene scene;
+    scene.setCamera(&camera);
+    for (const std::unique_ptr<Model> &model : models) {
+      scene.addModel(model.get());
+    }
+
+    std::vector<uint8_t> color((size_t)w * h * 3);
+    std::vector<float> depth((size_t)w * h);
+    std::vector<float> points((size_t)w * h * 3);
+    const PointOutput pointOutput = { points.data(), 3, (size_t)w * 3 };
+
+    Stage stages[] = {
+      { "color", 0, {} },
+      { "readback_rgb", (double)color.size(), {} },
+      { "depth", 0, {} },
+      { "readback_depth", (double)depth.size() * sizeof(float), {} },
+      { "unproject", (double)points.size() * sizeof(float), {} }
+    };
+    std::vector<double> frameMilliseconds;
+    RenderStats renderStats = RenderStats();
+
+    typedef std::chrono::steady_clock Clock;
+    auto elapsed = [](Clock::time_point begin, Clock::time_point end) {
+      return std::chrono::duration<double, std::milli>(end - begin).count();
+    };
+
+    for (int frame = 0; frame < options.warmup + options.frames; ++frame) {
+      Clock::time_point t[6];
+      t[0] = Clock::now();
+      scene.setOverrideMaterial(nullptr);
+      scene.setClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+      scene.render(RenderTargetType::MultiSampling);
+      glFinish();
+      t[1] = Clock::now();
+      camera.getReadbackRing().collect(camera.beginReadback(ReadbackFormat::RGB8), color.data(), false);
+      t[2] = Clock::now();
+      renderStats = scene.getRenderStats();
+      scene.setOverrideMaterial(depthMaterial);
+      scene.setClearColor(std::numeric_limits<float>::quiet_NaN(), 0, 0, 1);
+      scene.render(RenderTargetType::Depth);
+      glFinish();
+      t[3] = Clock::now();
+      camera.getReadbackRing().collect(camera.beginReadback(ReadbackFormat::F32), depth.data(), false);
+      t[4] = Clock::now();
+      camera.unprojectDepthImage(depth.data(), (size_t)w, pointOutput, PointCloudFrame::Camera, 0, std::numeric_limits<float>::infinity());
+      t[5] = Clock::now();
+
+      if (frame >= options.warmup) {
+        for (size_t i = 0; i < 5; ++i) {
+          stages[i].milliseconds.push_back(elapsed(t[i], t[i + 1]));
+        }
+        frameMilliseconds.push_back(elapsed(t[0], t[5]));
+      }
+    }
+
+    const GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+      throw XglException(string_format("OpenGL error 0x%04x in scenario %dx%d models x meshes at %dx%d.", error, scenario.models, scenario.meshes, w, h));
+    }
+
+    // fraction of pixels with geometry, a check that the scene is in view
+    size_t covered = 0;
+    for (float d : depth) {
+      covered += std::isfinite(d) && d > 0;
+    }
+
+    double totalMilliseconds = 0;
+    for (double ms : frameMilliseconds) {
+      totalMilliseconds += ms;
+    }
+
+    json << "    {\n";
+    json << "      \"models\": " << scenario.models << ",\n";
+    json << "      \"meshes_per_model\": " << scenario.meshes << ",\n";
+    json << "      \"triangles\": " << triangles << ",\n";
+    json << "      \"width\": " << w << ",\n";
+    json << "      \"height\": " << h << ",\n";
+    json << "      \"coverage\": " << (double)covered / depth.size() << ",\n";
+    json << "      \"draw_calls\": " << renderStats.drawCalls << ",\n";
+    json << "      \"fps\": ";
+    writeRate(json, options.frames * 1000.0, totalMilliseconds);
+    json << ",\n";
+    json << "      \"frame_ms\": ";
+    writePercentiles(frameMilliseconds, json, 0);
+    json << ",\n      \"stages\": {\n";
+    for (size_t i = 0; i < 5; ++i) {
+      const Stage &stage = stages[i];
+      json << "        \"" << stage.name << "\": ";
+      writePercentiles(stage.milliseconds, json, stage.bytesPerFrame);
+      json << (i + 1 < 5 ? ",\n" : "\n");
+    }
+    json << "      }\n";
+    json << "    }";
+  }
+
+private:
+  const Options &options;
+  std::shared_ptr<Shader> colorShader;
+  std::shared_ptr<Material> depthMaterial;
+
+  // Nearest-rank percentile of sorted values.
+  static double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+      return 0;
+    }
+    const size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+  }
+
+  // Writes amount / duration, null if the duration is not positive (JSON has no inf or nan).
+  static void writeRate(std::ostream &json, double amount, double duration) {
+    if (duration > 0) {
+      json << amount / duration;
+    } else {
+      json << "null";
+    }
+  }
+
+  // Duration statistics in milliseconds, with the throughput at the median duration if the
+  // stage produces data.
+  static void writePercentiles(const std::vector<double> &values, std::ostream &json, double bytes) {
+    std::vector<double> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    double mean = 0;
+    for (double v : sorted) {
+      mean += v;
+    }
+    mean = sorted.empty() ? 0 : mean / sorted.size();
+    json << "{ \"mean\": " << mean << ", \"p50\": " << percentile(sorted, 50) << ", \"p90\": " << percentile(sorted, 90)
+      << ", \"p99\": " << percentile(sorted, 99) << ", \"max\": " << (sorted.empty() ? 0 : sorted.back());
+    if (bytes > 0) {
+      json << ", \"mb_per_s\": ";
+      writeRate(json, bytes / (1024.0 * 1024.0) * 1000.0, percentile(sorted, 50));
+    }
+    json << " }";
+  }
+};
+
+
+static std::string jsonString(const char *text) {
+  std::string result = "\"";
+  for (const char *c = text != nullptr ? text : ""; *c != 0; ++c) {
+    if (*c == '"' || *c == '\\') {
+      result += '\\';
+      result += *c;
+    } else if ((unsigned char)*c < 0x20) {
+      result += string_format("\\u%04x", (int)(unsigned char)*c);
+    } else {
+      result += *c;
+    }
+  }
+  return result + "\"";
+}
+
+
+int main(int argc, char **argv) {
+  namespace po = boost::program_options;
+
+  Options options;
+  std::string models, meshes, resolutions;
+  po::options_description description("xgl_bench options");
+  description.add_options()
+    ("help,h", "print this help")
+    ("backend", po::value<std::string>(&options.backend)->default_value("egl"), "context backend: egl, glfw or auto")
+    ("models", po::value<std::string>(&models)->default_value("1,16"), "comma separated model counts")
+    ("meshes", po::value<std::string>(&meshes)->default_value("1,16"), "comma separated mesh counts per model")
+    ("resolutions", po::value<std::string>(&resolutions)->default_value("640x480,1920x1080"), "comma separated image sizes (WIDTHxHEIGHT)")
+    ("segments", po::value<int>(&options.segments)->default_value(64), "sphere segments around the equator")
+    ("samples", po::value<int>(&options.samples)->default_value(4), "multi-sample count of the color target")
+    ("warmup", po::value<int>(&options.warmup)->default_value(10), "frames rendered before measuring")
+    ("frames", po::value<int>(&options.frames)->default_value(100), "measured frames per scenario")
+    ("output,o", po::value<std::string>(&options.output)->default_value("-"), "JSON output file, - for stdout");
+
+  try {
+    po::variables_map variables;
+    po::store(po::parse_command_line(argc, argv, description), variables);
+    po::notify(variables);
+    if (variables.count("help")) {
+      std::cout << description << std::endl;
+      return 0;
+    }
+
+    options.models = parseCounts(models, "model count");
+    options.meshes = parseCounts(meshes, "mesh count");
+    options.resolutions = parseResolutions(resolutions);
+    if (options.segments < 3 || options.samples < 0 || options.warmup < 0 || options.frames <= 0) {
+      throw XglException("Invalid segment, sample or frame count.");
+    }
+
+    std::unique_ptr<RenderContext> context = createRenderContext(options.backend, false, 16, 16);
+    glewExperimental = GL_TRUE;
+    const GLenum glewStatus = glewInit();
+    if (glewStatus != GLEW_OK && glewStatus != GLEW_ERROR_NO_GLX_DISPLAY) {   // GLX is not needed for EGL contexts
+      throw XglException(string_format("GLEW initialization failed: %s", (const char *)glewGetErrorString(glewStatus)));
+    }
+    glGetError();   // clear error flag potentially left by glewInit
+    VertexLayout::setDefaultAttributeValues();
+    InstancedModel::setDefaultInstanceAttributes();
+
+    std::ofstream file;
+    if (options.output != "-") {
+      file.open(options.output.c_str());
+      if (!file) {
+        throw XglException(string_format("Cannot open output file '%s'.", options.output.c_str()));
+      }
+    }
+    std::ostringstream json;
+    json.precision(6);
+
+    json << "{\n";
+    json << "  \"backend\": " << jsonString(context->getName()) << ",\n";
+    json << "  \"renderer\": " << jsonString((const char *)glGetString(GL_RENDERER)) << ",\n";
+    json << "  \"gl_version\": " << jsonString((const char *)glGetString(GL_VERSION)) << ",\n";
+    json << "  \"warmup\": " << options.warmup << ",\n";
+    json << "  \"frames\": " << options.frames << ",\n";
+    json << "  \"segments\": " << options.segments << ",\n";
+    json << "  \"samples\": " << options.samples << ",\n";
+    json << "  \"scenarios\": [\n";
+    {
+      Benchmark benchmark(options);
+      bool first = true;
+      for (const glm::ivec2 &resolution : options.resolutions) {
+        for (int modelCount : options.models) {
+          for (int meshCount : options.meshes) {
+            json << (first ? "" : ",\n");
+            first = false;
+            const Scenario scenario = { modelCount, meshCount, resolution.x, resolution.y };
+            benchmark.run(scenario, json);
+          }
+        }
+      }
+    }
+    json << "\n  ]\n}\n";
+
+    (options.output != "-" ? static_cast<std::ostream &>(file) : std::cout) << json.str();
+    renderTargetPool().trim(0);
+    textureCache().trim(0);
+  }
+  catch (const std::exception &e) {
+    std::cerr << "xgl_bench: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}